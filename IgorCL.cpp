@@ -22,6 +22,9 @@ this program with Igor Pro, developed by WaveMetrics Inc. (www.wavemetrics.com).
 #include "XOPStandardHeaders.h"			// Include ANSI headers, Mac headers, IgorXOP.h, XOP.h and XOPSupport.h
 #include <vector>
 #include <stdexcept>
+#include <chrono>
+#include <algorithm>
+#include <cctype>
 
 #include "IgorCL.h"
 #include "IgorCLOperations.h"
@@ -50,6 +53,11 @@ struct IgorCLRuntimeParams {
 	Handle DTYPFlag_deviceType;
 	int DTYPFlagParamsSet[1];
     
+	// Parameters for /DSEL flag group.
+	int DSELFlagEncountered;
+	Handle DSELFlag_deviceSelector;
+	int DSELFlagParamsSet[1];
+    
 	// Parameters for /SRCT flag group.
 	int SRCTFlagEncountered;
 	Handle SRCTFlag_sourceText;
@@ -65,6 +73,10 @@ struct IgorCLRuntimeParams {
 	Handle KERNFlag_kernelName;
 	int KERNFlagParamsSet[1];
     
+	// Parameters for /TMPL flag group.
+	int TMPLFlagEncountered;
+	// There are no fields for this group because it has no parameters.
+    
 	// Parameters for /GSZE flag group.
 	int GSZEFlagEncountered;
 	double GSZEFlag_globalSize0;
@@ -84,6 +96,23 @@ struct IgorCLRuntimeParams {
 	waveHndl MFLGFlag_memoryFlagsWave;
 	int MFLGFlagParamsSet[1];
     
+	// Parameters for /FILV flag group.
+	int FILVFlagEncountered;
+	waveHndl FILVFlag_fillValuesWave;
+	int FILVFlagParamsSet[1];
+    
+	// Parameters for /WAVES flag group.
+	int WAVESFlagEncountered;
+	waveHndl WAVESFlag_argumentWaves;
+	int WAVESFlagParamsSet[1];
+    
+	// Parameters for /SCLR flag group.
+	int SCLRFlagEncountered;
+	waveHndl SCLRFlag_scalarValues;
+	waveHndl SCLRFlag_scalarTypes;
+	waveHndl SCLRFlag_scalarIndices;
+	int SCLRFlagParamsSet[3];
+    
 	// Parameters for /Z flag group.
 	int ZFlagEncountered;
 	double ZFlag_quiet;						// Optional parameter.
@@ -125,6 +154,11 @@ struct IgorCLCompileRuntimeParams {
 	Handle DTYPFlag_deviceType;
 	int DTYPFlagParamsSet[1];
     
+	// Parameters for /DSEL flag group.
+	int DSELFlagEncountered;
+	Handle DSELFlag_deviceSelector;
+	int DSELFlagParamsSet[1];
+    
 	// Parameters for /DEST flag group.
 	int DESTFlagEncountered;
 	DataFolderAndName DESTFlag_destination;
@@ -167,347 +201,948 @@ typedef struct IgorCLInfoRuntimeParams IgorCLInfoRuntimeParams;
 typedef struct IgorCLInfoRuntimeParams* IgorCLInfoRuntimeParamsPtr;
 #pragma pack()	// Reset structure alignment to default.
 
-static int ExecuteIgorCL(IgorCLRuntimeParamsPtr p) {
-	int err = 0;
-    bool quiet = false;
+// Runtime param structure for IgorCLSettings operation.
+#pragma pack(2)	// All structures passed to Igor are two-byte aligned.
+struct IgorCLSettingsRuntimeParams {
+	// Flag parameters.
     
-    try {
-        // Flag parameters.
-        
-        int platformIndex = 0;
-        if (p->PLTMFlagEncountered) {
-            // Parameter: p->PLTMFlag_platform
-            if (p->PLTMFlag_platform < 0)
-                return EXPECT_POS_NUM;
-            platformIndex = p->PLTMFlag_platform + 0.5;
-        }
-        
-        // only one of /DEV or /DTYP flags may be specified
-        if (p->DEVFlagEncountered && p->DTYPFlagEncountered) {
-            XOPNotice("Only one of the /DEV or /DTYP flags may be specified\r");
-            return SYNERR;
-        }
-        int deviceIndex = 0;
-        if (p->DEVFlagEncountered) {
-            // Parameter: p->DEVFlag_device
-            if (p->DEVFlag_device < 0)
-                return EXPECT_POS_NUM;
-            deviceIndex = p->DEVFlag_device + 0.5;
-        }
-        
-        if (p->DTYPFlagEncountered) {
-            // Parameter: p->DTYPFlag_deviceType (test for NULL handle before using)
-            if (p->DTYPFlag_deviceType == NULL)
-                return USING_NULL_STRVAR;
-            std::string deviceTypeStr = GetStdStringFromHandle(p->DTYPFlag_deviceType);
-            deviceIndex = GetFirstDeviceOfType(platformIndex, deviceTypeStr);
-        }
-        
-        bool sourceProvidedAsText = false;
-        std::string textSource;
-        if (p->SRCTFlagEncountered) {
-            // Parameter: p->SRCTFlag_sourceText (test for NULL handle before using)
-            if (p->SRCTFlag_sourceText == NULL)
-                return USING_NULL_STRVAR;
-            sourceProvidedAsText = true;
-            textSource = GetStdStringFromHandle(p->SRCTFlag_sourceText);
-        }
-        
-        waveHndl programBinaryWave = NULL;
-        size_t nBytesInProgramBinary;
-        std::vector<char> programBinary;
-        if (p->SRCBFlagEncountered) {
-            // Parameter: p->SRCBFlag_sourceBinary (test for NULL handle before using)
-            if (p->SRCBFlag_sourceBinary == NULL)
-                return NULL_WAVE_OP;
-            if (sourceProvidedAsText)
-                return GENERAL_BAD_VIBS;    // program needs to be provided as text OR binary
-            
-            programBinaryWave = p->SRCBFlag_sourceBinary;
-            // require a wave containing bytes
-            if (WaveType(programBinaryWave) != NT_I8)
-                return NT_INCOMPATIBLE;
-            // require that the wave is 1D
-            int numDimensions;
-            CountInt dimensionSizes[MAX_DIMENSIONS + 1];
-            err = MDGetWaveDimensions(programBinaryWave, &numDimensions, dimensionSizes);
-            if (err)
-                return err;
-            if (numDimensions != 1)
-                return INCOMPATIBLE_DIMENSIONING;
-            nBytesInProgramBinary = dimensionSizes[0];
-            programBinary.resize(nBytesInProgramBinary);
-            memcpy(reinterpret_cast<void*>(&programBinary[0]), WaveData(programBinaryWave), nBytesInProgramBinary);
-        } else if (!sourceProvidedAsText) {
-            return EXPECTED_STRING;         // program needs to be provided as text OR binary
-        }
-        
-        std::string kernelName;
-        if (p->KERNFlagEncountered) {
-            // Parameter: p->KERNFlag_kernelName (test for NULL handle before using)
-            if (p->KERNFlag_kernelName == NULL)
-                return USING_NULL_STRVAR;
-            kernelName = GetStdStringFromHandle(p->KERNFlag_kernelName);
-        } else {
-            return EXPECTED_STRING;
-        }
-        
-        cl::NDRange globalRange;
-        if (p->GSZEFlagEncountered) {
-            // Parameter: p->GSZEFlag_globalSize0
-            // Parameter: p->GSZEFlag_globalSize1
-            // Parameter: p->GSZEFlag_globalSize2
-            if ((p->GSZEFlag_globalSize0 < 0) || (p->GSZEFlag_globalSize1 < 0) || (p->GSZEFlag_globalSize2 < 0))
-                return EXPECT_POS_NUM;
-            size_t gSize0 = p->GSZEFlag_globalSize0 + 0.5;
-            size_t gSize1 = p->GSZEFlag_globalSize1 + 0.5;
-            size_t gSize2 = p->GSZEFlag_globalSize2 + 0.5;
-            globalRange = cl::NDRange(gSize0, gSize1, gSize2);
-        } else {
-            XOPNotice("A global size must be specified (/GSZE flag)\r");
-            return SYNERR;
-        }
-        
-        cl::NDRange workgroupSize;
-        if (p->WGRPFlagEncountered) {
-            // Parameter: p->WGRPFlag_wgSize0
-            // Parameter: p->WGRPFlag_wgSize1
-            // Parameter: p->WGRPFlag_wgSize2
-            if ((p->WGRPFlag_wgSize0 < 0) || (p->WGRPFlag_wgSize1 < 0) || (p->WGRPFlag_wgSize2 < 0))
-                return EXPECT_POS_NUM;
-            size_t wRange0 = p->WGRPFlag_wgSize0 + 0.5;
-            size_t wRange1 = p->WGRPFlag_wgSize1 + 0.5;
-            size_t wRange2 = p->WGRPFlag_wgSize2 + 0.5;
-            workgroupSize = cl::NDRange(wRange0, wRange1, wRange2);
-        } else {
-            workgroupSize = cl::NullRange;
-        }
-        
-        std::vector<int> memFlags;
-        if (p->MFLGFlagEncountered) {
-            // Parameter: p->MFLGFlag_memoryFlagsWave (test for NULL handle before using)
-            if (p->MFLGFlag_memoryFlagsWave == NULL)
-                return NULL_WAVE_OP;
-            if (WaveType(p->MFLGFlag_memoryFlagsWave) & NT_CMPLX)
-                return COMPLEX_TO_REAL_LOSS;
-            
-            waveHndl memFlagsWave = p->MFLGFlag_memoryFlagsWave;
-            // require that the wave is 1D
-            int numDimensions;
-            CountInt dimensionSizes[MAX_DIMENSIONS + 1];
-            err = MDGetWaveDimensions(memFlagsWave, &numDimensions, dimensionSizes);
-            if (err)
-                return err;
-            if (numDimensions != 1)
-                return INCOMPATIBLE_DIMENSIONING;
-            
-            // copy all flag values into memFlags
-            IndexInt indices[MAX_DIMENSIONS];
-            double value[2];
-            for (size_t i = 0; i < dimensionSizes[0]; i+=1) {
-                indices[0] = i;
-                err = MDGetNumericWavePointValue(memFlagsWave, indices, value);
-                if (value[0] < 0.0)
-                    return EXPECT_POS_NUM;
-                memFlags.push_back(value[0] + 0.5);
-            }
-        }
-        
-        if (p->ZFlagEncountered) {
-            // Parameter: p->ZFlag_quiet
-            quiet = true;
-            if (p->ZFlagParamsSet[0] != 0)
-                quiet = (p->ZFlag_quiet != 0.0);
-        }
-        
-        // Main parameters.
-        std::vector<waveHndl> waves;
-        int nDataWaves = 0;
-        if (p->dataWavesEncountered) {
-            // Array-style optional parameter: p->dataWaves
-            int* paramsSet = &p->dataWavesParamsSet[0];
-            for(int i=0; i<12; i++) {
-                if (paramsSet[i] == 0)
-                    break;		// No more parameters.
-                // No NULL waves allowed.
-                if (p->dataWaves[i] == NULL)
-                    return NULL_WAVE_OP;
-                // No non-numeric waves allowed.
-                int waveType = WaveType(p->dataWaves[i]);
-                if ((waveType & TEXT_WAVE_TYPE) || (waveType & WAVE_TYPE) || (waveType & DATAFOLDER_TYPE))
-                    return EXPECTED_NUMERIC_WAVE;
-                waves.push_back(p->dataWaves[i]);
-            }
-        } else {
-            return NOWAV;
-        }
-        
-        // if memory flags have been provided then require that there are as many flags as there are waves
-        if ((memFlags.size() > 0) && (memFlags.size() != waves.size())) {
-            XOPNotice("the wave containing memory flags must one point for every wave passed to IgorCL\r");
-            return GENERAL_BAD_VIBS;
-        }
-        
-        if (sourceProvidedAsText) {
-            DoOpenCLCalculation(platformIndex, deviceIndex, globalRange, workgroupSize, kernelName, waves, memFlags, textSource);
-        } else {
-            DoOpenCLCalculation(platformIndex, deviceIndex, globalRange, workgroupSize, kernelName, waves, memFlags, programBinary);
-        }
-    }
-    catch (int e) {
-        return e;
-    }
-    catch (IgorCLError& e) {
-        int errorCode = e.getErrorCode();
-        char noticeStr[200];
-        sprintf(noticeStr, "OpenCL error code %d (%s)\r", errorCode, OpenCLErrorCodeToSymbolicName(errorCode).c_str());
-        XOPNotice(noticeStr);
-        SetOperationNumVar("V_Flag", errorCode);
-        if (quiet) {
-            return 0;
-        } else {
-            return OPENCL_ERROR;
-        }
-    }
-    catch (std::range_error& e) {
-        return INDEX_OUT_OF_RANGE;
-    }
-    catch (std::runtime_error& e) {
-        XOPNotice(e.what());
-        return GENERAL_BAD_VIBS;
-    }
-    catch (...) {
-        return GENERAL_BAD_VIBS;
-    }
+	// Parameters for /TLQ flag group.
+	int TLQFlagEncountered;
+	double TLQFlag_useThreadLocalQueues;
+	int TLQFlagParamsSet[1];
     
-    SetOperationNumVar("V_Flag", err);
+	// Parameters for /QMAX flag group.
+	int QMAXFlagEncountered;
+	double QMAXFlag_maxQueuesPerDevice;
+	int QMAXFlagParamsSet[1];
     
-	return err;
-}
-
-static int ExecuteIgorCLCompile(IgorCLCompileRuntimeParamsPtr p) {
-	int err = 0;
-    bool quiet = false;
-    std::string buildLog;
+	// Parameters for /SUBT flag group.
+	int SUBTFlagEncountered;
+	double SUBTFlag_useSubmissionThread;
+	int SUBTFlagParamsSet[1];
     
-    try {
-        // Flag parameters.
-        
-        int platformIndex = 0;
-        if (p->PLTMFlagEncountered) {
-            // Parameter: p->PLTMFlag_platform
-            platformIndex = p->PLTMFlag_platform + 0.5;
-        }
-        
-        // only one of /DEV or /DTYP flags may be specified
-        if (p->DEVFlagEncountered && p->DTYPFlagEncountered) {
-            XOPNotice("Only one of the /DEV or /DTYP flags may be specified\r");
-            return SYNERR;
-        }
-        
-        
-        int deviceIndex = 0;
-        if (p->DEVFlagEncountered) {
-            // Parameter: p->DEVFlag_device
-            deviceIndex = p->DEVFlag_device + 0.5;
-        }
-        
-        if (p->DTYPFlagEncountered) {
-            // Parameter: p->DTYPFlag_deviceType (test for NULL handle before using)
-            if (p->DTYPFlag_deviceType == NULL)
-                return USING_NULL_STRVAR;
-            std::string deviceTypeStr = GetStdStringFromHandle(p->DTYPFlag_deviceType);
-            deviceIndex = GetFirstDeviceOfType(platformIndex, deviceTypeStr);
-        }
-        
-        DataFolderAndName destination;
-        if (p->DESTFlagEncountered) {
-            // Parameter: p->DESTFlag_destination
-            destination = p->DESTFlag_destination;
-        } else {
-            destination.dfH = NULL;
-            strcpy(destination.name, "W_CompiledBinary");
-        }
-        
-        if (p->ZFlagEncountered) {
-            quiet = true;
-            if (p->ZFlagParamsSet[0] != 0)
-                quiet = (p->ZFlag_quiet != 0.0);
-        }
-        
-        // Main parameters.
-        
-        std::string programSource;
-        if (p->programSourceEncountered) {
-            // Parameter: p->programSource (test for NULL handle before using)
-            if (p->programSource == NULL)
-                return EXPECTED_STRING;
-            programSource = GetStdStringFromHandle(p->programSource);
-        } else {
-            return EXPECTED_STRING;
-        }
-        
-        // do the actual compilation
-        std::vector<char> compiledBinary;
-        compiledBinary = CompileSource(platformIndex, deviceIndex, programSource, buildLog);
-        
-        // copy the compiled binary back out to an Igor wave
-        size_t nBytes = compiledBinary.size();
-        CountInt dimensionSizes[MAX_DIMENSIONS + 1];
-        dimensionSizes[0] = nBytes;
-        dimensionSizes[1] = 0;
-        waveHndl outputWave;
-        err = MDMakeWave(&outputWave, destination.name, destination.dfH, dimensionSizes, NT_I8, 1);
-        if (err)
-            return err;
-        
-        memcpy(WaveData(outputWave), reinterpret_cast<void*>(&compiledBinary[0]), nBytes);
-    }
-    catch (int e) {
-        return e;
-    }
-    catch (IgorCLError& e) {
-        int errorCode = e.getErrorCode();
-        SetOperationNumVar("V_Flag", errorCode);
-        SetOperationStrVar("S_BuildLog", buildLog.c_str());
-        if (!quiet) {
-            char noticeStr[100];
-            sprintf(noticeStr, "\rOpenCL error code %d\r", errorCode);
-            XOPNotice(noticeStr);
-            return OPENCL_ERROR;
-        }
-        return 0;
-    }
-    catch (std::range_error& e) {
-        return INDEX_OUT_OF_RANGE;
-    }
-    catch (std::runtime_error& e) {
-        XOPNotice(e.what());
-        XOPNotice("\r");
-        return GENERAL_BAD_VIBS;
-    }
-    catch (...) {
-        return GENERAL_BAD_VIBS;
-    }
+	// Parameters for /SHCX flag group.
+	int SHCXFlagEncountered;
+	double SHCXFlag_useSharedContexts;
+	int SHCXFlagParamsSet[1];
     
-    SetOperationNumVar("V_Flag", err);
-    SetOperationStrVar("S_BuildLog", buildLog.c_str());
+	// Parameters for /FISS flag group.
+	int FISSFlagEncountered;
+	double FISSFlag_platform;
+	double FISSFlag_device;
+	Handle FISSFlag_partitionSpecification;
+	int FISSFlagParamsSet[3];
     
-	return err;
-}
+	// Parameters for /FTHR flag group.
+	int FTHRFlagEncountered;
+	double FTHRFlag_routeThreadsToPartitions;
+	int FTHRFlagParamsSet[1];
+    
+	// Parameters for /NUMA flag group.
+	int NUMAFlagEncountered;
+	double NUMAFlag_firstTouchOnDevice;
+	int NUMAFlagParamsSet[1];
+    
+	// Parameters for /CALF flag group.
+	int CALFFlagEncountered;
+	Handle CALFFlag_calibrationFilePath;
+	int CALFFlagParamsSet[1];
+    
+	// Main parameters.
+    
+	// These are postamble fields that Igor sets.
+	int calledFromFunction;					// 1 if called from a user function, 0 otherwise.
+	int calledFromMacro;					// 1 if called from a macro, 0 otherwise.
+	UserFunctionThreadInfoPtr tp;			// If not null, we are running from a ThreadSafe function.
+};
+typedef struct IgorCLSettingsRuntimeParams IgorCLSettingsRuntimeParams;
+typedef struct IgorCLSettingsRuntimeParams* IgorCLSettingsRuntimeParamsPtr;
+#pragma pack()	// Reset structure alignment to default.
 
-static int ExecuteIgorCLInfo(IgorCLInfoRuntimeParamsPtr p) {
-	int err = 0;
-    cl_int status;
+// Runtime param structure for IgorCLBuffer operation.
+#pragma pack(2)	// All structures passed to Igor are two-byte aligned.
+struct IgorCLBufferRuntimeParams {
+	// Flag parameters.
     
-    char noticeString[256];
+	// Parameters for /PLTM flag group.
+	int PLTMFlagEncountered;
+	double PLTMFlag_platform;
+	int PLTMFlagParamsSet[1];
     
-    try {
-        
-        // fetch information on the platforms
-        std::vector<cl::Platform> platforms;
-        cl::Platform::get(&platforms);
-        
+	// Parameters for /DEV flag group.
+	int DEVFlagEncountered;
+	double DEVFlag_device;
+	int DEVFlagParamsSet[1];
+    
+	// Parameters for /DTYP flag group.
+	int DTYPFlagEncountered;
+	Handle DTYPFlag_deviceType;
+	int DTYPFlagParamsSet[1];
+    
+	// Parameters for /DSEL flag group.
+	int DSELFlagEncountered;
+	Handle DSELFlag_deviceSelector;
+	int DSELFlagParamsSet[1];
+    
+	// Parameters for /NEW flag group.
+	int NEWFlagEncountered;
+	waveHndl NEWFlag_sourceWave;
+	int NEWFlagParamsSet[1];
+    
+	// Parameters for /READ flag group.
+	int READFlagEncountered;
+	double READFlag_bufferID;
+	waveHndl READFlag_destinationWave;
+	int READFlagParamsSet[2];
+    
+	// Parameters for /MIGR flag group.
+	int MIGRFlagEncountered;
+	double MIGRFlag_bufferID;
+	int MIGRFlagParamsSet[1];
+    
+	// Parameters for /COPY flag group.
+	int COPYFlagEncountered;
+	double COPYFlag_bufferID;
+	int COPYFlagParamsSet[1];
+    
+	// Parameters for /FREE flag group.
+	int FREEFlagEncountered;
+	double FREEFlag_bufferID;
+	int FREEFlagParamsSet[1];
+    
+	// Parameters for /Z flag group.
+	int ZFlagEncountered;
+	double ZFlag_quiet;						// Optional parameter.
+	int ZFlagParamsSet[1];
+    
+	// Main parameters.
+    
+	// These are postamble fields that Igor sets.
+	int calledFromFunction;					// 1 if called from a user function, 0 otherwise.
+	int calledFromMacro;					// 1 if called from a macro, 0 otherwise.
+	UserFunctionThreadInfoPtr tp;			// If not null, we are running from a ThreadSafe function.
+};
+typedef struct IgorCLBufferRuntimeParams IgorCLBufferRuntimeParams;
+typedef struct IgorCLBufferRuntimeParams* IgorCLBufferRuntimeParamsPtr;
+#pragma pack()	// Reset structure alignment to default.
+
+// Runtime param structure for IgorCLBench operation.
+#pragma pack(2)	// All structures passed to Igor are two-byte aligned.
+struct IgorCLBenchRuntimeParams {
+	// Flag parameters.
+    
+	// Parameters for /PLTM flag group.
+	int PLTMFlagEncountered;
+	double PLTMFlag_platform;
+	int PLTMFlagParamsSet[1];
+    
+	// Parameters for /DEV flag group.
+	int DEVFlagEncountered;
+	double DEVFlag_device;
+	int DEVFlagParamsSet[1];
+    
+	// Parameters for /DTYP flag group.
+	int DTYPFlagEncountered;
+	Handle DTYPFlag_deviceType;
+	int DTYPFlagParamsSet[1];
+    
+	// Parameters for /DSEL flag group.
+	int DSELFlagEncountered;
+	Handle DSELFlag_deviceSelector;
+	int DSELFlagParamsSet[1];
+    
+	// Parameters for /SIZE flag group.
+	int SIZEFlagEncountered;
+	waveHndl SIZEFlag_transferSizes;
+	int SIZEFlagParamsSet[1];
+    
+	// Parameters for /REPS flag group.
+	int REPSFlagEncountered;
+	double REPSFlag_repeats;
+	int REPSFlagParamsSet[1];
+    
+	// Parameters for /FILE flag group.
+	int FILEFlagEncountered;
+	Handle FILEFlag_calibrationFilePath;
+	int FILEFlagParamsSet[1];
+    
+	// Parameters for /Z flag group.
+	int ZFlagEncountered;
+	double ZFlag_quiet;						// Optional parameter.
+	int ZFlagParamsSet[1];
+    
+	// Main parameters.
+    
+	// These are postamble fields that Igor sets.
+	int calledFromFunction;					// 1 if called from a user function, 0 otherwise.
+	int calledFromMacro;					// 1 if called from a macro, 0 otherwise.
+	UserFunctionThreadInfoPtr tp;			// If not null, we are running from a ThreadSafe function.
+};
+typedef struct IgorCLBenchRuntimeParams IgorCLBenchRuntimeParams;
+typedef struct IgorCLBenchRuntimeParams* IgorCLBenchRuntimeParamsPtr;
+#pragma pack()	// Reset structure alignment to default.
+
+// Runtime param structure for IgorCLStats operation.
+#pragma pack(2)	// All structures passed to Igor are two-byte aligned.
+struct IgorCLStatsRuntimeParams {
+	// Flag parameters.
+    
+	// Parameters for /RSET flag group.
+	int RSETFlagEncountered;
+	// There are no fields for this group because it has no parameters.
+    
+	// Main parameters.
+    
+	// These are postamble fields that Igor sets.
+	int calledFromFunction;					// 1 if called from a user function, 0 otherwise.
+	int calledFromMacro;					// 1 if called from a macro, 0 otherwise.
+	UserFunctionThreadInfoPtr tp;			// If not null, we are running from a ThreadSafe function.
+};
+typedef struct IgorCLStatsRuntimeParams IgorCLStatsRuntimeParams;
+typedef struct IgorCLStatsRuntimeParams* IgorCLStatsRuntimeParamsPtr;
+#pragma pack()	// Reset structure alignment to default.
+
+// Runtime param structure for IgorCLKernelInfo operation.
+#pragma pack(2)	// All structures passed to Igor are two-byte aligned.
+struct IgorCLKernelInfoRuntimeParams {
+	// Flag parameters.
+    
+	// Parameters for /PLTM flag group.
+	int PLTMFlagEncountered;
+	double PLTMFlag_platform;
+	int PLTMFlagParamsSet[1];
+    
+	// Parameters for /DEV flag group.
+	int DEVFlagEncountered;
+	double DEVFlag_device;
+	int DEVFlagParamsSet[1];
+    
+	// Parameters for /DTYP flag group.
+	int DTYPFlagEncountered;
+	Handle DTYPFlag_deviceType;
+	int DTYPFlagParamsSet[1];
+    
+	// Parameters for /DSEL flag group.
+	int DSELFlagEncountered;
+	Handle DSELFlag_deviceSelector;
+	int DSELFlagParamsSet[1];
+    
+	// Parameters for /SRCT flag group.
+	int SRCTFlagEncountered;
+	Handle SRCTFlag_sourceText;
+	int SRCTFlagParamsSet[1];
+    
+	// Parameters for /SRCB flag group.
+	int SRCBFlagEncountered;
+	waveHndl SRCBFlag_sourceBinary;
+	int SRCBFlagParamsSet[1];
+    
+	// Parameters for /KERN flag group.
+	int KERNFlagEncountered;
+	Handle KERNFlag_kernelName;
+	int KERNFlagParamsSet[1];
+    
+	// Parameters for /TMPL flag group.
+	int TMPLFlagEncountered;
+	// There are no fields for this group because it has no parameters.
+    
+	// Parameters for /Z flag group.
+	int ZFlagEncountered;
+	double ZFlag_quiet;						// Optional parameter.
+	int ZFlagParamsSet[1];
+    
+	// Main parameters.
+    
+	// These are postamble fields that Igor sets.
+	int calledFromFunction;					// 1 if called from a user function, 0 otherwise.
+	int calledFromMacro;					// 1 if called from a macro, 0 otherwise.
+	UserFunctionThreadInfoPtr tp;			// If not null, we are running from a ThreadSafe function.
+};
+typedef struct IgorCLKernelInfoRuntimeParams IgorCLKernelInfoRuntimeParams;
+typedef struct IgorCLKernelInfoRuntimeParams* IgorCLKernelInfoRuntimeParamsPtr;
+#pragma pack()	// Reset structure alignment to default.
+    
+// Runtime param structure for IgorCLSession operation.
+#pragma pack(2)	// All structures passed to Igor are two-byte aligned.
+struct IgorCLSessionRuntimeParams {
+	// Flag parameters.
+    
+	// Parameters for /PLTM flag group.
+	int PLTMFlagEncountered;
+	double PLTMFlag_platform;
+	int PLTMFlagParamsSet[1];
+    
+	// Parameters for /DEV flag group.
+	int DEVFlagEncountered;
+	double DEVFlag_device;
+	int DEVFlagParamsSet[1];
+    
+	// Parameters for /DTYP flag group.
+	int DTYPFlagEncountered;
+	Handle DTYPFlag_deviceType;
+	int DTYPFlagParamsSet[1];
+    
+	// Parameters for /DSEL flag group.
+	int DSELFlagEncountered;
+	Handle DSELFlag_deviceSelector;
+	int DSELFlagParamsSet[1];
+    
+	// Parameters for /SRCT flag group.
+	int SRCTFlagEncountered;
+	Handle SRCTFlag_sourceText;
+	int SRCTFlagParamsSet[1];
+    
+	// Parameters for /SRCB flag group.
+	int SRCBFlagEncountered;
+	waveHndl SRCBFlag_sourceBinary;
+	int SRCBFlagParamsSet[1];
+    
+	// Parameters for /KERN flag group.
+	int KERNFlagEncountered;
+	Handle KERNFlag_kernelName;
+	int KERNFlagParamsSet[1];
+    
+	// Parameters for /TMPL flag group.
+	int TMPLFlagEncountered;
+	// There are no fields for this group because it has no parameters.
+    
+	// Parameters for /GSZE flag group.
+	int GSZEFlagEncountered;
+	double GSZEFlag_globalSize0;
+	double GSZEFlag_globalSize1;
+	double GSZEFlag_globalSize2;
+	int GSZEFlagParamsSet[3];
+    
+	// Parameters for /WGRP flag group.
+	int WGRPFlagEncountered;
+	double WGRPFlag_wgSize0;
+	double WGRPFlag_wgSize1;
+	double WGRPFlag_wgSize2;
+	int WGRPFlagParamsSet[3];
+    
+	// Parameters for /MFLG flag group.
+	int MFLGFlagEncountered;
+	waveHndl MFLGFlag_memoryFlagsWave;
+	int MFLGFlagParamsSet[1];
+    
+	// Parameters for /FILV flag group.
+	int FILVFlagEncountered;
+	waveHndl FILVFlag_fillValuesWave;
+	int FILVFlagParamsSet[1];
+    
+	// Parameters for /DYN flag group.
+	int DYNFlagEncountered;
+	waveHndl DYNFlag_dynamicFlagsWave;
+	int DYNFlagParamsSet[1];
+    
+	// Parameters for /WAVES flag group.
+	int WAVESFlagEncountered;
+	waveHndl WAVESFlag_argumentWaves;
+	int WAVESFlagParamsSet[1];
+    
+	// Parameters for /SCLR flag group.
+	int SCLRFlagEncountered;
+	waveHndl SCLRFlag_scalarValues;
+	waveHndl SCLRFlag_scalarTypes;
+	waveHndl SCLRFlag_scalarIndices;
+	int SCLRFlagParamsSet[3];
+    
+	// Parameters for /NEW flag group.
+	int NEWFlagEncountered;
+	// There are no fields for this group because it has no parameters.
+    
+	// Parameters for /RUN flag group.
+	int RUNFlagEncountered;
+	double RUNFlag_sessionID;
+	int RUNFlagParamsSet[1];
+    
+	// Parameters for /FREE flag group.
+	int FREEFlagEncountered;
+	double FREEFlag_sessionID;
+	int FREEFlagParamsSet[1];
+    
+	// Parameters for /Z flag group.
+	int ZFlagEncountered;
+	double ZFlag_quiet;						// Optional parameter.
+	int ZFlagParamsSet[1];
+    
+	// Main parameters.
+    
+	// Parameters for simple main group #0.
+	int dataWavesEncountered;
+	waveHndl dataWaves[12];					// Optional parameter.
+	int dataWavesParamsSet[12];
+    
+	// These are postamble fields that Igor sets.
+	int calledFromFunction;					// 1 if called from a user function, 0 otherwise.
+	int calledFromMacro;					// 1 if called from a macro, 0 otherwise.
+	UserFunctionThreadInfoPtr tp;			// If not null, we are running from a ThreadSafe function.
+};
+typedef struct IgorCLSessionRuntimeParams IgorCLSessionRuntimeParams;
+typedef struct IgorCLSessionRuntimeParams* IgorCLSessionRuntimeParamsPtr;
+#pragma pack()	// Reset structure alignment to default.
+
+// returns an Igor error code if wave cannot be passed as a kernel argument
+static int CheckKernelArgumentWave(waveHndl wave) {
+    // No NULL waves allowed.
+    if (wave == NULL)
+        return NULL_WAVE_OP;
+    // No non-numeric waves allowed.
+    int waveType = WaveType(wave);
+    if ((waveType & TEXT_WAVE_TYPE) || (waveType & WAVE_TYPE) || (waveType & DATAFOLDER_TYPE))
+        return EXPECTED_NUMERIC_WAVE;
+    return 0;
+}
+
+// copies the values of a real, 1D numeric wave. Returns an Igor error code.
+static int GetValuesFrom1DNumericWave(waveHndl wave, std::vector<double>& values) {
+    if (wave == NULL)
+        return NULL_WAVE_OP;
+    if (WaveType(wave) & NT_CMPLX)
+        return COMPLEX_TO_REAL_LOSS;
+    
+    int err;
+    int numDimensions;
+    CountInt dimensionSizes[MAX_DIMENSIONS + 1];
+    err = MDGetWaveDimensions(wave, &numDimensions, dimensionSizes);
+    if (err)
+        return err;
+    if (numDimensions != 1)
+        return INCOMPATIBLE_DIMENSIONING;
+    
+    IndexInt indices[MAX_DIMENSIONS];
+    double value[2];
+    values.clear();
+    values.reserve(dimensionSizes[0]);
+    for (CountInt i = 0; i < dimensionSizes[0]; i+=1) {
+        indices[0] = i;
+        err = MDGetNumericWavePointValue(wave, indices, value);
+        if (err)
+            return err;
+        values.push_back(value[0]);
+    }
+    
+    return 0;
+}
+
+// copies the memory flags, one point per kernel argument wave. Returns an Igor error code.
+static int GetMemFlagsFromWave(waveHndl memFlagsWave, std::vector<int>& memFlags) {
+    std::vector<double> values;
+    int err = GetValuesFrom1DNumericWave(memFlagsWave, values);
+    if (err)
+        return err;
+    
+    memFlags.clear();
+    for (size_t i = 0; i < values.size(); i+=1) {
+        if (values[i] < 0.0)
+            return EXPECT_POS_NUM;
+        memFlags.push_back(values[i] + 0.5);
+    }
+    
+    return 0;
+}
+
+// the scalar arguments (/SCLR), one point per scalar argument: its value, its type as an Igor wave type code,
+// and its kernel argument index. Returns an Igor error code.
+static int GetScalarArgumentsFromWaves(waveHndl valuesWave, waveHndl typesWave, waveHndl indicesWave, std::vector<IgorCLScalarArgument>& scalarArgs) {
+    int err;
+    std::vector<double> scalarValues, scalarTypes, scalarIndices;
+    err = GetValuesFrom1DNumericWave(valuesWave, scalarValues);
+    if (err)
+        return err;
+    err = GetValuesFrom1DNumericWave(typesWave, scalarTypes);
+    if (err)
+        return err;
+    err = GetValuesFrom1DNumericWave(indicesWave, scalarIndices);
+    if (err)
+        return err;
+    if ((scalarTypes.size() != scalarValues.size()) || (scalarIndices.size() != scalarValues.size())) {
+        XOPNotice("the scalar values, types, and indices waves must have the same number of points\r");
+        return GENERAL_BAD_VIBS;
+    }
+    
+    // 64-bit integer values are taken without a round trip through double
+    const cl_long* exactIntegerValues = NULL;
+#ifdef NT_I64
+    if ((WaveType(valuesWave) & ~NT_UNSIGNED) == NT_I64)
+        exactIntegerValues = reinterpret_cast<const cl_long*>(WaveData(valuesWave));
+#endif
+    scalarArgs.clear();
+    for (size_t i = 0; i < scalarValues.size(); i+=1) {
+        if (scalarIndices[i] < 0)
+            return EXPECT_POS_NUM;
+        const cl_long* exactIntegerValue = (exactIntegerValues != NULL) ? &exactIntegerValues[i] : NULL;
+        scalarArgs.push_back(MakeScalarArgument(scalarIndices[i] + 0.5, scalarTypes[i] + 0.5, scalarValues[i], exactIntegerValue));
+    }
+    
+    return 0;
+}
+
+// the kernel argument waves listed in a wave reference wave (/WAVES). Returns an Igor error code.
+static int GetKernelArgumentWavesFromWaveReferenceWave(waveHndl argumentWaves, std::vector<waveHndl>& waves) {
+    if (argumentWaves == NULL)
+        return NULL_WAVE_OP;
+    if (WaveType(argumentWaves) != WAVE_TYPE)
+        return NT_INCOMPATIBLE;
+    // require that the wave is 1D
+    int err;
+    int numDimensions;
+    CountInt dimensionSizes[MAX_DIMENSIONS + 1];
+    err = MDGetWaveDimensions(argumentWaves, &numDimensions, dimensionSizes);
+    if (err)
+        return err;
+    if (numDimensions != 1)
+        return INCOMPATIBLE_DIMENSIONING;
+    
+    // the data of a wave reference wave is an array of wave handles
+    waveHndl* argumentWaveHandles = reinterpret_cast<waveHndl*>(WaveData(argumentWaves));
+    waves.clear();
+    waves.reserve(dimensionSizes[0]);
+    for (CountInt i = 0; i < dimensionSizes[0]; i+=1) {
+        err = CheckKernelArgumentWave(argumentWaveHandles[i]);
+        if (err)
+            return err;
+        waves.push_back(argumentWaveHandles[i]);
+    }
+    if (waves.empty())
+        return NOWAV;
+    
+    return 0;
+}
+
+// /PLTM, /DEV, /DTYP and /DSEL are shared by all operations that run on a single device.
+// /DTYP=AUTO is only accepted if selectDeviceAutomatically is not NULL, the cost model then chooses the device later.
+template<typename RuntimeParamsPtr>
+static int ResolveDeviceFlags(RuntimeParamsPtr p, int& platformIndex, int& deviceIndex, bool* selectDeviceAutomatically) {
+    platformIndex = 0;
+    deviceIndex = 0;
+    if (selectDeviceAutomatically != NULL)
+        *selectDeviceAutomatically = false;
+    
+    if (p->PLTMFlagEncountered) {
+        // Parameter: p->PLTMFlag_platform
+        if (p->PLTMFlag_platform < 0)
+            return EXPECT_POS_NUM;
+        platformIndex = p->PLTMFlag_platform + 0.5;
+    }
+    
+    // only one of /DEV or /DTYP flags may be specified
+    if (p->DEVFlagEncountered && p->DTYPFlagEncountered) {
+        XOPNotice("Only one of the /DEV or /DTYP flags may be specified\r");
+        return SYNERR;
+    }
+    if (p->DEVFlagEncountered) {
+        // Parameter: p->DEVFlag_device
+        if (p->DEVFlag_device < 0)
+            return EXPECT_POS_NUM;
+        deviceIndex = p->DEVFlag_device + 0.5;
+    }
+    
+    if (p->DTYPFlagEncountered) {
+        // Parameter: p->DTYPFlag_deviceType (test for NULL handle before using)
+        if (p->DTYPFlag_deviceType == NULL)
+            return USING_NULL_STRVAR;
+        std::string deviceTypeStr = NormalizeDeviceTypeString(GetStdStringFromHandle(p->DTYPFlag_deviceType));
+        if ((deviceTypeStr == "AUTO") && (selectDeviceAutomatically != NULL)) {
+            *selectDeviceAutomatically = true;
+        } else {
+            deviceIndex = GetFirstDeviceOfType(platformIndex, deviceTypeStr);
+        }
+    }
+    
+    if (p->DSELFlagEncountered) {
+        // Parameter: p->DSELFlag_deviceSelector (test for NULL handle before using)
+        if (p->DSELFlag_deviceSelector == NULL)
+            return USING_NULL_STRVAR;
+        // the selector chooses the platform as well as the device
+        if (p->PLTMFlagEncountered || p->DEVFlagEncountered || p->DTYPFlagEncountered) {
+            XOPNotice("The /DSEL flag cannot be combined with /PLTM, /DEV or /DTYP\r");
+            return SYNERR;
+        }
+        std::pair<int, int> selectedDevice = deviceSelector.selectDevice(GetStdStringFromHandle(p->DSELFlag_deviceSelector));
+        platformIndex = selectedDevice.first;
+        deviceIndex = selectedDevice.second;
+    }
+    
+    return 0;
+}
+
+// the kernel arguments are either passed directly or listed in a wave reference wave (/WAVES)
+template<typename RuntimeParamsPtr>
+static int GetKernelArgumentWaves(RuntimeParamsPtr p, std::vector<waveHndl>& waves) {
+    if (p->WAVESFlagEncountered && p->dataWavesEncountered) {
+        XOPNotice("Pass the kernel arguments either as a list of waves or using /WAVES, but not both\r");
+        return SYNERR;
+    }
+    if (p->WAVESFlagEncountered) {
+        // Parameter: p->WAVESFlag_argumentWaves (test for NULL handle before using)
+        return GetKernelArgumentWavesFromWaveReferenceWave(p->WAVESFlag_argumentWaves, waves);
+    } else if (p->dataWavesEncountered) {
+        // Array-style optional parameter: p->dataWaves
+        int* paramsSet = &p->dataWavesParamsSet[0];
+        for(int i=0; i<12; i++) {
+            if (paramsSet[i] == 0)
+                break;		// No more parameters.
+            int err = CheckKernelArgumentWave(p->dataWaves[i]);
+            if (err)
+                return err;
+            waves.push_back(p->dataWaves[i]);
+        }
+    } else {
+        return NOWAV;
+    }
+    return 0;
+}
+
+// a calculation as described by the flags and waves that IgorCL and IgorCLSession have in common
+struct IgorCLCalculationCall {
+    int platformIndex;
+    int deviceIndex;
+    bool selectDeviceAutomatically;     // /DTYP=AUTO
+    bool sourceProvidedAsText;
+    std::string textSource;             // with the wildcards resolved if the source is a template (/TMPL)
+    std::vector<char> programBinary;
+    std::string kernelName;
+    cl::NDRange globalRange;
+    cl::NDRange workgroupSize;
+    double nWorkItems;
+    std::vector<waveHndl> waves;
+    std::vector<int> memFlags;
+    std::vector<double> fillValues;
+    std::vector<IgorCLScalarArgument> scalarArgs;
+};
+
+// parses /PLTM, /DEV, /DTYP, /DSEL, /SRCT, /SRCB, /KERN, /TMPL, /GSZE, /WGRP, /MFLG, /FILV, /SCLR and the kernel arguments.
+// /DTYP=AUTO is only accepted if allowAutomaticDeviceSelection is true.
+template<typename RuntimeParamsPtr>
+static int ParseCalculationCall(RuntimeParamsPtr p, const std::string& operationName, const bool allowAutomaticDeviceSelection, IgorCLCalculationCall& call) {
+    call.selectDeviceAutomatically = false;
+    int err = ResolveDeviceFlags(p, call.platformIndex, call.deviceIndex, allowAutomaticDeviceSelection ? &call.selectDeviceAutomatically : NULL);
+    if (err)
+        return err;
+    
+    call.sourceProvidedAsText = false;
+    if (p->SRCTFlagEncountered) {
+        // Parameter: p->SRCTFlag_sourceText (test for NULL handle before using)
+        if (p->SRCTFlag_sourceText == NULL)
+            return USING_NULL_STRVAR;
+        call.sourceProvidedAsText = true;
+        call.textSource = GetStdStringFromHandle(p->SRCTFlag_sourceText);
+    }
+    
+    if (p->SRCBFlagEncountered) {
+        // Parameter: p->SRCBFlag_sourceBinary (test for NULL handle before using)
+        if (p->SRCBFlag_sourceBinary == NULL)
+            return NULL_WAVE_OP;
+        if (call.sourceProvidedAsText)
+            return GENERAL_BAD_VIBS;    // program needs to be provided as text OR binary
+        
+        waveHndl programBinaryWave = p->SRCBFlag_sourceBinary;
+        // require a wave containing bytes
+        if (WaveType(programBinaryWave) != NT_I8)
+            return NT_INCOMPATIBLE;
+        // require that the wave is 1D
+        int numDimensions;
+        CountInt dimensionSizes[MAX_DIMENSIONS + 1];
+        err = MDGetWaveDimensions(programBinaryWave, &numDimensions, dimensionSizes);
+        if (err)
+            return err;
+        if (numDimensions != 1)
+            return INCOMPATIBLE_DIMENSIONING;
+        call.programBinary.resize(dimensionSizes[0]);
+        memcpy(reinterpret_cast<void*>(&call.programBinary[0]), WaveData(programBinaryWave), dimensionSizes[0]);
+    } else if (!call.sourceProvidedAsText) {
+        return EXPECTED_STRING;         // program needs to be provided as text OR binary
+    }
+    if (call.selectDeviceAutomatically && !call.sourceProvidedAsText)
+        throw std::runtime_error("/DTYP=AUTO requires the program source (/SRCT), binaries are specific to a device");
+    
+    if (p->KERNFlagEncountered) {
+        // Parameter: p->KERNFlag_kernelName (test for NULL handle before using)
+        if (p->KERNFlag_kernelName == NULL)
+            return USING_NULL_STRVAR;
+        call.kernelName = GetStdStringFromHandle(p->KERNFlag_kernelName);
+    } else {
+        return EXPECTED_STRING;
+    }
+    
+    // the source is a template, its type wildcards get the types of the waves
+    bool sourceIsTemplate = false;
+    if (p->TMPLFlagEncountered) {
+        if (!call.sourceProvidedAsText)
+            throw std::runtime_error("/TMPL requires the program source (/SRCT)");
+        sourceIsTemplate = true;
+    }
+    
+    if (p->GSZEFlagEncountered) {
+        // Parameter: p->GSZEFlag_globalSize0
+        // Parameter: p->GSZEFlag_globalSize1
+        // Parameter: p->GSZEFlag_globalSize2
+        if ((p->GSZEFlag_globalSize0 < 0) || (p->GSZEFlag_globalSize1 < 0) || (p->GSZEFlag_globalSize2 < 0))
+            return EXPECT_POS_NUM;
+        size_t gSize0 = p->GSZEFlag_globalSize0 + 0.5;
+        size_t gSize1 = p->GSZEFlag_globalSize1 + 0.5;
+        size_t gSize2 = p->GSZEFlag_globalSize2 + 0.5;
+        call.globalRange = cl::NDRange(gSize0, gSize1, gSize2);
+        call.nWorkItems = static_cast<double>(std::max<size_t>(gSize0, 1)) * std::max<size_t>(gSize1, 1) * std::max<size_t>(gSize2, 1);
+    } else {
+        XOPNotice("A global size must be specified (/GSZE flag)\r");
+        return SYNERR;
+    }
+    
+    if (p->WGRPFlagEncountered) {
+        // Parameter: p->WGRPFlag_wgSize0
+        // Parameter: p->WGRPFlag_wgSize1
+        // Parameter: p->WGRPFlag_wgSize2
+        if ((p->WGRPFlag_wgSize0 < 0) || (p->WGRPFlag_wgSize1 < 0) || (p->WGRPFlag_wgSize2 < 0))
+            return EXPECT_POS_NUM;
+        size_t wRange0 = p->WGRPFlag_wgSize0 + 0.5;
+        size_t wRange1 = p->WGRPFlag_wgSize1 + 0.5;
+        size_t wRange2 = p->WGRPFlag_wgSize2 + 0.5;
+        call.workgroupSize = cl::NDRange(wRange0, wRange1, wRange2);
+    } else {
+        call.workgroupSize = cl::NullRange;
+    }
+    
+    if (p->MFLGFlagEncountered) {
+        // Parameter: p->MFLGFlag_memoryFlagsWave
+        err = GetMemFlagsFromWave(p->MFLGFlag_memoryFlagsWave, call.memFlags);
+        if (err)
+            return err;
+    }
+    
+    if (p->FILVFlagEncountered) {
+        // Parameter: p->FILVFlag_fillValuesWave
+        // the fill values are only used for arguments flagged with IgorCLFillOnDevice
+        err = GetValuesFrom1DNumericWave(p->FILVFlag_fillValuesWave, call.fillValues);
+        if (err)
+            return err;
+    }
+    
+    if (p->SCLRFlagEncountered) {
+        // Parameter: p->SCLRFlag_scalarValues
+        // Parameter: p->SCLRFlag_scalarTypes
+        // Parameter: p->SCLRFlag_scalarIndices
+        err = GetScalarArgumentsFromWaves(p->SCLRFlag_scalarValues, p->SCLRFlag_scalarTypes, p->SCLRFlag_scalarIndices, call.scalarArgs);
+        if (err)
+            return err;
+    }
+    
+    // Main parameters.
+    err = GetKernelArgumentWaves(p, call.waves);
+    if (err)
+        return err;
+    
+    // if memory flags have been provided then require that there are as many flags as there are waves
+    if ((call.memFlags.size() > 0) && (call.memFlags.size() != call.waves.size())) {
+        XOPNotice(("the wave containing memory flags must one point for every wave passed to " + operationName + "\r").c_str());
+        return GENERAL_BAD_VIBS;
+    }
+    if ((call.fillValues.size() > 0) && (call.fillValues.size() != call.waves.size())) {
+        XOPNotice(("the wave containing fill values must have one point for every wave passed to " + operationName + "\r").c_str());
+        return GENERAL_BAD_VIBS;
+    }
+    
+    if (sourceIsTemplate)
+        call.textSource = templateCache.instantiate(call.platformIndex, call.deviceIndex, call.textSource, call.kernelName, call.waves, call.memFlags, call.scalarArgs);
+    
+    return 0;
+}
+
+static int ExecuteIgorCL(IgorCLRuntimeParamsPtr p) {
+	int err = 0;
+    bool quiet = false;
+    
+    try {
+        // Flag parameters.
+        
+        if (p->ZFlagEncountered) {
+            // Parameter: p->ZFlag_quiet
+            quiet = true;
+            if (p->ZFlagParamsSet[0] != 0)
+                quiet = (p->ZFlag_quiet != 0.0);
+        }
+        
+        IgorCLCalculationCall call;
+        err = ParseCalculationCall(p, "IgorCL", true, call);
+        if (err)
+            return err;
+        
+        size_t kernelHash = 0;
+        double bytesToDevice = 0, bytesFromDevice = 0;
+        if (call.selectDeviceAutomatically) {
+            kernelHash = IgorCLDeviceCostModel::kernelHash(call.textSource, call.kernelName);
+            EstimateTransferBytes(call.waves, call.memFlags, bytesToDevice, bytesFromDevice);
+        }
+        
+        int selectedDeviceIndex = call.deviceIndex;
+        for ( ; ; ) {
+            if (call.selectDeviceAutomatically)
+                selectedDeviceIndex = costModel.selectDevice(call.platformIndex, kernelHash, bytesToDevice, bytesFromDevice, call.nWorkItems);
+            
+            // with device fission, each thread may be routed to its own partition of the device
+            int deviceIndex = deviceFission.deviceIndexForThread(call.platformIndex, selectedDeviceIndex);
+            
+            std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+            bool wavesMayHaveChanged = false;
+            try {
+                if (call.sourceProvidedAsText) {
+                    DoOpenCLCalculation(call.platformIndex, deviceIndex, call.globalRange, call.workgroupSize, call.kernelName, call.waves, call.memFlags, call.fillValues, call.scalarArgs, call.textSource, &wavesMayHaveChanged);
+                } else {
+                    DoOpenCLCalculation(call.platformIndex, deviceIndex, call.globalRange, call.workgroupSize, call.kernelName, call.waves, call.memFlags, call.fillValues, call.scalarArgs, call.programBinary, &wavesMayHaveChanged);
+                }
+            }
+            catch (IgorCLError&) {
+                // with automatic selection, retry on the next best device on which this kernel has not failed yet.
+                // Once the kernel has been enqueued the waves may hold partial results, and running an in-place kernel
+                // again would start from those. The failure is still recorded, so that later calls avoid this device.
+                if (!call.selectDeviceAutomatically || !costModel.recordFailure(call.platformIndex, selectedDeviceIndex, kernelHash) || wavesMayHaveChanged)
+                    throw;
+                continue;
+            }
+            
+            if (call.selectDeviceAutomatically) {
+                double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+                costModel.recordExecution(call.platformIndex, selectedDeviceIndex, kernelHash, bytesToDevice, bytesFromDevice, call.nWorkItems, elapsedSeconds);
+            }
+            break;
+        }
+    }
+    catch (int e) {
+        return e;
+    }
+    catch (IgorCLError& e) {
+        int errorCode = e.getErrorCode();
+        char noticeStr[200];
+        sprintf(noticeStr, "OpenCL error code %d (%s)\r", errorCode, OpenCLErrorCodeToSymbolicName(errorCode).c_str());
+        XOPNotice(noticeStr);
+        SetOperationNumVar("V_Flag", errorCode);
+        if (quiet) {
+            return 0;
+        } else {
+            return OPENCL_ERROR;
+        }
+    }
+    catch (std::range_error& e) {
+        return INDEX_OUT_OF_RANGE;
+    }
+    catch (std::runtime_error& e) {
+        XOPNotice(e.what());
+        XOPNotice("\r");
+        return GENERAL_BAD_VIBS;
+    }
+    catch (...) {
+        return GENERAL_BAD_VIBS;
+    }
+    
+    SetOperationNumVar("V_Flag", err);
+    
+	return err;
+}
+
+static int ExecuteIgorCLCompile(IgorCLCompileRuntimeParamsPtr p) {
+	int err = 0;
+    bool quiet = false;
+    std::string buildLog;
+    
+    try {
+        // Flag parameters.
+        
+        int platformIndex, deviceIndex;
+        err = ResolveDeviceFlags(p, platformIndex, deviceIndex, NULL);
+        if (err)
+            return err;
+        
+        DataFolderAndName destination;
+        if (p->DESTFlagEncountered) {
+            // Parameter: p->DESTFlag_destination
+            destination = p->DESTFlag_destination;
+        } else {
+            destination.dfH = NULL;
+            strcpy(destination.name, "W_CompiledBinary");
+        }
+        
+        if (p->ZFlagEncountered) {
+            quiet = true;
+            if (p->ZFlagParamsSet[0] != 0)
+                quiet = (p->ZFlag_quiet != 0.0);
+        }
+        
+        // Main parameters.
+        
+        std::string programSource;
+        if (p->programSourceEncountered) {
+            // Parameter: p->programSource (test for NULL handle before using)
+            if (p->programSource == NULL)
+                return EXPECTED_STRING;
+            programSource = GetStdStringFromHandle(p->programSource);
+        } else {
+            return EXPECTED_STRING;
+        }
+        
+        // do the actual compilation
+        std::vector<char> compiledBinary;
+        compiledBinary = CompileSource(platformIndex, deviceIndex, programSource, buildLog);
+        
+        // copy the compiled binary back out to an Igor wave
+        size_t nBytes = compiledBinary.size();
+        CountInt dimensionSizes[MAX_DIMENSIONS + 1];
+        dimensionSizes[0] = nBytes;
+        dimensionSizes[1] = 0;
+        waveHndl outputWave;
+        err = MDMakeWave(&outputWave, destination.name, destination.dfH, dimensionSizes, NT_I8, 1);
+        if (err)
+            return err;
+        
+        memcpy(WaveData(outputWave), reinterpret_cast<void*>(&compiledBinary[0]), nBytes);
+    }
+    catch (int e) {
+        return e;
+    }
+    catch (IgorCLError& e) {
+        int errorCode = e.getErrorCode();
+        SetOperationNumVar("V_Flag", errorCode);
+        SetOperationStrVar("S_BuildLog", buildLog.c_str());
+        if (!quiet) {
+            char noticeStr[100];
+            sprintf(noticeStr, "\rOpenCL error code %d\r", errorCode);
+            XOPNotice(noticeStr);
+            return OPENCL_ERROR;
+        }
+        return 0;
+    }
+    catch (std::range_error& e) {
+        return INDEX_OUT_OF_RANGE;
+    }
+    catch (std::runtime_error& e) {
+        XOPNotice(e.what());
+        XOPNotice("\r");
+        return GENERAL_BAD_VIBS;
+    }
+    catch (...) {
+        return GENERAL_BAD_VIBS;
+    }
+    
+    SetOperationNumVar("V_Flag", err);
+    SetOperationStrVar("S_BuildLog", buildLog.c_str());
+    
+	return err;
+}
+
+static int ExecuteIgorCLInfo(IgorCLInfoRuntimeParamsPtr p) {
+	int err = 0;
+    cl_int status;
+    
+    char noticeString[256];
+    
+    try {
+        
+        // fetch information on the platforms
+        std::vector<cl::Platform> platforms;
+        for (size_t i = 0; i < deviceTable.nPlatforms(); ++i) {
+            platforms.push_back(deviceTable.getPlatform(i));
+        }
+        
         // create a text wave that will store the information
         waveHndl platformsWave;
         waveHndl devicesWave;
@@ -540,9 +1175,8 @@ static int ExecuteIgorCLInfo(IgorCLInfoRuntimeParamsPtr p) {
             indices[0] = 1;
             StoreStringInTextWave(platforms[i].getInfo<CL_PLATFORM_VERSION>().c_str(), platformsWave, indices);
             
-            // device information
-            std::vector<cl::Device> devices;
-            status = platforms[i].getDevices(CL_DEVICE_TYPE_ALL, &devices);
+            // device information, including sub-devices
+            std::vector<cl::Device> devices = deviceFission.getDevices(i);
             
             char deviceWaveName[50];
             sprintf(deviceWaveName, "M_OpenCLDevices%d", i);
@@ -789,13 +1423,866 @@ static int ExecuteIgorCLInfo(IgorCLInfoRuntimeParamsPtr p) {
                 indices[0] += 1;
                 StoreStringInTextWave(devices[j].getInfo<CL_DEVICE_EXTENSIONS>(), devicesWave, indices);
             }
+            
+            // the same information as numbers, one labeled row per property and one column per device.
+            // Physical devices come from the device table, sub-devices are queried directly.
+            const std::vector<IgorCLDeviceDescription>& physicalDevices = deviceTable.getDeviceDescriptions(i);
+            waveHndl deviceInfoWave;
+            sprintf(deviceWaveName, "M_OpenCLDeviceInfo%d", i);
+            dimensionSizes[0] = IgorCLNDeviceCapabilities;
+            dimensionSizes[1] = devices.size();
+            dimensionSizes[2] = 0;
+            err = MDMakeWave(&deviceInfoWave, deviceWaveName, NULL, dimensionSizes, NT_FP64, 1);
+            if (err)
+                return err;
+            for (int k = 0; k < IgorCLNDeviceCapabilities; ++k) {
+                err = MDSetDimensionLabel(deviceInfoWave, 0, k, DeviceCapabilityName(static_cast<IgorCLDeviceCapability>(k)));
+                if (err) return err;
+            }
+            for (int j = 0; j < devices.size(); ++j) {
+                IgorCLDeviceDescription description = (j < physicalDevices.size()) ? physicalDevices[j] : DescribeDevice(devices[j]);
+                indices[1] = j;
+                for (int k = 0; k < IgorCLNDeviceCapabilities; ++k) {
+                    double value[2] = {description.capabilities[k], 0};
+                    indices[0] = k;
+                    err = MDSetNumericWavePointValue(deviceInfoWave, indices, value);
+                    if (err) return err;
+                }
+            }
+            WaveHandleModified(deviceInfoWave);
+        }
+        
+        // command queue usage, one row per platform/device combination that has been used
+        std::vector<IgorCLQueueStatistics> queueStatistics = commandQueueFactory.getQueueStatistics();
+        waveHndl queueStatisticsWave;
+        dimensionSizes[0] = queueStatistics.size();
+        dimensionSizes[1] = 7;
+        dimensionSizes[2] = 0;
+        err = MDMakeWave(&queueStatisticsWave, "M_OpenCLQueueStatistics", NULL, dimensionSizes, NT_FP64, 1);
+        if (err)
+            return err;
+        const char* queueStatisticsLabels[] = {"Platform", "Device", "Queues", "Acquisitions", "Waits", "Total Wait Time", "Max Wait Time"};
+        for (int i = 0; i < 7; ++i) {
+            err = MDSetDimensionLabel(queueStatisticsWave, 1, i, queueStatisticsLabels[i]);
+            if (err) return err;
+        }
+        for (size_t i = 0; i < queueStatistics.size(); ++i) {
+            double values[7] = {static_cast<double>(queueStatistics[i].platformIndex), static_cast<double>(queueStatistics[i].deviceIndex), static_cast<double>(queueStatistics[i].nQueues), queueStatistics[i].nAcquisitions, queueStatistics[i].nWaits, queueStatistics[i].totalWaitTime, queueStatistics[i].maxWaitTime};
+            indices[0] = i;
+            for (int j = 0; j < 7; ++j) {
+                double value[2] = {values[j], 0};
+                indices[1] = j;
+                err = MDSetNumericWavePointValue(queueStatisticsWave, indices, value);
+                if (err) return err;
+            }
+        }
+        
+        // transferred bytes, one row per platform/device combination that has been used
+        std::vector<IgorCLTransferStatistics> transfers = transferStatistics.getStatistics();
+        waveHndl transferStatisticsWave;
+        dimensionSizes[0] = transfers.size();
+        dimensionSizes[1] = 7;
+        dimensionSizes[2] = 0;
+        err = MDMakeWave(&transferStatisticsWave, "M_OpenCLTransferStatistics", NULL, dimensionSizes, NT_FP64, 1);
+        if (err)
+            return err;
+        const char* transferStatisticsLabels[] = {"Platform", "Device", "NUMA Node", "Direct Bytes", "Staged Bytes", "Zero-Copy Bytes", "First-Touched Bytes"};
+        for (int i = 0; i < 7; ++i) {
+            err = MDSetDimensionLabel(transferStatisticsWave, 1, i, transferStatisticsLabels[i]);
+            if (err) return err;
+        }
+        for (size_t i = 0; i < transfers.size(); ++i) {
+            double values[7] = {static_cast<double>(transfers[i].platformIndex), static_cast<double>(transfers[i].deviceIndex), static_cast<double>(transfers[i].isNUMANode), transfers[i].directBytes, transfers[i].stagedBytes, transfers[i].zeroCopyBytes, transfers[i].firstTouchedBytes};
+            indices[0] = i;
+            for (int j = 0; j < 7; ++j) {
+                double value[2] = {values[j], 0};
+                indices[1] = j;
+                err = MDSetNumericWavePointValue(transferStatisticsWave, indices, value);
+                if (err) return err;
+            }
+        }
+        
+    }
+    catch (...) {
+        return GENERAL_BAD_VIBS;
+    }
+    
+	return err;
+}
+
+static int ExecuteIgorCLSettings(IgorCLSettingsRuntimeParamsPtr p) {
+	int err = 0;
+    
+    // Flag parameters.
+    
+    if (p->FISSFlagEncountered) {
+        // Parameter: p->FISSFlag_platform
+        // Parameter: p->FISSFlag_device
+        // Parameter: p->FISSFlag_partitionSpecification (test for NULL handle before using)
+        if ((p->FISSFlag_platform < 0) || (p->FISSFlag_device < 0))
+            return EXPECT_POS_NUM;
+        if (p->FISSFlag_partitionSpecification == NULL)
+            return USING_NULL_STRVAR;
+        std::string partitionSpecification = GetStdStringFromHandle(p->FISSFlag_partitionSpecification);
+        int nSubDevices = 0;
+        int firstSubDevice;
+        try {
+            firstSubDevice = deviceFission.partitionDevice(p->FISSFlag_platform + 0.5, p->FISSFlag_device + 0.5, partitionSpecification, nSubDevices);
+        }
+        catch (IgorCLError& e) {
+            int errorCode = e.getErrorCode();
+            char noticeStr[200];
+            sprintf(noticeStr, "OpenCL error code %d (%s)\r", errorCode, OpenCLErrorCodeToSymbolicName(errorCode).c_str());
+            XOPNotice(noticeStr);
+            return OPENCL_ERROR;
+        }
+        catch (std::runtime_error& e) {
+            XOPNotice(e.what());
+            XOPNotice("\r");
+            return GENERAL_BAD_VIBS;
+        }
+        catch (...) {
+            return GENERAL_BAD_VIBS;
+        }
+        SetOperationNumVar("V_FirstSubDevice", firstSubDevice);
+        SetOperationNumVar("V_NumSubDevices", nSubDevices);
+    }
+    
+    if (p->FTHRFlagEncountered) {
+        // Parameter: p->FTHRFlag_routeThreadsToPartitions
+        deviceFission.setRouteThreadsToPartitions(p->FTHRFlag_routeThreadsToPartitions != 0.0);
+    }
+    
+    if (p->NUMAFlagEncountered) {
+        // Parameter: p->NUMAFlag_firstTouchOnDevice
+        executionSettings.setFirstTouchOnDevice(p->NUMAFlag_firstTouchOnDevice != 0.0);
+    }
+    
+    if (p->CALFFlagEncountered) {
+        // Parameter: p->CALFFlag_calibrationFilePath (test for NULL handle before using)
+        // device calibrations written by IgorCLBench /FILE replace those of the automatic device selection
+        if (p->CALFFlag_calibrationFilePath == NULL)
+            return USING_NULL_STRVAR;
+        try {
+            std::vector<IgorCLDeviceCalibrationRecord> records = ReadCalibrationFile(GetStdStringFromHandle(p->CALFFlag_calibrationFilePath));
+            for (size_t i = 0; i < records.size(); ++i) {
+                const IgorCLDeviceCalibrationRecord& record = records.at(i);
+                costModel.setCalibration(record.platformIndex, record.deviceIndex, record.launchLatency, record.h2dBandwidth[IgorCLTransferDefault], record.d2hBandwidth[IgorCLTransferDefault]);
+            }
+        }
+        catch (int e) {
+            return e;
+        }
+        catch (std::runtime_error& e) {
+            XOPNotice(e.what());
+            XOPNotice("\r");
+            return GENERAL_BAD_VIBS;
+        }
+        catch (...) {
+            return GENERAL_BAD_VIBS;
+        }
+    }
+    
+    if (p->TLQFlagEncountered) {
+        // Parameter: p->TLQFlag_useThreadLocalQueues
+        executionSettings.setUseThreadLocalQueues(p->TLQFlag_useThreadLocalQueues != 0.0);
+    }
+    
+    if (p->QMAXFlagEncountered) {
+        // Parameter: p->QMAXFlag_maxQueuesPerDevice
+        if (p->QMAXFlag_maxQueuesPerDevice < 0)
+            return EXPECT_POS_NUM;
+        executionSettings.setMaxQueuesPerDevice(static_cast<int>(p->QMAXFlag_maxQueuesPerDevice + 0.5));
+    }
+    
+    if (p->SUBTFlagEncountered) {
+        // Parameter: p->SUBTFlag_useSubmissionThread
+        executionSettings.setUseSubmissionThread(p->SUBTFlag_useSubmissionThread != 0.0);
+    }
+    
+    if (p->SHCXFlagEncountered) {
+        // Parameter: p->SHCXFlag_useSharedContexts
+        // waits for calls in progress, since they may hold queues that belong to the context of the current mode.
+        executionSettings.changeContextMode(p->SHCXFlag_useSharedContexts != 0.0);
+    }
+    
+    // report the current settings
+    SetOperationNumVar("V_ThreadLocalQueues", executionSettings.useThreadLocalQueues());
+    SetOperationNumVar("V_MaxQueuesPerDevice", executionSettings.maxQueuesPerDevice());
+    SetOperationNumVar("V_SubmissionThread", executionSettings.useSubmissionThread());
+    SetOperationNumVar("V_SharedContexts", executionSettings.useSharedContexts());
+    SetOperationNumVar("V_ThreadPartitions", deviceFission.routeThreadsToPartitions());
+    SetOperationNumVar("V_NUMAFirstTouch", executionSettings.firstTouchOnDevice());
+    
+	return err;
+}
+
+static int ExecuteIgorCLBuffer(IgorCLBufferRuntimeParamsPtr p) {
+	int err = 0;
+    bool quiet = false;
+    
+    try {
+        // Flag parameters.
+        
+        int platformIndex, deviceIndex;
+        err = ResolveDeviceFlags(p, platformIndex, deviceIndex, NULL);
+        if (err)
+            return err;
+        
+        if (p->ZFlagEncountered) {
+            quiet = true;
+            if (p->ZFlagParamsSet[0] != 0)
+                quiet = (p->ZFlag_quiet != 0.0);
+        }
+        
+        // exactly one action
+        int nActions = p->NEWFlagEncountered + p->READFlagEncountered + p->MIGRFlagEncountered + p->COPYFlagEncountered + p->FREEFlagEncountered;
+        if (nActions != 1) {
+            XOPNotice("Exactly one of the /NEW, /READ, /MIGR, /COPY, or /FREE flags must be specified\r");
+            return SYNERR;
+        }
+        
+        double bufferID = 0;
+        if (p->NEWFlagEncountered) {
+            // Parameter: p->NEWFlag_sourceWave (test for NULL handle before using)
+            // the buffer is created on the selected device and initialized with the contents of the wave.
+            if ((err = CheckKernelArgumentWave(p->NEWFlag_sourceWave)))
+                return err;
+            bufferID = residentBuffers.createBuffer(platformIndex, deviceIndex, WaveDataSizeInBytes(p->NEWFlag_sourceWave), WaveData(p->NEWFlag_sourceWave));
+        }
+        
+        if (p->READFlagEncountered) {
+            // Parameter: p->READFlag_bufferID
+            // Parameter: p->READFlag_destinationWave (test for NULL handle before using)
+            if ((err = CheckKernelArgumentWave(p->READFlag_destinationWave)))
+                return err;
+            bufferID = p->READFlag_bufferID;
+            residentBuffers.readBuffer(p->READFlag_bufferID + 0.5, WaveData(p->READFlag_destinationWave), WaveDataSizeInBytes(p->READFlag_destinationWave));
+            WaveHandleModified(p->READFlag_destinationWave);
+        }
+        
+        if (p->MIGRFlagEncountered) {
+            // Parameter: p->MIGRFlag_bufferID
+            // moves the buffer to the selected device
+            bufferID = p->MIGRFlag_bufferID;
+            residentBuffers.migrateBuffer(p->MIGRFlag_bufferID + 0.5, platformIndex, deviceIndex);
+        }
+        
+        if (p->COPYFlagEncountered) {
+            // Parameter: p->COPYFlag_bufferID
+            // copies the buffer to a new buffer on the selected device
+            bufferID = residentBuffers.copyBuffer(p->COPYFlag_bufferID + 0.5, platformIndex, deviceIndex);
+        }
+        
+        if (p->FREEFlagEncountered) {
+            // Parameter: p->FREEFlag_bufferID
+            bufferID = p->FREEFlag_bufferID;
+            residentBuffers.releaseBuffer(p->FREEFlag_bufferID + 0.5);
+        }
+        
+        SetOperationNumVar("V_Value", bufferID);
+    }
+    catch (int e) {
+        return e;
+    }
+    catch (IgorCLError& e) {
+        int errorCode = e.getErrorCode();
+        char noticeStr[200];
+        sprintf(noticeStr, "OpenCL error code %d (%s)\r", errorCode, OpenCLErrorCodeToSymbolicName(errorCode).c_str());
+        XOPNotice(noticeStr);
+        SetOperationNumVar("V_Flag", errorCode);
+        if (quiet) {
+            return 0;
+        } else {
+            return OPENCL_ERROR;
+        }
+    }
+    catch (std::range_error& e) {
+        return INDEX_OUT_OF_RANGE;
+    }
+    catch (std::runtime_error& e) {
+        XOPNotice(e.what());
+        XOPNotice("\r");
+        return GENERAL_BAD_VIBS;
+    }
+    catch (...) {
+        return GENERAL_BAD_VIBS;
+    }
+    
+    SetOperationNumVar("V_Flag", err);
+    
+	return err;
+}
+
+static int ExecuteIgorCLBench(IgorCLBenchRuntimeParamsPtr p) {
+	int err = 0;
+    bool quiet = false;
+    
+    try {
+        // Flag parameters.
+        
+        int platformIndex, selectedDeviceIndex;
+        bool selectDeviceAutomatically;
+        err = ResolveDeviceFlags(p, platformIndex, selectedDeviceIndex, &selectDeviceAutomatically);
+        if (err)
+            return err;
+        if (selectDeviceAutomatically) {
+            XOPNotice("/DTYP=AUTO cannot be used with IgorCLBench, omit /DTYP to measure all devices\r");
+            return SYNERR;
+        }
+        
+        // without /DEV, /DTYP or /DSEL, all devices of the platform are measured.
+        std::vector<int> deviceIndices;
+        if (p->DEVFlagEncountered || p->DTYPFlagEncountered || p->DSELFlagEncountered) {
+            deviceIndices.push_back(selectedDeviceIndex);
+        } else {
+            size_t nDevices = deviceFission.getDevices(platformIndex, false).size();
+            for (size_t i = 0; i < nDevices; ++i) {
+                deviceIndices.push_back(i);
+            }
+        }
+        
+        // transfer sizes in bytes, by default 4 kB to 64 MB
+        std::vector<size_t> transferSizes;
+        if (p->SIZEFlagEncountered) {
+            // Parameter: p->SIZEFlag_transferSizes
+            std::vector<double> sizes;
+            err = GetValuesFrom1DNumericWave(p->SIZEFlag_transferSizes, sizes);
+            if (err)
+                return err;
+            for (size_t i = 0; i < sizes.size(); ++i) {
+                if (sizes[i] < 1)
+                    return EXPECT_POS_NUM;
+                transferSizes.push_back(sizes[i] + 0.5);
+            }
+            if (transferSizes.empty())
+                return GENERAL_BAD_VIBS;
+        } else {
+            for (size_t nBytes = 1 << 12; nBytes <= (1 << 26); nBytes *= 4) {
+                transferSizes.push_back(nBytes);
+            }
+        }
+        
+        int nRepeats = 5;
+        if (p->REPSFlagEncountered) {
+            // Parameter: p->REPSFlag_repeats
+            if (p->REPSFlag_repeats < 1)
+                return EXPECT_POS_NUM;
+            nRepeats = p->REPSFlag_repeats + 0.5;
+        }
+        
+        std::string calibrationFilePath;
+        if (p->FILEFlagEncountered) {
+            // Parameter: p->FILEFlag_calibrationFilePath (test for NULL handle before using)
+            if (p->FILEFlag_calibrationFilePath == NULL)
+                return USING_NULL_STRVAR;
+            calibrationFilePath = GetStdStringFromHandle(p->FILEFlag_calibrationFilePath);
+        }
+        
+        if (p->ZFlagEncountered) {
+            quiet = true;
+            if (p->ZFlagParamsSet[0] != 0)
+                quiet = (p->ZFlag_quiet != 0.0);
+        }
+        
+        const char* columnLabels[] = {"Size", "H2D Default", "D2H Default", "H2D Pinned", "D2H Pinned", "H2D Host Pointer", "D2H Host Pointer",
+                                      "Launch Latency", "Finish Latency", "Compile Time"};
+        const int nColumns = sizeof(columnLabels) / sizeof(columnLabels[0]);
+        std::vector<IgorCLDeviceCalibrationRecord> records;
+        for (size_t deviceNumber = 0; deviceNumber < deviceIndices.size(); ++deviceNumber) {
+            int deviceIndex = deviceIndices.at(deviceNumber);
+            IgorCLBenchmarkResult result = BenchmarkDevice(platformIndex, deviceIndex, transferSizes, nRepeats);
+            
+            // one row per transfer size. Bandwidths are in bytes per second, the latencies (in seconds) are the same in every row.
+            char benchWaveName[50];
+            sprintf(benchWaveName, "M_OpenCLBench%d_%d", platformIndex, deviceIndex);
+            CountInt dimensionSizes[MAX_DIMENSIONS + 1];
+            dimensionSizes[0] = transferSizes.size();
+            dimensionSizes[1] = nColumns;
+            dimensionSizes[2] = 0;
+            waveHndl benchWave;
+            err = MDMakeWave(&benchWave, benchWaveName, NULL, dimensionSizes, NT_FP64, 1);
+            if (err)
+                return err;
+            for (int j = 0; j < nColumns; ++j) {
+                err = MDSetDimensionLabel(benchWave, 1, j, columnLabels[j]);
+                if (err)
+                    return err;
+            }
+            
+            IndexInt indices[MAX_DIMENSIONS];
+            double value[2] = {0, 0};
+            for (size_t i = 0; i < transferSizes.size(); ++i) {
+                indices[0] = i;
+                std::vector<double> row;
+                row.push_back(transferSizes.at(i));
+                for (int j = 0; j < IgorCLNTransferStrategies; ++j) {
+                    row.push_back(result.h2dBandwidth[j].at(i));
+                    row.push_back(result.d2hBandwidth[j].at(i));
+                }
+                row.push_back(result.launchLatency);
+                row.push_back(result.finishLatency);
+                row.push_back(result.compileTime);
+                for (int j = 0; j < nColumns; ++j) {
+                    indices[1] = j;
+                    value[0] = row.at(j);
+                    err = MDSetNumericWavePointValue(benchWave, indices, value);
+                    if (err)
+                        return err;
+                }
+            }
+            WaveHandleModified(benchWave);
+            
+            // the largest transfer is the best estimate of the sustained bandwidth
+            IgorCLDeviceCalibrationRecord record;
+            record.platformIndex = platformIndex;
+            record.deviceIndex = deviceIndex;
+            record.launchLatency = result.launchLatency;
+            record.finishLatency = result.finishLatency;
+            record.compileTime = result.compileTime;
+            size_t largestTransfer = std::max_element(transferSizes.begin(), transferSizes.end()) - transferSizes.begin();
+            for (int j = 0; j < IgorCLNTransferStrategies; ++j) {
+                record.h2dBandwidth[j] = result.h2dBandwidth[j].at(largestTransfer);
+                record.d2hBandwidth[j] = result.d2hBandwidth[j].at(largestTransfer);
+            }
+            records.push_back(record);
+            costModel.setCalibration(platformIndex, deviceIndex, record.launchLatency, record.h2dBandwidth[IgorCLTransferDefault], record.d2hBandwidth[IgorCLTransferDefault]);
+        }
+        
+        if (!calibrationFilePath.empty())
+            WriteCalibrationFile(calibrationFilePath, records);
+    }
+    catch (int e) {
+        return e;
+    }
+    catch (IgorCLError& e) {
+        int errorCode = e.getErrorCode();
+        char noticeStr[200];
+        sprintf(noticeStr, "OpenCL error code %d (%s)\r", errorCode, OpenCLErrorCodeToSymbolicName(errorCode).c_str());
+        XOPNotice(noticeStr);
+        SetOperationNumVar("V_Flag", errorCode);
+        if (quiet) {
+            return 0;
+        } else {
+            return OPENCL_ERROR;
+        }
+    }
+    catch (std::range_error& e) {
+        return INDEX_OUT_OF_RANGE;
+    }
+    catch (std::runtime_error& e) {
+        XOPNotice(e.what());
+        XOPNotice("\r");
+        return GENERAL_BAD_VIBS;
+    }
+    catch (...) {
+        return GENERAL_BAD_VIBS;
+    }
+    
+    SetOperationNumVar("V_Flag", err);
+    
+	return err;
+}
+
+static int ExecuteIgorCLStats(IgorCLStatsRuntimeParamsPtr p) {
+	int err = 0;
+    
+    // Flag parameters.
+    
+    bool reset = false;
+    if (p->RSETFlagEncountered) {
+        // the counters are reset as they are read, so no updates are lost in between
+        reset = true;
+    }
+    
+    std::vector<double> counters, phaseTimes;
+    statisticsCounters.getCounters(counters, phaseTimes, reset);
+    std::vector<std::vector<double> > deviceBytes = statisticsCounters.getDeviceBytes(reset);
+    
+    // one labeled point per counter, followed by the cumulative time per phase in seconds
+    waveHndl statsWave;
+    CountInt dimensionSizes[MAX_DIMENSIONS + 1];
+    IndexInt indices[MAX_DIMENSIONS];
+    double value[2] = {0, 0};
+    dimensionSizes[0] = IgorCLNCounters + IgorCLNPhases;
+    dimensionSizes[1] = 0;
+    err = MDMakeWave(&statsWave, "W_IgorCLStats", NULL, dimensionSizes, NT_FP64, 1);
+    if (err)
+        return err;
+    for (int i = 0; i < IgorCLNCounters; ++i) {
+        indices[0] = i;
+        value[0] = counters[i];
+        if ((err = MDSetDimensionLabel(statsWave, 0, i, IgorCLStatisticsCounters::counterName(static_cast<IgorCLCounter>(i)))))
+            return err;
+        if ((err = MDSetNumericWavePointValue(statsWave, indices, value)))
+            return err;
+    }
+    for (int i = 0; i < IgorCLNPhases; ++i) {
+        indices[0] = IgorCLNCounters + i;
+        value[0] = phaseTimes[i];
+        if ((err = MDSetDimensionLabel(statsWave, 0, IgorCLNCounters + i, IgorCLStatisticsCounters::phaseName(static_cast<IgorCLPhase>(i)))))
+            return err;
+        if ((err = MDSetNumericWavePointValue(statsWave, indices, value)))
+            return err;
+    }
+    WaveHandleModified(statsWave);
+    
+    // one row per device that transferred data
+    const char* columnLabels[] = {"Platform", "Device", "Bytes Uploaded", "Bytes Downloaded"};
+    const int nColumns = sizeof(columnLabels) / sizeof(columnLabels[0]);
+    waveHndl deviceBytesWave;
+    dimensionSizes[0] = deviceBytes.size();
+    dimensionSizes[1] = nColumns;
+    dimensionSizes[2] = 0;
+    err = MDMakeWave(&deviceBytesWave, "M_IgorCLStatsDeviceBytes", NULL, dimensionSizes, NT_FP64, 1);
+    if (err)
+        return err;
+    for (int j = 0; j < nColumns; ++j) {
+        if ((err = MDSetDimensionLabel(deviceBytesWave, 1, j, columnLabels[j])))
+            return err;
+    }
+    for (size_t i = 0; i < deviceBytes.size(); ++i) {
+        indices[0] = i;
+        for (int j = 0; j < nColumns; ++j) {
+            indices[1] = j;
+            value[0] = deviceBytes[i][j];
+            if ((err = MDSetNumericWavePointValue(deviceBytesWave, indices, value)))
+                return err;
+        }
+    }
+    WaveHandleModified(deviceBytesWave);
+    
+	return err;
+}
+
+static int ExecuteIgorCLKernelInfo(IgorCLKernelInfoRuntimeParamsPtr p) {
+	int err = 0;
+    bool quiet = false;
+    
+    try {
+        // Flag parameters.
+        
+        int platformIndex, deviceIndex;
+        err = ResolveDeviceFlags(p, platformIndex, deviceIndex, NULL);
+        if (err)
+            return err;
+        
+        bool sourceProvidedAsText = false;
+        std::string textSource;
+        if (p->SRCTFlagEncountered) {
+            // Parameter: p->SRCTFlag_sourceText (test for NULL handle before using)
+            if (p->SRCTFlag_sourceText == NULL)
+                return USING_NULL_STRVAR;
+            sourceProvidedAsText = true;
+            textSource = GetStdStringFromHandle(p->SRCTFlag_sourceText);
+        }
+        
+        std::vector<char> programBinary;
+        if (p->SRCBFlagEncountered) {
+            // Parameter: p->SRCBFlag_sourceBinary (test for NULL handle before using)
+            if (p->SRCBFlag_sourceBinary == NULL)
+                return NULL_WAVE_OP;
+            if (sourceProvidedAsText)
+                return GENERAL_BAD_VIBS;    // program needs to be provided as text OR binary
+            
+            waveHndl programBinaryWave = p->SRCBFlag_sourceBinary;
+            // require a 1D wave containing bytes
+            if (WaveType(programBinaryWave) != NT_I8)
+                return NT_INCOMPATIBLE;
+            int numDimensions;
+            CountInt dimensionSizes[MAX_DIMENSIONS + 1];
+            err = MDGetWaveDimensions(programBinaryWave, &numDimensions, dimensionSizes);
+            if (err)
+                return err;
+            if (numDimensions != 1)
+                return INCOMPATIBLE_DIMENSIONING;
+            programBinary.resize(dimensionSizes[0]);
+            memcpy(reinterpret_cast<void*>(&programBinary[0]), WaveData(programBinaryWave), dimensionSizes[0]);
+        } else if (!sourceProvidedAsText) {
+            return EXPECTED_STRING;         // program needs to be provided as text OR binary
+        }
+        
+        // without /KERN only the names of the kernels are reported
+        std::string kernelName;
+        if (p->KERNFlagEncountered) {
+            // Parameter: p->KERNFlag_kernelName (test for NULL handle before using)
+            if (p->KERNFlag_kernelName == NULL)
+                return USING_NULL_STRVAR;
+            kernelName = GetStdStringFromHandle(p->KERNFlag_kernelName);
+        }
+        
+        // the source is a template (IgorCL /TMPL), arguments that use a type wildcard report the wildcard as their type
+        bool sourceIsTemplate = false;
+        if (p->TMPLFlagEncountered) {
+            if (!sourceProvidedAsText)
+                throw std::runtime_error("/TMPL requires the program source (/SRCT)");
+            sourceIsTemplate = true;
+        }
+        
+        if (p->ZFlagEncountered) {
+            quiet = true;
+            if (p->ZFlagParamsSet[0] != 0)
+                quiet = (p->ZFlag_quiet != 0.0);
+        }
+        
+        std::vector<std::string> kernelNames;
+        if (sourceIsTemplate) {
+            kernelNames = IgorCLTemplateCache::kernelNames(platformIndex, deviceIndex, textSource);
+        } else if (sourceProvidedAsText) {
+            kernelNames = GetKernelNames(platformIndex, deviceIndex, textSource);
+        } else {
+            kernelNames = GetKernelNames(platformIndex, deviceIndex, programBinary);
+        }
+        waveHndl kernelNamesWave;
+        CountInt dimensionSizes[MAX_DIMENSIONS + 1];
+        IndexInt indices[MAX_DIMENSIONS];
+        dimensionSizes[0] = kernelNames.size();
+        dimensionSizes[1] = 0;
+        err = MDMakeWave(&kernelNamesWave, "W_KernelNames", NULL, dimensionSizes, TEXT_WAVE_TYPE, 1);
+        if (err)
+            return err;
+        for (size_t i = 0; i < kernelNames.size(); ++i) {
+            indices[0] = i;
+            StoreStringInTextWave(kernelNames.at(i), kernelNamesWave, indices);
+        }
+        WaveHandleModified(kernelNamesWave);
+        if (kernelName.empty()) {
+            SetOperationNumVar("V_Flag", 0);
+            return 0;
+        }
+        
+        IgorCLKernelInfo info;
+        if (sourceIsTemplate) {
+            info = IgorCLTemplateCache::kernelInfo(platformIndex, deviceIndex, textSource, kernelName);
+        } else if (sourceProvidedAsText) {
+            info = GetKernelInfo(platformIndex, deviceIndex, kernelName, textSource);
+        } else {
+            info = GetKernelInfo(platformIndex, deviceIndex, kernelName, programBinary);
+        }
+        
+        // one labeled point per property. Memory sizes are in bytes, the private memory size is per work item.
+        const char* infoLabels[] = {"Work Group Size", "Preferred Work Group Size Multiple", "Local Mem Size", "Private Mem Size", "Num Args"};
+        const double infoValues[] = {static_cast<double>(info.workGroupSize), static_cast<double>(info.preferredWorkGroupSizeMultiple),
+                                     static_cast<double>(info.localMemSize), static_cast<double>(info.privateMemSize), static_cast<double>(info.nArguments)};
+        const int nInfoValues = sizeof(infoLabels) / sizeof(infoLabels[0]);
+        waveHndl infoWave;
+        double value[2] = {0, 0};
+        dimensionSizes[0] = nInfoValues;
+        dimensionSizes[1] = 0;
+        err = MDMakeWave(&infoWave, "W_KernelInfo", NULL, dimensionSizes, NT_FP64, 1);
+        if (err)
+            return err;
+        for (int i = 0; i < nInfoValues; ++i) {
+            indices[0] = i;
+            value[0] = infoValues[i];
+            if ((err = MDSetDimensionLabel(infoWave, 0, i, infoLabels[i])))
+                return err;
+            if ((err = MDSetNumericWavePointValue(infoWave, indices, value)))
+                return err;
+        }
+        WaveHandleModified(infoWave);
+        
+        // one row per argument. Has no rows if the implementation does not provide the argument metadata.
+        const char* columnLabels[] = {"Name", "Type", "Address Qualifier", "Access Qualifier", "Type Qualifier"};
+        const int nColumns = sizeof(columnLabels) / sizeof(columnLabels[0]);
+        waveHndl argInfoWave;
+        dimensionSizes[0] = info.arguments.size();
+        dimensionSizes[1] = nColumns;
+        dimensionSizes[2] = 0;
+        err = MDMakeWave(&argInfoWave, "M_KernelArgInfo", NULL, dimensionSizes, TEXT_WAVE_TYPE, 1);
+        if (err)
+            return err;
+        for (int j = 0; j < nColumns; ++j) {
+            if ((err = MDSetDimensionLabel(argInfoWave, 1, j, columnLabels[j])))
+                return err;
+        }
+        for (size_t i = 0; i < info.arguments.size(); ++i) {
+            const IgorCLKernelArgumentInfo& argument = info.arguments.at(i);
+            indices[0] = i;
+            indices[1] = 0;
+            StoreStringInTextWave(argument.name, argInfoWave, indices);
+            indices[1] = 1;
+            StoreStringInTextWave(argument.typeName, argInfoWave, indices);
+            indices[1] = 2;
+            StoreStringInTextWave(argument.addressQualifier, argInfoWave, indices);
+            indices[1] = 3;
+            StoreStringInTextWave(argument.accessQualifier, argInfoWave, indices);
+            indices[1] = 4;
+            StoreStringInTextWave(argument.typeQualifier, argInfoWave, indices);
+        }
+        WaveHandleModified(argInfoWave);
+        
+        // memory flags derived from the argument metadata, can be passed to IgorCL /MFLG
+        waveHndl memFlagsWave;
+        dimensionSizes[0] = info.arguments.size();
+        dimensionSizes[1] = 0;
+        err = MDMakeWave(&memFlagsWave, "W_KernelMemFlags", NULL, dimensionSizes, NT_I32 | NT_UNSIGNED, 1);
+        if (err)
+            return err;
+        for (size_t i = 0; i < info.arguments.size(); ++i) {
+            indices[0] = i;
+            value[0] = info.arguments.at(i).memFlags;
+            if ((err = MDSetNumericWavePointValue(memFlagsWave, indices, value)))
+                return err;
+        }
+        WaveHandleModified(memFlagsWave);
+        if (!info.haveArgumentInfo)
+            XOPNotice("The OpenCL implementation does not provide argument information for this kernel\r");
+    }
+    catch (int e) {
+        return e;
+    }
+    catch (IgorCLError& e) {
+        int errorCode = e.getErrorCode();
+        char noticeStr[200];
+        sprintf(noticeStr, "OpenCL error code %d (%s)\r", errorCode, OpenCLErrorCodeToSymbolicName(errorCode).c_str());
+        XOPNotice(noticeStr);
+        SetOperationNumVar("V_Flag", errorCode);
+        if (quiet) {
+            return 0;
+        } else {
+            return OPENCL_ERROR;
+        }
+    }
+    catch (std::range_error& e) {
+        return INDEX_OUT_OF_RANGE;
+    }
+    catch (std::runtime_error& e) {
+        XOPNotice(e.what());
+        XOPNotice("\r");
+        return GENERAL_BAD_VIBS;
+    }
+    catch (...) {
+        return GENERAL_BAD_VIBS;
+    }
+    
+    SetOperationNumVar("V_Flag", err);
+    
+	return err;
+}
+
+// the flags that describe the calculation of a session, which cannot change after /NEW
+static bool HasSessionCreationFlags(IgorCLSessionRuntimeParamsPtr p) {
+    return p->PLTMFlagEncountered || p->DEVFlagEncountered || p->DTYPFlagEncountered || p->DSELFlagEncountered ||
+        p->SRCTFlagEncountered || p->SRCBFlagEncountered || p->KERNFlagEncountered || p->TMPLFlagEncountered ||
+        p->GSZEFlagEncountered || p->WGRPFlagEncountered || p->MFLGFlagEncountered || p->FILVFlagEncountered ||
+        p->DYNFlagEncountered || p->SCLRFlagEncountered;
+}
+
+static int ExecuteIgorCLSession(IgorCLSessionRuntimeParamsPtr p) {
+	int err = 0;
+    bool quiet = false;
+    
+    try {
+        // Flag parameters.
+        
+        if (p->ZFlagEncountered) {
+            quiet = true;
+            if (p->ZFlagParamsSet[0] != 0)
+                quiet = (p->ZFlag_quiet != 0.0);
+        }
+        
+        // exactly one action
+        int nActions = p->NEWFlagEncountered + p->RUNFlagEncountered + p->FREEFlagEncountered;
+        if (nActions != 1) {
+            XOPNotice("Exactly one of the /NEW, /RUN, or /FREE flags must be specified\r");
+            return SYNERR;
+        }
+        
+        // everything but the waves is fixed when the session is created
+        if ((p->RUNFlagEncountered || p->FREEFlagEncountered) && HasSessionCreationFlags(p)) {
+            XOPNotice("/RUN and /FREE only take the session ID, the other flags can only be used with /NEW\r");
+            return SYNERR;
+        }
+        
+        double sessionID = 0;
+        if (p->FREEFlagEncountered) {
+            // Parameter: p->FREEFlag_sessionID
+            sessionID = p->FREEFlag_sessionID;
+            sessions.releaseSession(p->FREEFlag_sessionID + 0.5);
+            SetOperationNumVar("V_Value", sessionID);
+            SetOperationNumVar("V_Flag", 0);
+            return 0;
+        }
+        
+        if (p->RUNFlagEncountered) {
+            // Parameter: p->RUNFlag_sessionID
+            // Main parameters.
+            std::vector<waveHndl> waves;
+            err = GetKernelArgumentWaves(p, waves);
+            if (err)
+                return err;
+            sessionID = p->RUNFlag_sessionID;
+            sessions.runSession(p->RUNFlag_sessionID + 0.5, waves);
+            SetOperationNumVar("V_Value", sessionID);
+            SetOperationNumVar("V_Flag", 0);
+            return 0;
+        }
+        
+        IgorCLCalculationCall call;
+        err = ParseCalculationCall(p, "IgorCLSession", false, call);
+        if (err)
+            return err;
+        
+        // one point per wave, non-zero if the wave is transferred on every run. Without /DYN all waves are dynamic.
+        std::vector<bool> isDynamic;
+        if (p->DYNFlagEncountered) {
+            // Parameter: p->DYNFlag_dynamicFlagsWave
+            std::vector<double> dynamicFlags;
+            err = GetValuesFrom1DNumericWave(p->DYNFlag_dynamicFlagsWave, dynamicFlags);
+            if (err)
+                return err;
+            for (size_t i = 0; i < dynamicFlags.size(); i+=1) {
+                isDynamic.push_back(dynamicFlags[i] != 0.0);
+            }
+        } else {
+            isDynamic.assign(call.waves.size(), true);
+        }
+        if (isDynamic.size() != call.waves.size()) {
+            XOPNotice("the wave containing dynamic flags must have one point for every wave passed to IgorCLSession\r");
+            return GENERAL_BAD_VIBS;
         }
         
+        // with device fission, the session is bound to the partition of the creating thread
+        int deviceIndex = deviceFission.deviceIndexForThread(call.platformIndex, call.deviceIndex);
+        
+        if (call.sourceProvidedAsText) {
+            sessionID = sessions.createSession(call.platformIndex, deviceIndex, call.globalRange, call.workgroupSize, call.kernelName, call.waves, call.memFlags, call.fillValues, call.scalarArgs, isDynamic, call.textSource);
+        } else {
+            sessionID = sessions.createSession(call.platformIndex, deviceIndex, call.globalRange, call.workgroupSize, call.kernelName, call.waves, call.memFlags, call.fillValues, call.scalarArgs, isDynamic, call.programBinary);
+        }
+        
+        SetOperationNumVar("V_Value", sessionID);
+    }
+    catch (int e) {
+        return e;
+    }
+    catch (IgorCLError& e) {
+        int errorCode = e.getErrorCode();
+        char noticeStr[200];
+        sprintf(noticeStr, "OpenCL error code %d (%s)\r", errorCode, OpenCLErrorCodeToSymbolicName(errorCode).c_str());
+        XOPNotice(noticeStr);
+        SetOperationNumVar("V_Flag", errorCode);
+        if (quiet) {
+            return 0;
+        } else {
+            return OPENCL_ERROR;
+        }
+    }
+    catch (std::range_error& e) {
+        return INDEX_OUT_OF_RANGE;
+    }
+    catch (std::runtime_error& e) {
+        XOPNotice(e.what());
+        XOPNotice("\r");
+        return GENERAL_BAD_VIBS;
     }
     catch (...) {
         return GENERAL_BAD_VIBS;
     }
     
+    SetOperationNumVar("V_Flag", err);
+	
 	return err;
 }
 
@@ -805,7 +2292,7 @@ static int RegisterIgorCL(void) {
 	const char* runtimeStrVarList;
     
 	// NOTE: If you change this template, you must change the IgorCLRuntimeParams structure as well.
-    cmdTemplate = "IgorCL /PLTM=number:platform /DEV=number:device /DTYP=string:deviceType /SRCT=string:sourceText /SRCB=wave:sourceBinary /KERN=string:kernelName /GSZE={number:globalSize0, number:globalSize1, number:globalSize2} /WGRP={number:wgSize0, number:wgSize1, number:wgSize2} /MFLG=wave:memoryFlagsWave /Z[=number:quiet] wave[12]:dataWaves";
+    cmdTemplate = "IgorCL /PLTM=number:platform /DEV=number:device /DTYP=string:deviceType /DSEL=string:deviceSelector /SRCT=string:sourceText /SRCB=wave:sourceBinary /KERN=string:kernelName /TMPL /GSZE={number:globalSize0, number:globalSize1, number:globalSize2} /WGRP={number:wgSize0, number:wgSize1, number:wgSize2} /MFLG=wave:memoryFlagsWave /FILV=wave:fillValuesWave /WAVES=wave:argumentWaves /SCLR={wave:scalarValues, wave:scalarTypes, wave:scalarIndices} /Z[=number:quiet] [wave[12]:dataWaves]";
 	runtimeNumVarList = "V_Flag;";
 	runtimeStrVarList = "";
 	return RegisterOperation(cmdTemplate, runtimeNumVarList, runtimeStrVarList, sizeof(IgorCLRuntimeParams), (void*)ExecuteIgorCL, kOperationIsThreadSafe);
@@ -817,7 +2304,7 @@ static int RegisterIgorCLCompile(void) {
 	const char* runtimeStrVarList;
     
 	// NOTE: If you change this template, you must change the IgorCLCompileRuntimeParams structure as well.
-    cmdTemplate = "IgorCLCompile /PLTM=number:platform /DEV=number:device /DTYP=string:deviceType /DEST=dataFolderAndName:destination /Z[=number:quiet] string:programSource ";
+    cmdTemplate = "IgorCLCompile /PLTM=number:platform /DEV=number:device /DTYP=string:deviceType /DSEL=string:deviceSelector /DEST=dataFolderAndName:destination /Z[=number:quiet] string:programSource ";
     runtimeNumVarList = "V_Flag";
 	runtimeStrVarList = "S_BuildLog";
 	return RegisterOperation(cmdTemplate, runtimeNumVarList, runtimeStrVarList, sizeof(IgorCLCompileRuntimeParams), (void*)ExecuteIgorCLCompile, kOperationIsThreadSafe);
@@ -835,6 +2322,78 @@ static int RegisterIgorCLInfo(void) {
 	return RegisterOperation(cmdTemplate, runtimeNumVarList, runtimeStrVarList, sizeof(IgorCLInfoRuntimeParams), (void*)ExecuteIgorCLInfo, kOperationIsThreadSafe);
 }
 
+static int RegisterIgorCLSettings(void) {
+	const char* cmdTemplate;
+	const char* runtimeNumVarList;
+	const char* runtimeStrVarList;
+    
+	// NOTE: If you change this template, you must change the IgorCLSettingsRuntimeParams structure as well.
+	cmdTemplate = "IgorCLSettings /TLQ=number:useThreadLocalQueues /QMAX=number:maxQueuesPerDevice /SUBT=number:useSubmissionThread /SHCX=number:useSharedContexts /FISS={number:platform, number:device, string:partitionSpecification} /FTHR=number:routeThreadsToPartitions /NUMA=number:firstTouchOnDevice /CALF=string:calibrationFilePath";
+	runtimeNumVarList = "V_ThreadLocalQueues;V_MaxQueuesPerDevice;V_SubmissionThread;V_SharedContexts;V_ThreadPartitions;V_NUMAFirstTouch;V_FirstSubDevice;V_NumSubDevices;";
+	runtimeStrVarList = "";
+	return RegisterOperation(cmdTemplate, runtimeNumVarList, runtimeStrVarList, sizeof(IgorCLSettingsRuntimeParams), (void*)ExecuteIgorCLSettings, kOperationIsThreadSafe);
+}
+
+static int RegisterIgorCLBuffer(void) {
+	const char* cmdTemplate;
+	const char* runtimeNumVarList;
+	const char* runtimeStrVarList;
+    
+	// NOTE: If you change this template, you must change the IgorCLBufferRuntimeParams structure as well.
+	cmdTemplate = "IgorCLBuffer /PLTM=number:platform /DEV=number:device /DTYP=string:deviceType /DSEL=string:deviceSelector /NEW=wave:sourceWave /READ={number:bufferID, wave:destinationWave} /MIGR=number:bufferID /COPY=number:bufferID /FREE=number:bufferID /Z[=number:quiet]";
+	runtimeNumVarList = "V_Flag;V_Value;";
+	runtimeStrVarList = "";
+	return RegisterOperation(cmdTemplate, runtimeNumVarList, runtimeStrVarList, sizeof(IgorCLBufferRuntimeParams), (void*)ExecuteIgorCLBuffer, kOperationIsThreadSafe);
+}
+
+static int RegisterIgorCLBench(void) {
+	const char* cmdTemplate;
+	const char* runtimeNumVarList;
+	const char* runtimeStrVarList;
+    
+	// NOTE: If you change this template, you must change the IgorCLBenchRuntimeParams structure as well.
+	cmdTemplate = "IgorCLBench /PLTM=number:platform /DEV=number:device /DTYP=string:deviceType /DSEL=string:deviceSelector /SIZE=wave:transferSizes /REPS=number:repeats /FILE=string:calibrationFilePath /Z[=number:quiet]";
+	runtimeNumVarList = "V_Flag;";
+	runtimeStrVarList = "";
+	return RegisterOperation(cmdTemplate, runtimeNumVarList, runtimeStrVarList, sizeof(IgorCLBenchRuntimeParams), (void*)ExecuteIgorCLBench, kOperationIsThreadSafe);
+}
+
+static int RegisterIgorCLStats(void) {
+	const char* cmdTemplate;
+	const char* runtimeNumVarList;
+	const char* runtimeStrVarList;
+    
+	// NOTE: If you change this template, you must change the IgorCLStatsRuntimeParams structure as well.
+	cmdTemplate = "IgorCLStats /RSET";
+	runtimeNumVarList = "";
+	runtimeStrVarList = "";
+	return RegisterOperation(cmdTemplate, runtimeNumVarList, runtimeStrVarList, sizeof(IgorCLStatsRuntimeParams), (void*)ExecuteIgorCLStats, kOperationIsThreadSafe);
+}
+
+static int RegisterIgorCLKernelInfo(void) {
+	const char* cmdTemplate;
+	const char* runtimeNumVarList;
+	const char* runtimeStrVarList;
+    
+	// NOTE: If you change this template, you must change the IgorCLKernelInfoRuntimeParams structure as well.
+	cmdTemplate = "IgorCLKernelInfo /PLTM=number:platform /DEV=number:device /DTYP=string:deviceType /DSEL=string:deviceSelector /SRCT=string:sourceText /SRCB=wave:sourceBinary /KERN=string:kernelName /TMPL /Z[=number:quiet]";
+	runtimeNumVarList = "V_Flag;";
+	runtimeStrVarList = "";
+	return RegisterOperation(cmdTemplate, runtimeNumVarList, runtimeStrVarList, sizeof(IgorCLKernelInfoRuntimeParams), (void*)ExecuteIgorCLKernelInfo, kOperationIsThreadSafe);
+}
+
+static int RegisterIgorCLSession(void) {
+	const char* cmdTemplate;
+	const char* runtimeNumVarList;
+	const char* runtimeStrVarList;
+	
+	// NOTE: If you change this template, you must change the IgorCLSessionRuntimeParams structure as well.
+	cmdTemplate = "IgorCLSession /PLTM=number:platform /DEV=number:device /DTYP=string:deviceType /DSEL=string:deviceSelector /SRCT=string:sourceText /SRCB=wave:sourceBinary /KERN=string:kernelName /TMPL /GSZE={number:globalSize0, number:globalSize1, number:globalSize2} /WGRP={number:wgSize0, number:wgSize1, number:wgSize2} /MFLG=wave:memoryFlagsWave /FILV=wave:fillValuesWave /DYN=wave:dynamicFlagsWave /WAVES=wave:argumentWaves /SCLR={wave:scalarValues, wave:scalarTypes, wave:scalarIndices} /NEW /RUN=number:sessionID /FREE=number:sessionID /Z[=number:quiet] [wave[12]:dataWaves]";
+	runtimeNumVarList = "V_Flag;V_Value;";
+	runtimeStrVarList = "";
+	return RegisterOperation(cmdTemplate, runtimeNumVarList, runtimeStrVarList, sizeof(IgorCLSessionRuntimeParams), (void*)ExecuteIgorCLSession, kOperationIsThreadSafe);
+}
+
 static int
 RegisterOperations(void) {
 	int result;
@@ -846,6 +2405,18 @@ RegisterOperations(void) {
         return result;
     if (result = RegisterIgorCLInfo())
         return result;
+    if (result = RegisterIgorCLSettings())
+        return result;
+    if (result = RegisterIgorCLBuffer())
+        return result;
+    if (result = RegisterIgorCLBench())
+        return result;
+    if (result = RegisterIgorCLStats())
+        return result;
+    if (result = RegisterIgorCLKernelInfo())
+        return result;
+    if (result = RegisterIgorCLSession())
+        return result;
 	
 	// There are no more operations added by this XOP.
 		
@@ -864,7 +2435,14 @@ XOPEntry(void)
 	
 	switch (GetXOPMessage()) {
 		case CLEANUP:
+            submissionThreads.stopAll();
+            sessions.clear();
             commandQueueFactory.deleteAllCommandQueues();
+            programCache.clear();
+            templateCache.clear();
+            costModel.clear();
+            residentBuffers.clear();
+            stagingPool.clear();
             break;
 	}
 	SetXOPResult(result);
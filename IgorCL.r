@@ -42,6 +42,24 @@ resource 'XOPC' (1100) {
         
         "IGORCLInfo",                                   // Name of operation.
 		waveOP+XOPOp+compilableOp+threadSafeOp,			// Operation's category.
+        
+        "IgorCLSettings",                               // Name of operation.
+		XOPOp+compilableOp+threadSafeOp,				// Operation's category.
+        
+        "IgorCLBuffer",                                 // Name of operation.
+		waveOP+XOPOp+compilableOp+threadSafeOp,			// Operation's category.
+        
+        "IgorCLBench",                                  // Name of operation.
+		waveOP+XOPOp+compilableOp+threadSafeOp,			// Operation's category.
+        
+        "IgorCLStats",                                  // Name of operation.
+		waveOP+XOPOp+compilableOp+threadSafeOp,			// Operation's category.
+        
+        "IgorCLKernelInfo",                             // Name of operation.
+		waveOP+XOPOp+compilableOp+threadSafeOp,			// Operation's category.
+        
+        "IgorCLSession",                                // Name of operation.
+		waveOP+XOPOp+compilableOp+threadSafeOp,			// Operation's category.
 	}
 };
 
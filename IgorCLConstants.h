@@ -29,6 +29,10 @@ const int IgorCLUseHostPointer = 1 << 3;
 const int IgorCLIsLocalMemory = 1 << 4;
 const int IgorCLIsScalarArgument = 1 << 5;
 const int IgorCLUsePinnedMemory = 1 << 6;
+const int IgorCLTransferAsSingle = 1 << 7;  // NT_FP64 wave is stored as float on the device
+const int IgorCLTransferAsHalf = 1 << 8;    // NT_FP32 or NT_FP64 wave is stored as half on the device
+const int IgorCLFillOnDevice = 1 << 9;      // initialize the buffer with a constant on the device instead of uploading the wave
+const int IgorCLIsResidentBuffer = 1 << 10; // the wave holds the ID of a buffer created with IgorCLBuffer
 
 class IgorCLError {
 public:
@@ -22,26 +22,89 @@ this program with Igor Pro, developed by WaveMetrics Inc. (www.wavemetrics.com).
 #include "IgorCLOperations.h"
 
 #include <fstream>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <cctype>
+#include <limits>
 
 #include "IgorCLUtilities.h"
 #include "IgorCLConstants.h"
 
-void DoOpenCLCalculation(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::string* sourceText, const std::vector<char>* sourceBinary);
+static double SecondsSince(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void DoOpenCLCalculation(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::vector<double>& fillValues, const std::vector<IgorCLScalarArgument>& scalarArgs, const std::string* sourceText, const std::vector<char>* sourceBinary, bool* wavesMayHaveChanged);
+
+static void CheckStatus(const cl_int status) {
+    if (status != CL_SUCCESS)
+        throw IgorCLError(status);
+}
+
+// the transfers of a wave argument that need more than a single read or write, shared by DoOpenCLCalculation and IgorCLSession
+static void EnqueueFillOnDevice(cl::CommandQueue& commandQueue, const cl::Buffer& buffer, waveHndl wave, const int memFlags, const double fillValue, const size_t nBytes) {
+    std::vector<char> pattern = FillPatternForWave(wave, memFlags, fillValue);
+    CheckStatus(::clEnqueueFillBuffer(commandQueue(), buffer(), &pattern[0], pattern.size(), 0, nBytes, 0, NULL, NULL));
+}
+
+// the wave data is copied, or converted, into pinned memory, which is then written to the device
+static void EnqueueStagedUpload(cl::CommandQueue& commandQueue, const cl::Buffer& buffer, const cl::Buffer& stagingBuffer, waveHndl wave, const int memFlags, const size_t nBytes) {
+    cl_int status;
+    void* mappedBuffer = commandQueue.enqueueMapBuffer(stagingBuffer, true, CL_MAP_WRITE, 0, nBytes, NULL, NULL, &status);
+    CheckStatus(status);
+    if (RequiresTransferConversion(memFlags)) {
+        ConvertWaveDataForTransfer(wave, memFlags, mappedBuffer);
+    } else {
+        memcpy(mappedBuffer, WaveData(wave), nBytes);
+    }
+    CheckStatus(commandQueue.enqueueWriteBuffer(buffer, false, 0, nBytes, mappedBuffer));
+    CheckStatus(commandQueue.enqueueUnmapMemObject(stagingBuffer, mappedBuffer));
+}
+
+// the device data is read into pinned memory with a blocking read, and copied, or converted, into the wave right away
+static void EnqueueStagedDownload(cl::CommandQueue& commandQueue, const cl::Buffer& buffer, const cl::Buffer& stagingBuffer, waveHndl wave, const int memFlags, const size_t nBytes) {
+    cl_int status;
+    void* mappedBuffer = commandQueue.enqueueMapBuffer(stagingBuffer, true, CL_MAP_READ | CL_MAP_WRITE, 0, nBytes, NULL, NULL, &status);
+    CheckStatus(status);
+    CheckStatus(commandQueue.enqueueReadBuffer(buffer, true, 0, nBytes, mappedBuffer));
+    if (RequiresTransferConversion(memFlags)) {
+        ConvertTransferredDataToWave(mappedBuffer, memFlags, wave);
+    } else {
+        memcpy(WaveData(wave), mappedBuffer, nBytes);
+    }
+    CheckStatus(commandQueue.enqueueUnmapMemObject(stagingBuffer, mappedBuffer));
+}
 
-void DoOpenCLCalculation(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::string& sourceText) {
-    DoOpenCLCalculation(platformIndex, deviceIndex, globalRange, workgroupSize, kernelName, waves, memFlags, &sourceText, NULL);
+void DoOpenCLCalculation(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::vector<double>& fillValues, const std::vector<IgorCLScalarArgument>& scalarArgs, const std::string& sourceText, bool* wavesMayHaveChanged) {
+    DoOpenCLCalculation(platformIndex, deviceIndex, globalRange, workgroupSize, kernelName, waves, memFlags, fillValues, scalarArgs, &sourceText, NULL, wavesMayHaveChanged);
 }
 
-void DoOpenCLCalculation(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::vector<char>& sourceBinary) {
-    DoOpenCLCalculation(platformIndex, deviceIndex, globalRange, workgroupSize, kernelName, waves, memFlags, NULL, &sourceBinary);
+void DoOpenCLCalculation(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::vector<double>& fillValues, const std::vector<IgorCLScalarArgument>& scalarArgs, const std::vector<char>& sourceBinary, bool* wavesMayHaveChanged) {
+    DoOpenCLCalculation(platformIndex, deviceIndex, globalRange, workgroupSize, kernelName, waves, memFlags, fillValues, scalarArgs, NULL, &sourceBinary, wavesMayHaveChanged);
 }
 
-void DoOpenCLCalculation(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::string* sourceText, const std::vector<char>* sourceBinary) {
+void DoOpenCLCalculation(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::vector<double>& fillValues, const std::vector<IgorCLScalarArgument>& scalarArgs, const std::string* sourceText, const std::vector<char>* sourceBinary, bool* wavesMayHaveChanged) {
+    IgorCLContextModeLease contextModeLease;
     
     size_t nWaves = waves.size();
+    statisticsCounters.increment(IgorCLCounterCalculations);
+    std::chrono::steady_clock::time_point phaseStart = std::chrono::steady_clock::now();
+    
+    // convert IgorCL memflags to underlying OpenCL flags
+    std::vector<int> openCLMemFlags;
+    for (int i = 0; i < memFlags.size(); i+=1) {
+        int clFlags = ConvertIgorCLFlagsToOpenCLFlags(memFlags.at(i));
+        openCLMemFlags.push_back(clFlags);
+    }
     
     // vectors that will hold a pointer to the data and the size of the data
+    // arguments that are stored as a different type on the device are staged in conversionBuffers.
     std::vector<void*> dataPointers; std::vector<size_t> dataSizes;
+    std::vector<std::vector<char> > conversionBuffers(nWaves);
+    std::vector<cl::Buffer> residentBufferHandles(nWaves);
     dataPointers.reserve(nWaves); dataSizes.reserve(nWaves);
     for (size_t i = 0; i < nWaves; i+=1) {
         // special case: if we're using __shared memory then the corresponding wave must
@@ -49,166 +112,216 @@ void DoOpenCLCalculation(const int platformIndex, const int deviceIndex, const c
         if ((memFlags.size() > i) && (memFlags.at(i) & IgorCLIsLocalMemory)) {
             dataPointers.push_back(NULL);
             dataSizes.push_back(SharedMemorySizeFromWave(waves.at(i)));
+        } else if ((memFlags.size() > i) && (memFlags.at(i) & IgorCLIsResidentBuffer)) {
+            // the wave holds the ID of a buffer that is already on the device (moved there if it lives elsewhere)
+            IgorCLResidentBuffer residentBuffer = residentBuffers.getBufferOnDevice(ResidentBufferIDFromWave(waves.at(i)), platformIndex, deviceIndex);
+            residentBufferHandles.at(i) = residentBuffer.buffer;
+            dataPointers.push_back(NULL);
+            dataSizes.push_back(residentBuffer.sizeInBytes);
+        } else if ((memFlags.size() > i) && RequiresTransferConversion(memFlags.at(i))) {
+            dataSizes.push_back(TransferDataSizeInBytes(waves.at(i), memFlags.at(i)));
+            conversionBuffers.at(i).resize(dataSizes.at(i));
+            dataPointers.push_back(reinterpret_cast<void*>(&conversionBuffers.at(i)[0]));
+            // the pinned path converts directly into mapped memory, write-only memory needs no input
+            bool isUploadedFromHost = !(memFlags.at(i) & (IgorCLUsePinnedMemory | IgorCLFillOnDevice)) && !(openCLMemFlags.at(i) & CL_MEM_WRITE_ONLY);
+            if ((memFlags.at(i) & IgorCLIsScalarArgument) || isUploadedFromHost)
+                ConvertWaveDataForTransfer(waves.at(i), memFlags.at(i), dataPointers.at(i));
         } else {
             dataPointers.push_back(reinterpret_cast<void*>(WaveData(waves.at(i))));
             dataSizes.push_back(WaveDataSizeInBytes(waves.at(i)));
         }
     }
     
-    // convert IgorCL memflags to underlying OpenCL flags
-    std::vector<int> openCLMemFlags;
-    for (int i = 0; i < memFlags.size(); i+=1) {
-        int clFlags = ConvertIgorCLFlagsToOpenCLFlags(memFlags.at(i));
-        openCLMemFlags.push_back(clFlags);
-    }
+    statisticsCounters.addPhaseTime(IgorCLPhasePrepare, SecondsSince(phaseStart));
+    phaseStart = std::chrono::steady_clock::now();
     
     // obtain the appropriate context and device.
     cl::Context context;
     cl::Device device;
     contextAndDeviceProvider.getContextForPlatformAndDevice(platformIndex, deviceIndex, context, device);
-    std::vector<cl::Device> deviceAsVector(1, device);
     
-    // fetch a queue on the platform/device combination
-    IgorCLCommandQueueProvider commandQueueProvider(platformIndex, deviceIndex);
-    cl::CommandQueue commandQueue = commandQueueProvider.getCommandQueue();
-    
-    // get the program, either using text or using source
+    // get the program. Built programs are cached, and concurrent requests for the same program share a single build.
     cl_int status;
-    cl::Program program;
-    if (sourceText != NULL) {
-        // use text source
-        program = cl::Program(context, *sourceText, false, &status);
-    } else {
-        // use binary
-        const void* programPointer = &(sourceBinary->at(0));
-        size_t programSize = sourceBinary->size();
-        std::pair<const void*, size_t> sourcePair(programPointer, programSize);
-        std::vector<std::pair<const void*, size_t> > binaryAsVector;
-        binaryAsVector.push_back(sourcePair);
-        program = cl::Program(context, deviceAsVector, binaryAsVector, NULL, &status);
-    }
-    if (status != CL_SUCCESS)
-        throw IgorCLError(status);
-    
-    // build the program
-    status = program.build();
-    if (status != CL_SUCCESS) {
-        std::string buildLog = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
-        for (int i = 0; i < buildLog.size(); ++i) {
-            if (buildLog[i] == '\n')
-                buildLog[i] = '\r';
-        }
-        XOPNotice(buildLog.c_str());
-        throw IgorCLError(status);
-    }
+    cl::Program program = programCache.getProgram(platformIndex, deviceIndex, sourceText, sourceBinary);
     
     // fetch the kernel
     cl::Kernel kernel(program, kernelName.c_str(), &status);
     if (status != CL_SUCCESS)
         throw IgorCLError(status);
     
-    // create buffers for all of the input data
+    statisticsCounters.addPhaseTime(IgorCLPhaseBuild, SecondsSince(phaseStart));
+    phaseStart = std::chrono::steady_clock::now();
+    
+    // everything that is submitted to the command queue. The buffers are owned by this function
+    // so that they stay alive until the queue has finished. Staging buffers go back to the pool after that.
     std::vector<cl::Buffer> buffers;
-    buffers.reserve(nWaves);
-    for (size_t i = 0; i < nWaves; i+=1) {
-        if ((memFlags.size() > i) && (memFlags.at(i) & (IgorCLIsLocalMemory | IgorCLIsScalarArgument))) {
-            buffers.push_back(cl::Buffer());
-            continue;
-        }
+    std::vector<cl::Buffer> stagingBuffers;
+    double directBytes = 0, stagedBytes = 0, zeroCopyBytes = 0, firstTouchedBytes = 0;
+    double uploadedBytes = 0, downloadedBytes = 0;
+    std::function<void(cl::CommandQueue&)> enqueueCalculation = [&](cl::CommandQueue& commandQueue) {
+        cl_int status;
+        bool wasFirstTouched;
         
-        int flags = 0;
-        void* hostPointer = NULL;
-        if (openCLMemFlags.size() > i)
-            flags = openCLMemFlags.at(i);
-        if (flags & CL_MEM_USE_HOST_PTR)
-            hostPointer = dataPointers.at(i);
-        cl::Buffer buffer(context, flags, dataSizes.at(i), hostPointer, &status);
-        if (status != CL_SUCCESS)
-            throw IgorCLError(status);
-        buffers.push_back(buffer);
-    }
-    
-    // and copy all of the data to the device, unless we want to use the host memory, we're using shared memory, this is a scalar argument,
-    // or this memory is write-only.
-    for (size_t i = 0; i < nWaves; i+=1) {
-        if ((memFlags.size() > i) && (memFlags.at(i) & (IgorCLIsLocalMemory | IgorCLIsScalarArgument)))
-            continue;
-        if ((openCLMemFlags.size() > i) && (openCLMemFlags.at(i) & (CL_MEM_USE_HOST_PTR | CL_MEM_WRITE_ONLY)))
-            continue;
-        if ((memFlags.size() > i) && (memFlags.at(i) & IgorCLUsePinnedMemory)) {
-            cl::Buffer pinnedBuffer(context, CL_MEM_ALLOC_HOST_PTR, dataSizes.at(i), NULL, &status);
+        // create buffers for all of the input data
+        buffers.reserve(nWaves);
+        for (size_t i = 0; i < nWaves; i+=1) {
+            if ((memFlags.size() > i) && (memFlags.at(i) & (IgorCLIsLocalMemory | IgorCLIsScalarArgument))) {
+                buffers.push_back(cl::Buffer());
+                continue;
+            }
+            if ((memFlags.size() > i) && (memFlags.at(i) & IgorCLIsResidentBuffer)) {
+                buffers.push_back(residentBufferHandles.at(i));
+                continue;
+            }
+        
+            int flags = 0;
+            void* hostPointer = NULL;
+            if (openCLMemFlags.size() > i)
+                flags = openCLMemFlags.at(i);
+            if (flags & CL_MEM_USE_HOST_PTR)
+                hostPointer = dataPointers.at(i);
+            cl::Buffer buffer(context, flags, dataSizes.at(i), hostPointer, &status);
             if (status != CL_SUCCESS)
                 throw IgorCLError(status);
-            void* mappedBuffer = commandQueue.enqueueMapBuffer(pinnedBuffer, true, CL_MAP_WRITE, 0, dataSizes.at(i), NULL, NULL, &status);
+            statisticsCounters.increment(IgorCLCounterBuffersAllocated);
+            buffers.push_back(buffer);
+            // per-call buffers are not first touched, since they are released at the end of the call.
+            if (hostPointer != NULL)
+                zeroCopyBytes += dataSizes.at(i);
+        }
+        
+        // and copy all of the data to the device, unless we want to use the host memory, we're using shared memory, this is a scalar argument or resident buffer,
+        // or this memory is write-only. Buffers that are filled on the device do not need the wave data.
+        for (size_t i = 0; i < nWaves; i+=1) {
+            if ((memFlags.size() > i) && (memFlags.at(i) & (IgorCLIsLocalMemory | IgorCLIsScalarArgument | IgorCLIsResidentBuffer)))
+                continue;
+            if ((memFlags.size() > i) && (memFlags.at(i) & IgorCLFillOnDevice)) {
+                double fillValue = (fillValues.size() > i) ? fillValues.at(i) : 0.0;
+                EnqueueFillOnDevice(commandQueue, buffers.at(i), waves.at(i), memFlags.at(i), fillValue, dataSizes.at(i));
+                continue;
+            }
+            if ((openCLMemFlags.size() > i) && (openCLMemFlags.at(i) & (CL_MEM_USE_HOST_PTR | CL_MEM_WRITE_ONLY)))
+                continue;
+            if ((memFlags.size() > i) && (memFlags.at(i) & IgorCLUsePinnedMemory)) {
+                cl::Buffer pinnedBuffer = stagingPool.acquireBuffer(platformIndex, deviceIndex, context, commandQueue, dataSizes.at(i), wasFirstTouched);
+                stagingBuffers.push_back(pinnedBuffer);
+                if (wasFirstTouched)
+                    firstTouchedBytes += dataSizes.at(i);
+                stagedBytes += dataSizes.at(i);
+                EnqueueStagedUpload(commandQueue, buffers.at(i), pinnedBuffer, waves.at(i), memFlags.at(i), dataSizes.at(i));
+                uploadedBytes += dataSizes.at(i);
+                continue;
+            }
+            status = commandQueue.enqueueWriteBuffer(buffers.at(i), false, 0, dataSizes.at(i), dataPointers.at(i));
             if (status != CL_SUCCESS)
                 throw IgorCLError(status);
-            memcpy(mappedBuffer, static_cast<void*>(dataPointers.at(i)), dataSizes.at(i));
-            status = commandQueue.enqueueWriteBuffer(buffers.at(i), false, 0, dataSizes.at(i), mappedBuffer);
+            directBytes += dataSizes.at(i);
+            uploadedBytes += dataSizes.at(i);
+        }
+        
+        // set arguments for the kernel
+        std::vector<cl_uint> waveArgumentIndices = KernelArgumentIndicesForWaves(nWaves, scalarArgs);
+        for (size_t i = 0; i < nWaves; i+=1) {
+            cl_uint argumentIndex = waveArgumentIndices.at(i);
+            if ((memFlags.size() > i) && (memFlags.at(i) & IgorCLIsLocalMemory)) {
+                status = kernel.setArg(argumentIndex, dataSizes.at(i), NULL);
+            } else if ((memFlags.size() > i) && (memFlags.at(i) & IgorCLIsScalarArgument)) {
+                status = kernel.setArg(argumentIndex, dataSizes.at(i), dataPointers.at(i));
+            } else {
+                status = kernel.setArg(argumentIndex, buffers.at(i));
+            }
             if (status != CL_SUCCESS)
                 throw IgorCLError(status);
-            status = commandQueue.enqueueUnmapMemObject(pinnedBuffer, mappedBuffer);
+        }
+        for (size_t i = 0; i < scalarArgs.size(); i+=1) {
+            const IgorCLScalarArgument& scalarArg = scalarArgs.at(i);
+            status = kernel.setArg(scalarArg.argumentIndex, scalarArg.value.size(), const_cast<char*>(&scalarArg.value[0]));
             if (status != CL_SUCCESS)
                 throw IgorCLError(status);
-            continue;
         }
-        status = commandQueue.enqueueWriteBuffer(buffers.at(i), false, 0, dataSizes.at(i), dataPointers.at(i));
+        
+        // perform the actual calculation
+        status = commandQueue.enqueueNDRangeKernel(kernel, cl::NullRange, globalRange, workgroupSize, NULL, NULL);
         if (status != CL_SUCCESS)
             throw IgorCLError(status);
-    }
+        statisticsCounters.increment(IgorCLCounterKernelLaunches);
+        if (wavesMayHaveChanged != NULL)
+            *wavesMayHaveChanged = true;
+        
+        // copy arguments back into the waves, unless we have used host memory, used shared memory, this is a scalar argument or resident buffer,
+        // or this memory is read-only.
+        for (size_t i = 0; i < nWaves; i+=1) {
+            if ((memFlags.size() > i) && (memFlags.at(i) & (IgorCLIsLocalMemory | IgorCLIsScalarArgument | IgorCLIsResidentBuffer)))
+                continue;
+            if ((openCLMemFlags.size() > i) && (openCLMemFlags.at(i) & (CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY)))
+                continue;
+            if ((memFlags.size() > i) && (memFlags.at(i) & IgorCLUsePinnedMemory)) {
+                cl::Buffer pinnedBuffer = stagingPool.acquireBuffer(platformIndex, deviceIndex, context, commandQueue, dataSizes.at(i), wasFirstTouched);
+                stagingBuffers.push_back(pinnedBuffer);
+                if (wasFirstTouched)
+                    firstTouchedBytes += dataSizes.at(i);
+                stagedBytes += dataSizes.at(i);
+                EnqueueStagedDownload(commandQueue, buffers.at(i), pinnedBuffer, waves.at(i), memFlags.at(i), dataSizes.at(i));
+                downloadedBytes += dataSizes.at(i);
+                continue;
+            }
+            status = commandQueue.enqueueReadBuffer(buffers.at(i), false, 0, dataSizes.at(i), dataPointers.at(i));
+            if (status != CL_SUCCESS)
+                throw IgorCLError(status);
+            directBytes += dataSizes.at(i);
+            downloadedBytes += dataSizes.at(i);
+        }
+    };
     
-    // set arguments for the kernel
-    for (size_t i = 0; i < nWaves; i+=1) {
-        if ((memFlags.size() > i) && (memFlags.at(i) & IgorCLIsLocalMemory)) {
-            status = kernel.setArg(i, dataSizes.at(i), NULL);
-        } else if ((memFlags.size() > i) && (memFlags.at(i) & IgorCLIsScalarArgument)) {
-            status = kernel.setArg(i, dataSizes.at(i), dataPointers.at(i));
-        } else {
-            status = kernel.setArg(i, buffers.at(i));
+    if (executionSettings.useSubmissionThread()) {
+        // enqueued and finished by the thread that owns the queue for this device
+        submissionThreads.submit(platformIndex, deviceIndex, enqueueCalculation);
+    } else {
+        // fetch a queue on the platform/device combination
+        IgorCLCommandQueueProvider commandQueueProvider(platformIndex, deviceIndex);
+        cl::CommandQueue commandQueue = commandQueueProvider.getCommandQueue();
+        
+        try {
+            enqueueCalculation(commandQueue);
+        }
+        catch (...) {
+            // work that was already enqueued may still read from or write into conversionBuffers and the waves,
+            // so let it drain before they go away and the queue goes back to the pool
+            commandQueue.finish();
+            throw;
         }
+        
+        // block until everything is finished
+        status = commandQueue.finish();
         if (status != CL_SUCCESS)
             throw IgorCLError(status);
     }
     
-    // perform the actual calculation
-    status = commandQueue.enqueueNDRangeKernel(kernel, cl::NullRange, globalRange, workgroupSize, NULL, NULL);
-    if (status != CL_SUCCESS)
-        throw IgorCLError(status);
+    // the queue has finished, so the staging buffers can be reused
+    for (size_t i = 0; i < stagingBuffers.size(); i+=1) {
+        stagingPool.releaseBuffer(platformIndex, deviceIndex, context, stagingBuffers.at(i));
+    }
+    transferStatistics.recordTransfers(platformIndex, deviceIndex, device, directBytes, stagedBytes, zeroCopyBytes, firstTouchedBytes);
+    statisticsCounters.addTransferredBytes(platformIndex, deviceIndex, uploadedBytes, downloadedBytes);
+    statisticsCounters.addPhaseTime(IgorCLPhaseExecute, SecondsSince(phaseStart));
+    phaseStart = std::chrono::steady_clock::now();
     
-    // copy arguments back into the waves, unless we have used host memory, used shared memory, this is a scalar argument,
-    // or this memory is read-only.
+    // convert staged results back to the wave type
     for (size_t i = 0; i < nWaves; i+=1) {
-        if ((memFlags.size() > i) && (memFlags.at(i) & (IgorCLIsLocalMemory | IgorCLIsScalarArgument)))
+        if ((memFlags.size() <= i) || !RequiresTransferConversion(memFlags.at(i)))
             continue;
-        if ((openCLMemFlags.size() > i) && (openCLMemFlags.at(i) & (CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY)))
+        if (memFlags.at(i) & (IgorCLIsScalarArgument | IgorCLUsePinnedMemory))
             continue;
-        if ((memFlags.size() > i) && (memFlags.at(i) & IgorCLUsePinnedMemory)) {
-            cl::Buffer pinnedBuffer(context, CL_MEM_ALLOC_HOST_PTR, dataSizes.at(i), NULL, &status);
-            if (status != CL_SUCCESS)
-                throw IgorCLError(status);
-            void* mappedBuffer = commandQueue.enqueueMapBuffer(pinnedBuffer, true, CL_MAP_WRITE, 0, dataSizes.at(i), NULL, NULL, &status);
-            if (status != CL_SUCCESS)
-                throw IgorCLError(status);
-            status = commandQueue.enqueueReadBuffer(buffers.at(i), true, 0, dataSizes.at(i), mappedBuffer);
-            if (status != CL_SUCCESS)
-                throw IgorCLError(status);
-            memcpy(static_cast<void*>(dataPointers.at(i)), mappedBuffer, dataSizes.at(i));
-            status = commandQueue.enqueueUnmapMemObject(pinnedBuffer, mappedBuffer);
-            if (status != CL_SUCCESS)
-                throw IgorCLError(status);
+        if (openCLMemFlags.at(i) & CL_MEM_READ_ONLY)
             continue;
-        }
-        status = commandQueue.enqueueReadBuffer(buffers.at(i), false, 0, dataSizes.at(i), dataPointers.at(i));
-        if (status != CL_SUCCESS)
-            throw IgorCLError(status);
+        ConvertTransferredDataToWave(dataPointers.at(i), memFlags.at(i), waves.at(i));
     }
-    
-    // block until everything is finished
-    status = commandQueue.finish();
-    if (status != CL_SUCCESS)
-        throw IgorCLError(status);
+    statisticsCounters.addPhaseTime(IgorCLPhaseConvert, SecondsSince(phaseStart));
 }
 
 std::vector<char> CompileSource(const int platformIndex, const int deviceIndex, const std::string programSource, std::string& buildLog) {
+    IgorCLContextModeLease contextModeLease;
+    
     // obtain the appropriate context and device.
     cl::Context context;
     cl::Device device;
@@ -220,9 +333,11 @@ std::vector<char> CompileSource(const int platformIndex, const int deviceIndex,
     if (status != CL_SUCCESS)
         throw IgorCLError(status);
     
-    // build the program
+    // build the program, only for the requested device since the context may contain others
     buildLog.clear();
-    status = program.build();
+    std::vector<cl::Device> deviceAsVector(1, device);
+    statisticsCounters.increment(IgorCLCounterCompiles);
+    status = program.build(deviceAsVector);
     buildLog = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
     for (int i = 0; i < buildLog.size(); ++i) {
         if (buildLog[i] == '\n')
@@ -237,9 +352,781 @@ std::vector<char> CompileSource(const int platformIndex, const int deviceIndex,
     programBinary = program.getInfo<CL_PROGRAM_BINARIES>();
     programBinarySizes = program.getInfo<CL_PROGRAM_BINARY_SIZES>();
     
+    // the binaries are in the order of the devices in the context
+    std::vector<cl::Device> programDevices = program.getInfo<CL_PROGRAM_DEVICES>();
+    size_t binaryIndex = 0;
+    for (size_t i = 0; i < programDevices.size(); ++i) {
+        if (programDevices[i]() == device()) {
+            binaryIndex = i;
+            break;
+        }
+    }
+    
     std::vector<char> compiledBinary;
-    compiledBinary.resize(programBinarySizes.at(0));
-    memcpy(reinterpret_cast<void*>(&compiledBinary.at(0)), reinterpret_cast<void*>(programBinary.at(0)), programBinarySizes.at(0));
+    compiledBinary.resize(programBinarySizes.at(binaryIndex));
+    memcpy(reinterpret_cast<void*>(&compiledBinary.at(0)), reinterpret_cast<void*>(programBinary.at(binaryIndex)), programBinarySizes.at(binaryIndex));
     
     return compiledBinary;
 }
+
+IgorCLBenchmarkResult BenchmarkDevice(const int platformIndex, const int deviceIndex, const std::vector<size_t>& transferSizes, const int nRepeats, const bool measureCompileTime) {
+    IgorCLContextModeLease contextModeLease;
+    
+    // every build gets a unique source, so that neither our program cache nor a driver cache is hit.
+    // The driver cache may persist on disk, so the source also differs between Igor sessions.
+    static const long long sessionNonce = std::chrono::system_clock::now().time_since_epoch().count();
+    static std::atomic<unsigned long> nBenchmarkBuilds(0);
+    
+    cl::Context context;
+    cl::Device device;
+    contextAndDeviceProvider.getContextForPlatformAndDevice(platformIndex, deviceIndex, context, device);
+    IgorCLCommandQueueProvider commandQueueProvider(platformIndex, deviceIndex);
+    cl::CommandQueue commandQueue = commandQueueProvider.getCommandQueue();
+    std::vector<cl::Device> deviceAsVector(1, device);
+    cl_int status;
+    
+    // all timings are the fastest of nRepeats, after one untimed run
+    IgorCLBenchmarkResult result;
+    result.transferSizes = transferSizes;
+    result.compileTime = (measureCompileTime) ? 1e30 : std::numeric_limits<double>::quiet_NaN();
+    result.launchLatency = 1e30;
+    result.finishLatency = 1e30;
+    
+    cl::Program program;
+    const int nBuilds = (measureCompileTime) ? nRepeats + 1 : 1;
+    for (int i = 0; i < nBuilds; ++i) {
+        std::ostringstream benchmarkSource;
+        benchmarkSource << "// IgorCLBench build " << sessionNonce << " " << nBenchmarkBuilds++ << "\n";
+        benchmarkSource << "__kernel void IgorCLBenchmarkKernel(__global float* data) {size_t i = get_global_id(0); data[i] = 2.0f * data[i] + 1.0f;}\n";
+        benchmarkSource << "__kernel void IgorCLEmptyKernel(void) {}\n";
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        program = cl::Program(context, benchmarkSource.str(), false, &status);
+        CheckStatus(status);
+        CheckStatus(program.build(deviceAsVector));
+        if (i > 0)
+            result.compileTime = std::min(result.compileTime, SecondsSince(start));
+    }
+    
+    cl::Kernel emptyKernel(program, "IgorCLEmptyKernel", &status);
+    CheckStatus(status);
+    for (int i = 0; i <= nRepeats; ++i) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        CheckStatus(commandQueue.enqueueNDRangeKernel(emptyKernel, cl::NullRange, cl::NDRange(1), cl::NullRange));
+        CheckStatus(commandQueue.finish());
+        if (i > 0)
+            result.launchLatency = std::min(result.launchLatency, SecondsSince(start));
+        
+        start = std::chrono::steady_clock::now();
+        CheckStatus(commandQueue.finish());
+        if (i > 0)
+            result.finishLatency = std::min(result.finishLatency, SecondsSince(start));
+    }
+    
+    // the transfers are done in the same way as in DoOpenCLCalculation
+    for (size_t sizeIndex = 0; sizeIndex < transferSizes.size(); ++sizeIndex) {
+        size_t nBytes = transferSizes.at(sizeIndex);
+        std::vector<char> hostData(nBytes, 1);
+        cl::Buffer deviceBuffer(context, CL_MEM_READ_WRITE, nBytes, NULL, &status);
+        CheckStatus(status);
+        cl::Buffer pinnedBuffer(context, CL_MEM_ALLOC_HOST_PTR, nBytes, NULL, &status);
+        CheckStatus(status);
+        
+        double h2dTime[IgorCLNTransferStrategies], d2hTime[IgorCLNTransferStrategies];
+        for (int j = 0; j < IgorCLNTransferStrategies; ++j) {
+            h2dTime[j] = 1e30;
+            d2hTime[j] = 1e30;
+        }
+        for (int i = 0; i <= nRepeats; ++i) {
+            double time;
+            std::chrono::steady_clock::time_point start;
+            
+            // default
+            start = std::chrono::steady_clock::now();
+            CheckStatus(commandQueue.enqueueWriteBuffer(deviceBuffer, true, 0, nBytes, &hostData[0]));
+            time = SecondsSince(start);
+            if (i > 0)
+                h2dTime[IgorCLTransferDefault] = std::min(h2dTime[IgorCLTransferDefault], time);
+            start = std::chrono::steady_clock::now();
+            CheckStatus(commandQueue.enqueueReadBuffer(deviceBuffer, true, 0, nBytes, &hostData[0]));
+            time = SecondsSince(start);
+            if (i > 0)
+                d2hTime[IgorCLTransferDefault] = std::min(d2hTime[IgorCLTransferDefault], time);
+            
+            // pinned, including the copy between wave memory and the staging buffer
+            start = std::chrono::steady_clock::now();
+            void* mappedBuffer = commandQueue.enqueueMapBuffer(pinnedBuffer, true, CL_MAP_WRITE, 0, nBytes, NULL, NULL, &status);
+            CheckStatus(status);
+            memcpy(mappedBuffer, &hostData[0], nBytes);
+            CheckStatus(commandQueue.enqueueWriteBuffer(deviceBuffer, false, 0, nBytes, mappedBuffer));
+            CheckStatus(commandQueue.enqueueUnmapMemObject(pinnedBuffer, mappedBuffer));
+            CheckStatus(commandQueue.finish());
+            time = SecondsSince(start);
+            if (i > 0)
+                h2dTime[IgorCLTransferPinned] = std::min(h2dTime[IgorCLTransferPinned], time);
+            start = std::chrono::steady_clock::now();
+            mappedBuffer = commandQueue.enqueueMapBuffer(pinnedBuffer, true, CL_MAP_WRITE, 0, nBytes, NULL, NULL, &status);
+            CheckStatus(status);
+            CheckStatus(commandQueue.enqueueReadBuffer(deviceBuffer, true, 0, nBytes, mappedBuffer));
+            memcpy(&hostData[0], mappedBuffer, nBytes);
+            CheckStatus(commandQueue.enqueueUnmapMemObject(pinnedBuffer, mappedBuffer));
+            CheckStatus(commandQueue.finish());
+            time = SecondsSince(start);
+            if (i > 0)
+                d2hTime[IgorCLTransferPinned] = std::min(d2hTime[IgorCLTransferPinned], time);
+            
+            // host pointer: the buffer is created on wave memory for every call, and the device accesses it in place.
+            // Migrating the buffer to the device and mapping it back are the equivalent of the transfers.
+            start = std::chrono::steady_clock::now();
+            cl::Buffer hostPointerBuffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, nBytes, &hostData[0], &status);
+            CheckStatus(status);
+            cl_mem memObject = hostPointerBuffer();
+            CheckStatus(::clEnqueueMigrateMemObjects(commandQueue(), 1, &memObject, 0, 0, NULL, NULL));
+            CheckStatus(commandQueue.finish());
+            time = SecondsSince(start);
+            if (i > 0)
+                h2dTime[IgorCLTransferHostPointer] = std::min(h2dTime[IgorCLTransferHostPointer], time);
+            start = std::chrono::steady_clock::now();
+            mappedBuffer = commandQueue.enqueueMapBuffer(hostPointerBuffer, true, CL_MAP_READ, 0, nBytes, NULL, NULL, &status);
+            CheckStatus(status);
+            CheckStatus(commandQueue.enqueueUnmapMemObject(hostPointerBuffer, mappedBuffer));
+            CheckStatus(commandQueue.finish());
+            time = SecondsSince(start);
+            if (i > 0)
+                d2hTime[IgorCLTransferHostPointer] = std::min(d2hTime[IgorCLTransferHostPointer], time);
+        }
+        
+        for (int j = 0; j < IgorCLNTransferStrategies; ++j) {
+            result.h2dBandwidth[j].push_back(nBytes / std::max(h2dTime[j], 1e-9));
+            result.d2hBandwidth[j].push_back(nBytes / std::max(d2hTime[j], 1e-9));
+        }
+    }
+    
+    return result;
+}
+
+static IgorCLKernelInfo GetKernelInfo(const int platformIndex, const int deviceIndex, const std::string& kernelName, const std::string* sourceText, const std::vector<char>* sourceBinary);
+
+IgorCLKernelInfo GetKernelInfo(const int platformIndex, const int deviceIndex, const std::string& kernelName, const std::string& sourceText) {
+    return GetKernelInfo(platformIndex, deviceIndex, kernelName, &sourceText, NULL);
+}
+
+IgorCLKernelInfo GetKernelInfo(const int platformIndex, const int deviceIndex, const std::string& kernelName, const std::vector<char>& sourceBinary) {
+    return GetKernelInfo(platformIndex, deviceIndex, kernelName, NULL, &sourceBinary);
+}
+
+static std::string AddressQualifierToString(const cl_kernel_arg_address_qualifier qualifier) {
+    switch (qualifier) {
+        case CL_KERNEL_ARG_ADDRESS_GLOBAL:
+            return std::string("global");
+        case CL_KERNEL_ARG_ADDRESS_LOCAL:
+            return std::string("local");
+        case CL_KERNEL_ARG_ADDRESS_CONSTANT:
+            return std::string("constant");
+        case CL_KERNEL_ARG_ADDRESS_PRIVATE:
+            return std::string("private");
+        default:
+            return std::string("unknown");
+    }
+}
+
+static std::string AccessQualifierToString(const cl_kernel_arg_access_qualifier qualifier) {
+    switch (qualifier) {
+        case CL_KERNEL_ARG_ACCESS_READ_ONLY:
+            return std::string("read_only");
+        case CL_KERNEL_ARG_ACCESS_WRITE_ONLY:
+            return std::string("write_only");
+        case CL_KERNEL_ARG_ACCESS_READ_WRITE:
+            return std::string("read_write");
+        case CL_KERNEL_ARG_ACCESS_NONE:
+            return std::string("none");
+        default:
+            return std::string("unknown");
+    }
+}
+
+static std::string TypeQualifierToString(const cl_kernel_arg_type_qualifier qualifier) {
+    std::string qualifierStr;
+    if (qualifier & CL_KERNEL_ARG_TYPE_CONST)
+        qualifierStr += "const ";
+    if (qualifier & CL_KERNEL_ARG_TYPE_RESTRICT)
+        qualifierStr += "restrict ";
+    if (qualifier & CL_KERNEL_ARG_TYPE_VOLATILE)
+        qualifierStr += "volatile ";
+    if (qualifierStr.empty())
+        return std::string("none");
+    qualifierStr.erase(qualifierStr.size() - 1);
+    return qualifierStr;
+}
+
+// local memory and scalar arguments need to be flagged, and global or constant memory that the kernel cannot
+// write to does not have to be read back.
+static int DeriveMemoryFlags(const cl_kernel_arg_address_qualifier addressQualifier, const cl_kernel_arg_type_qualifier typeQualifier, const std::string& typeName) {
+    bool isPointer = (typeName.find('*') != std::string::npos);
+    switch (addressQualifier) {
+        case CL_KERNEL_ARG_ADDRESS_LOCAL:
+            return IgorCLIsLocalMemory;
+        case CL_KERNEL_ARG_ADDRESS_CONSTANT:
+            return IgorCLReadOnly;
+        case CL_KERNEL_ARG_ADDRESS_GLOBAL:
+            return (typeQualifier & CL_KERNEL_ARG_TYPE_CONST) ? IgorCLReadOnly : 0;
+        default:
+            return isPointer ? 0 : IgorCLIsScalarArgument;
+    }
+}
+
+// argument metadata is only guaranteed to be kept when the program is compiled with -cl-kernel-arg-info.
+// These options are part of the cache key, so this does not replace the program used by IgorCL.
+static cl::Program GetIntrospectionProgram(const int platformIndex, const int deviceIndex, const std::string* sourceText, const std::vector<char>* sourceBinary) {
+    std::string buildOptions = (sourceText != NULL) ? std::string("-cl-kernel-arg-info") : std::string();
+    return programCache.getProgram(platformIndex, deviceIndex, sourceText, sourceBinary, buildOptions);
+}
+
+static std::vector<std::string> KernelNamesInProgram(cl::Program program) {
+    std::vector<cl::Kernel> kernels;
+    CheckStatus(program.createKernels(&kernels));
+    
+    std::vector<std::string> kernelNames;
+    for (size_t i = 0; i < kernels.size(); ++i) {
+        std::string kernelName;
+        CheckStatus(kernels[i].getInfo(CL_KERNEL_FUNCTION_NAME, &kernelName));
+        kernelNames.push_back(kernelName);
+    }
+    return kernelNames;
+}
+
+static std::vector<std::string> GetKernelNames(const int platformIndex, const int deviceIndex, const std::string* sourceText, const std::vector<char>* sourceBinary) {
+    IgorCLContextModeLease contextModeLease;
+    cl::Program program = GetIntrospectionProgram(platformIndex, deviceIndex, sourceText, sourceBinary);
+    return KernelNamesInProgram(program);
+}
+
+std::vector<std::string> GetKernelNames(const int platformIndex, const int deviceIndex, const std::string& sourceText) {
+    return GetKernelNames(platformIndex, deviceIndex, &sourceText, NULL);
+}
+
+std::vector<std::string> GetKernelNames(const int platformIndex, const int deviceIndex, const std::vector<char>& sourceBinary) {
+    return GetKernelNames(platformIndex, deviceIndex, NULL, &sourceBinary);
+}
+
+static IgorCLKernelInfo KernelInfoInProgram(const cl::Program& program, const cl::Device& device, const std::string& kernelName) {
+    cl_int status;
+    cl::Kernel kernel(program, kernelName.c_str(), &status);
+    CheckStatus(status);
+    
+    IgorCLKernelInfo info;
+    CheckStatus(kernel.getWorkGroupInfo(device, CL_KERNEL_WORK_GROUP_SIZE, &info.workGroupSize));
+    CheckStatus(kernel.getWorkGroupInfo(device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, &info.preferredWorkGroupSizeMultiple));
+    CheckStatus(kernel.getWorkGroupInfo(device, CL_KERNEL_LOCAL_MEM_SIZE, &info.localMemSize));
+    CheckStatus(kernel.getWorkGroupInfo(device, CL_KERNEL_PRIVATE_MEM_SIZE, &info.privateMemSize));
+    
+    cl_uint nArguments;
+    CheckStatus(kernel.getInfo(CL_KERNEL_NUM_ARGS, &nArguments));
+    info.nArguments = nArguments;
+    
+    info.haveArgumentInfo = true;
+    for (cl_uint i = 0; i < nArguments; ++i) {
+        IgorCLKernelArgumentInfo argument;
+        cl_kernel_arg_address_qualifier addressQualifier;
+        cl_kernel_arg_access_qualifier accessQualifier;
+        cl_kernel_arg_type_qualifier typeQualifier;
+        status = kernel.getArgInfo(i, CL_KERNEL_ARG_NAME, &argument.name);
+        if (status == CL_KERNEL_ARG_INFO_NOT_AVAILABLE) {
+            info.haveArgumentInfo = false;
+            info.arguments.clear();
+            break;
+        }
+        CheckStatus(status);
+        CheckStatus(kernel.getArgInfo(i, CL_KERNEL_ARG_TYPE_NAME, &argument.typeName));
+        CheckStatus(kernel.getArgInfo(i, CL_KERNEL_ARG_ADDRESS_QUALIFIER, &addressQualifier));
+        CheckStatus(kernel.getArgInfo(i, CL_KERNEL_ARG_ACCESS_QUALIFIER, &accessQualifier));
+        CheckStatus(kernel.getArgInfo(i, CL_KERNEL_ARG_TYPE_QUALIFIER, &typeQualifier));
+        argument.addressQualifier = AddressQualifierToString(addressQualifier);
+        argument.accessQualifier = AccessQualifierToString(accessQualifier);
+        argument.typeQualifier = TypeQualifierToString(typeQualifier);
+        argument.memFlags = DeriveMemoryFlags(addressQualifier, typeQualifier, argument.typeName);
+        info.arguments.push_back(argument);
+    }
+    
+    return info;
+}
+
+static IgorCLKernelInfo GetKernelInfo(const int platformIndex, const int deviceIndex, const std::string& kernelName, const std::string* sourceText, const std::vector<char>* sourceBinary) {
+    IgorCLContextModeLease contextModeLease;
+    cl::Context context;
+    cl::Device device;
+    contextAndDeviceProvider.getContextForPlatformAndDevice(platformIndex, deviceIndex, context, device);
+    
+    cl::Program program = GetIntrospectionProgram(platformIndex, deviceIndex, sourceText, sourceBinary);
+    return KernelInfoInProgram(program, device, kernelName);
+}
+
+// the OpenCL type of a wave on the device
+static std::string DeviceTypeNameForWave(waveHndl wave, const int memFlags) {
+    if (memFlags & IgorCLIsResidentBuffer)
+        throw std::runtime_error("Type wildcards cannot be used with resident buffers, their type is not known");
+    if (memFlags & IgorCLTransferAsSingle)
+        return std::string("float");
+    if (memFlags & IgorCLTransferAsHalf)
+        return std::string("half");
+    
+    // complex waves are not supported
+    int waveType = WaveType(wave);
+    std::string typeName = (waveType & NT_UNSIGNED) ? std::string("unsigned ") : std::string();
+    switch (waveType & ~NT_UNSIGNED) {
+        case NT_FP32:
+            return std::string("float");
+        case NT_FP64:
+            return std::string("double");
+        case NT_I8:
+            return typeName + "char";
+        case NT_I16:
+            return typeName + "short";
+        case NT_I32:
+            return typeName + "int";
+#ifdef NT_I64
+        case NT_I64:
+            return typeName + "long";
+#endif
+        default:
+            throw int(NT_INCOMPATIBLE);
+    }
+}
+
+std::vector<std::string> IgorCLTemplateCache::_findWildcards(const std::string& templateSource) {
+    const std::string wildcardPrefix("ICLT_");
+    std::vector<std::string> wildcards;
+    size_t index = 0;
+    while ((index = templateSource.find(wildcardPrefix, index)) != std::string::npos) {
+        size_t start = index;
+        index += wildcardPrefix.size();
+        if ((start > 0) && (std::isalnum(templateSource[start - 1]) || (templateSource[start - 1] == '_')))
+            continue;
+        size_t end = index;
+        while ((end < templateSource.size()) && std::isdigit(templateSource[end])) {
+            ++end;
+        }
+        if (end == index)
+            continue;
+        std::string wildcard = templateSource.substr(start, end - start);
+        if (std::find(wildcards.begin(), wildcards.end(), wildcard) == wildcards.end())
+            wildcards.push_back(wildcard);
+        index = end;
+    }
+    return wildcards;
+}
+
+int IgorCLTemplateCache::_wildcardIndexForArgumentType(const std::vector<std::string>& wildcards, std::string typeName) {
+    typeName.erase(std::remove(typeName.begin(), typeName.end(), '*'), typeName.end());
+    typeName.erase(std::remove(typeName.begin(), typeName.end(), ' '), typeName.end());
+    std::vector<std::string>::const_iterator it = std::find(wildcards.begin(), wildcards.end(), typeName);
+    return (it != wildcards.end()) ? static_cast<int>(it - wildcards.begin()) : -1;
+}
+
+cl::Program IgorCLTemplateCache::_buildIntrospectionProgram(const int platformIndex, const int deviceIndex, const std::string& templateSource, const std::vector<std::string>& wildcards, std::string& placeholderType) {
+    // typedefs keep their name in the argument type reported by the implementation, unlike macros.
+    // int allows the integer-only operators and builtins, float is the fallback for templates that need floating-point builtins.
+    // These programs are only inspected, so they are kept out of the program cache, and a failed int build is not reported.
+    const char* placeholderTypes[] = {"int", "float"};
+    const int nPlaceholderTypes = sizeof(placeholderTypes) / sizeof(placeholderTypes[0]);
+    for (int i = 0; ; ++i) {
+        std::string introspectionSource;
+        for (size_t j = 0; j < wildcards.size(); ++j) {
+            introspectionSource += std::string("typedef ") + placeholderTypes[i] + " " + wildcards[j] + ";\n";
+        }
+        introspectionSource += templateSource;
+        try {
+            cl::Program program = programCache.buildUncachedProgram(platformIndex, deviceIndex, introspectionSource, "-cl-kernel-arg-info", i == nPlaceholderTypes - 1);
+            placeholderType = placeholderTypes[i];
+            return program;
+        }
+        catch (const IgorCLError&) {
+            if (i == nPlaceholderTypes - 1)
+                throw;
+        }
+    }
+}
+
+std::vector<std::string> IgorCLTemplateCache::kernelNames(const int platformIndex, const int deviceIndex, const std::string& templateSource) {
+    IgorCLContextModeLease contextModeLease;
+    std::string placeholderType;
+    cl::Program program = _buildIntrospectionProgram(platformIndex, deviceIndex, templateSource, _findWildcards(templateSource), placeholderType);
+    return KernelNamesInProgram(program);
+}
+
+IgorCLKernelInfo IgorCLTemplateCache::kernelInfo(const int platformIndex, const int deviceIndex, const std::string& templateSource, const std::string& kernelName) {
+    IgorCLContextModeLease contextModeLease;
+    cl::Context context;
+    cl::Device device;
+    contextAndDeviceProvider.getContextForPlatformAndDevice(platformIndex, deviceIndex, context, device);
+    
+    std::string placeholderType;
+    cl::Program program = _buildIntrospectionProgram(platformIndex, deviceIndex, templateSource, _findWildcards(templateSource), placeholderType);
+    return KernelInfoInProgram(program, device, kernelName);
+}
+
+IgorCLTemplateCache::WildcardBinding IgorCLTemplateCache::_bindWildcards(const int platformIndex, const int deviceIndex, const std::string& templateSource, const std::string& kernelName) {
+    WildcardBinding binding;
+    binding.wildcards = _findWildcards(templateSource);
+    binding.argumentIndices.resize(binding.wildcards.size());
+    if (binding.wildcards.empty())
+        return binding;
+    
+    cl::Context context;
+    cl::Device device;
+    contextAndDeviceProvider.getContextForPlatformAndDevice(platformIndex, deviceIndex, context, device);
+    cl::Program program = _buildIntrospectionProgram(platformIndex, deviceIndex, templateSource, binding.wildcards, binding.placeholderType);
+    IgorCLKernelInfo info = KernelInfoInProgram(program, device, kernelName);
+    if (!info.haveArgumentInfo)
+        throw std::runtime_error("The OpenCL implementation does not provide the kernel argument types needed for /TMPL");
+    
+    bool haveUnusedWildcards = false;
+    for (size_t i = 0; i < info.arguments.size(); ++i) {
+        int wildcardIndex = _wildcardIndexForArgumentType(binding.wildcards, info.arguments[i].typeName);
+        if (wildcardIndex >= 0)
+            binding.argumentIndices[wildcardIndex].push_back(i);
+    }
+    std::vector<bool> isArgumentType(binding.wildcards.size());
+    for (size_t i = 0; i < binding.wildcards.size(); ++i) {
+        isArgumentType[i] = !binding.argumentIndices[i].empty();
+        haveUnusedWildcards |= !isArgumentType[i];
+    }
+    
+    // a wildcard that this kernel does not use may still belong to another kernel in the template
+    if (haveUnusedWildcards) {
+        std::vector<std::string> kernelNames = KernelNamesInProgram(program);
+        for (size_t i = 0; i < kernelNames.size(); ++i) {
+            if (kernelNames[i] == kernelName)
+                continue;
+            IgorCLKernelInfo otherInfo = KernelInfoInProgram(program, device, kernelNames[i]);
+            for (size_t j = 0; j < otherInfo.arguments.size(); ++j) {
+                int wildcardIndex = _wildcardIndexForArgumentType(binding.wildcards, otherInfo.arguments[j].typeName);
+                if (wildcardIndex >= 0)
+                    isArgumentType[wildcardIndex] = true;
+            }
+        }
+        for (size_t i = 0; i < binding.wildcards.size(); ++i) {
+            if (!isArgumentType[i])
+                throw std::runtime_error("Type wildcard " + binding.wildcards[i] + " is not the type of any kernel argument, so its type cannot be derived from the waves");
+        }
+    }
+    return binding;
+}
+
+std::string IgorCLTemplateCache::instantiate(const int platformIndex, const int deviceIndex, const std::string& templateSource, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::vector<IgorCLScalarArgument>& scalarArgs) {
+    IgorCLContextModeLease contextModeLease;
+    std::pair<std::string, std::string> key(templateSource, kernelName);
+    WildcardBinding binding;
+    bool haveBinding = false;
+    {
+        std::lock_guard<std::mutex> lock(_bindingMutex);
+        std::map<std::pair<std::string, std::string>, WildcardBinding>::const_iterator it = _bindings.find(key);
+        if (it != _bindings.end()) {
+            binding = it->second;
+            haveBinding = true;
+        }
+    }
+    if (!haveBinding) {
+        // compiled outside of the lock, threads racing on a new template reach the same result.
+        binding = _bindWildcards(platformIndex, deviceIndex, templateSource, kernelName);
+        std::lock_guard<std::mutex> lock(_bindingMutex);
+        if (_bindings.insert(std::make_pair(key, binding)).second) {
+            _insertionOrder.push_back(key);
+            while (_insertionOrder.size() > kMaxCachedBindings) {
+                _bindings.erase(_insertionOrder.front());
+                _insertionOrder.pop_front();
+            }
+        }
+    }
+    
+    // kernel argument index to wave index
+    std::vector<cl_uint> waveArgumentIndices = KernelArgumentIndicesForWaves(waves.size(), scalarArgs);
+    std::string definitions;
+    for (size_t i = 0; i < binding.wildcards.size(); ++i) {
+        std::string typeName(binding.placeholderType);
+        const std::vector<int>& argumentIndices = binding.argumentIndices[i];
+        for (size_t j = 0; j < argumentIndices.size(); ++j) {
+            std::vector<cl_uint>::const_iterator it = std::find(waveArgumentIndices.begin(), waveArgumentIndices.end(), static_cast<cl_uint>(argumentIndices[j]));
+            if (it == waveArgumentIndices.end())
+                throw std::runtime_error("Type wildcard " + binding.wildcards[i] + " is used by an argument that is not a wave");
+            size_t waveIndex = it - waveArgumentIndices.begin();
+            int flags = (memFlags.size() > waveIndex) ? memFlags[waveIndex] : 0;
+            std::string waveTypeName = DeviceTypeNameForWave(waves.at(waveIndex), flags);
+            if (j == 0) {
+                typeName = waveTypeName;
+            } else if (waveTypeName != typeName) {
+                throw std::runtime_error("The waves for type wildcard " + binding.wildcards[i] + " have different types (" + typeName + " and " + waveTypeName + ")");
+            }
+        }
+        definitions += "#define " + binding.wildcards[i] + " " + typeName + "\n";
+    }
+    if (definitions.find("half") != std::string::npos)
+        definitions = "#pragma OPENCL EXTENSION cl_khr_fp16 : enable\n" + definitions;
+    if (definitions.find("double") != std::string::npos)
+        definitions = "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n" + definitions;
+    
+    return definitions + templateSource;
+}
+
+void IgorCLTemplateCache::clear() {
+    std::lock_guard<std::mutex> lock(_bindingMutex);
+    _bindings.clear();
+    _insertionOrder.clear();
+}
+
+IgorCLTemplateCache templateCache;
+
+// the number of bytes that an argument occupies on the device, except for local memory and resident buffers.
+static size_t SessionTransferSizeInBytes(waveHndl wave, const int memFlags) {
+    if (RequiresTransferConversion(memFlags))
+        return TransferDataSizeInBytes(wave, memFlags);
+    return WaveDataSizeInBytes(wave);
+}
+
+IgorCLSession::IgorCLSession(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::vector<double>& fillValues, const std::vector<IgorCLScalarArgument>& scalarArgs, const std::vector<bool>& isDynamic, const std::string* sourceText, const std::vector<char>* sourceBinary) :
+    _platformIndex(platformIndex),
+    _deviceIndex(deviceIndex),
+    _globalRange(globalRange),
+    _workgroupSize(workgroupSize)
+{
+    IgorCLContextModeLease contextModeLease;
+    size_t nWaves = waves.size();
+    cl_int status;
+    
+    contextAndDeviceProvider.getContextForPlatformAndDevice(platformIndex, deviceIndex, _context, _device);
+    cl::Program program = programCache.getProgram(platformIndex, deviceIndex, sourceText, sourceBinary);
+    _kernel = cl::Kernel(program, kernelName.c_str(), &status);
+    if (status != CL_SUCCESS)
+        throw IgorCLError(status);
+    
+    // a queue of its own, so that a run does not have to acquire one
+    _commandQueue = cl::CommandQueue(_context, _device, 0, &status);
+    if (status != CL_SUCCESS)
+        throw IgorCLError(status);
+    statisticsCounters.increment(IgorCLCounterQueuesCreated);
+    
+    bool firstTouchDeviceBuffers = executionSettings.firstTouchOnDevice() && (_device.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU);
+    std::vector<cl_uint> waveArgumentIndices = KernelArgumentIndicesForWaves(nWaves, scalarArgs);
+    _arguments.resize(nWaves);
+    for (size_t i = 0; i < nWaves; i+=1) {
+        Argument& argument = _arguments.at(i);
+        argument.memFlags = (memFlags.size() > i) ? memFlags.at(i) : 0;
+        argument.openCLMemFlags = ConvertIgorCLFlagsToOpenCLFlags(argument.memFlags);
+        argument.isDynamic = (isDynamic.size() > i) && isDynamic.at(i);
+        argument.argumentIndex = waveArgumentIndices.at(i);
+        argument.fillValue = (fillValues.size() > i) ? fillValues.at(i) : 0.0;
+        argument.waveType = WaveType(waves.at(i));
+        argument.sizeInBytes = 0;
+        
+        // the buffers outlive this call, so they cannot use the memory of the wave
+        if (argument.openCLMemFlags & CL_MEM_USE_HOST_PTR)
+            throw std::runtime_error("A session cannot use wave memory on the device (IgorCLUseHostPointer)");
+        if (argument.memFlags & (IgorCLIsLocalMemory | IgorCLIsResidentBuffer))
+            continue;
+        
+        argument.sizeInBytes = SessionTransferSizeInBytes(waves.at(i), argument.memFlags);
+        if (RequiresTransferConversion(argument.memFlags))
+            argument.conversionBuffer.resize(argument.sizeInBytes);
+        if (argument.memFlags & IgorCLIsScalarArgument)
+            continue;
+        
+        argument.buffer = cl::Buffer(_context, argument.openCLMemFlags, argument.sizeInBytes, NULL, &status);
+        if (status != CL_SUCCESS)
+            throw IgorCLError(status);
+        statisticsCounters.increment(IgorCLCounterBuffersAllocated);
+        // only buffers that are not uploaded are first touched, an upload or fill overwrites the whole buffer.
+        if (firstTouchDeviceBuffers && (argument.openCLMemFlags & CL_MEM_WRITE_ONLY) && !(argument.memFlags & IgorCLFillOnDevice))
+            FirstTouchBufferOnDevice(_commandQueue, argument.buffer, argument.sizeInBytes);
+        if (argument.memFlags & IgorCLUsePinnedMemory) {
+            argument.stagingBuffer = cl::Buffer(_context, CL_MEM_ALLOC_HOST_PTR, argument.sizeInBytes, NULL, &status);
+            if (status != CL_SUCCESS)
+                throw IgorCLError(status);
+            statisticsCounters.increment(IgorCLCounterBuffersAllocated);
+        }
+    }
+    
+    // bind and upload every argument once
+    double uploadedBytes = 0;
+    for (size_t i = 0; i < nWaves; i+=1) {
+        _bindArgument(_arguments.at(i), waves.at(i));
+        _uploadArgument(_arguments.at(i), waves.at(i), uploadedBytes);
+    }
+    for (size_t i = 0; i < scalarArgs.size(); i+=1) {
+        const IgorCLScalarArgument& scalarArg = scalarArgs.at(i);
+        status = _kernel.setArg(scalarArg.argumentIndex, scalarArg.value.size(), const_cast<char*>(&scalarArg.value[0]));
+        if (status != CL_SUCCESS)
+            throw IgorCLError(status);
+    }
+    status = _commandQueue.finish();
+    if (status != CL_SUCCESS)
+        throw IgorCLError(status);
+    statisticsCounters.addTransferredBytes(platformIndex, deviceIndex, uploadedBytes, 0);
+}
+
+void IgorCLSession::_bindArgument(Argument& argument, waveHndl wave) {
+    cl_int status;
+    if (argument.memFlags & IgorCLIsLocalMemory) {
+        status = _kernel.setArg(argument.argumentIndex, SharedMemorySizeFromWave(wave), NULL);
+    } else if (argument.memFlags & IgorCLIsScalarArgument) {
+        void* value = WaveData(wave);
+        if (RequiresTransferConversion(argument.memFlags)) {
+            ConvertWaveDataForTransfer(wave, argument.memFlags, &argument.conversionBuffer[0]);
+            value = &argument.conversionBuffer[0];
+        }
+        status = _kernel.setArg(argument.argumentIndex, argument.sizeInBytes, value);
+    } else if (argument.memFlags & IgorCLIsResidentBuffer) {
+        // the wave holds the ID of a buffer that is already on the device (moved there if it lives elsewhere)
+        argument.buffer = residentBuffers.getBufferOnDevice(ResidentBufferIDFromWave(wave), _platformIndex, _deviceIndex).buffer;
+        status = _kernel.setArg(argument.argumentIndex, argument.buffer);
+    } else {
+        status = _kernel.setArg(argument.argumentIndex, argument.buffer);
+    }
+    if (status != CL_SUCCESS)
+        throw IgorCLError(status);
+}
+
+void IgorCLSession::_uploadArgument(Argument& argument, waveHndl wave, double& uploadedBytes) {
+    if (argument.memFlags & (IgorCLIsLocalMemory | IgorCLIsScalarArgument | IgorCLIsResidentBuffer))
+        return;
+    
+    if (argument.memFlags & IgorCLFillOnDevice) {
+        EnqueueFillOnDevice(_commandQueue, argument.buffer, wave, argument.memFlags, argument.fillValue, argument.sizeInBytes);
+        return;
+    }
+    if (argument.openCLMemFlags & CL_MEM_WRITE_ONLY)
+        return;
+    
+    if (argument.memFlags & IgorCLUsePinnedMemory) {
+        EnqueueStagedUpload(_commandQueue, argument.buffer, argument.stagingBuffer, wave, argument.memFlags, argument.sizeInBytes);
+    } else if (RequiresTransferConversion(argument.memFlags)) {
+        ConvertWaveDataForTransfer(wave, argument.memFlags, &argument.conversionBuffer[0]);
+        CheckStatus(_commandQueue.enqueueWriteBuffer(argument.buffer, false, 0, argument.sizeInBytes, &argument.conversionBuffer[0]));
+    } else {
+        CheckStatus(_commandQueue.enqueueWriteBuffer(argument.buffer, false, 0, argument.sizeInBytes, WaveData(wave)));
+    }
+    uploadedBytes += argument.sizeInBytes;
+}
+
+void IgorCLSession::_downloadArgument(Argument& argument, waveHndl wave, double& downloadedBytes) {
+    if (argument.memFlags & (IgorCLIsLocalMemory | IgorCLIsScalarArgument | IgorCLIsResidentBuffer))
+        return;
+    if (argument.openCLMemFlags & CL_MEM_READ_ONLY)
+        return;
+    
+    // converted data is read with a blocking read, so that it can be converted right away
+    if (argument.memFlags & IgorCLUsePinnedMemory) {
+        EnqueueStagedDownload(_commandQueue, argument.buffer, argument.stagingBuffer, wave, argument.memFlags, argument.sizeInBytes);
+    } else if (RequiresTransferConversion(argument.memFlags)) {
+        CheckStatus(_commandQueue.enqueueReadBuffer(argument.buffer, true, 0, argument.sizeInBytes, &argument.conversionBuffer[0]));
+        ConvertTransferredDataToWave(&argument.conversionBuffer[0], argument.memFlags, wave);
+    } else {
+        CheckStatus(_commandQueue.enqueueReadBuffer(argument.buffer, false, 0, argument.sizeInBytes, WaveData(wave)));
+    }
+    downloadedBytes += argument.sizeInBytes;
+}
+
+void IgorCLSession::run(const std::vector<waveHndl>& waves) {
+    std::lock_guard<std::mutex> lock(_runMutex);
+    
+    size_t nWaves = _arguments.size();
+    if (waves.size() != nWaves)
+        throw std::runtime_error("A session must be run with the waves that it was created with");
+    for (size_t i = 0; i < nWaves; i+=1) {
+        const Argument& argument = _arguments.at(i);
+        if (!argument.isDynamic || (argument.memFlags & (IgorCLIsLocalMemory | IgorCLIsResidentBuffer)))
+            continue;
+        if (WaveType(waves.at(i)) != argument.waveType)
+            throw std::runtime_error("The type of a dynamic wave differs from its type when the session was created");
+        if (SessionTransferSizeInBytes(waves.at(i), argument.memFlags) != argument.sizeInBytes)
+            throw std::runtime_error("The size of a dynamic wave differs from its size when the session was created");
+    }
+    
+    statisticsCounters.increment(IgorCLCounterCalculations);
+    std::chrono::steady_clock::time_point phaseStart = std::chrono::steady_clock::now();
+    
+    cl_int status;
+    double uploadedBytes = 0, downloadedBytes = 0;
+    try {
+        for (size_t i = 0; i < nWaves; i+=1) {
+            Argument& argument = _arguments.at(i);
+            // a resident buffer may have been moved to another device since the last run, so it is looked up every time
+            if (argument.memFlags & IgorCLIsResidentBuffer) {
+                _bindArgument(argument, waves.at(i));
+                continue;
+            }
+            if (!argument.isDynamic)
+                continue;
+            // buffer arguments stay bound to the same buffer
+            if (argument.memFlags & (IgorCLIsLocalMemory | IgorCLIsScalarArgument))
+                _bindArgument(argument, waves.at(i));
+            _uploadArgument(argument, waves.at(i), uploadedBytes);
+        }
+        
+        status = _commandQueue.enqueueNDRangeKernel(_kernel, cl::NullRange, _globalRange, _workgroupSize, NULL, NULL);
+        if (status != CL_SUCCESS)
+            throw IgorCLError(status);
+        statisticsCounters.increment(IgorCLCounterKernelLaunches);
+        
+        for (size_t i = 0; i < nWaves; i+=1) {
+            if (_arguments.at(i).isDynamic)
+                _downloadArgument(_arguments.at(i), waves.at(i), downloadedBytes);
+        }
+    }
+    catch (...) {
+        // transfers that were already enqueued may still use the wave memory
+        _commandQueue.finish();
+        throw;
+    }
+    
+    status = _commandQueue.finish();
+    if (status != CL_SUCCESS)
+        throw IgorCLError(status);
+    
+    statisticsCounters.addTransferredBytes(_platformIndex, _deviceIndex, uploadedBytes, downloadedBytes);
+    statisticsCounters.addPhaseTime(IgorCLPhaseExecute, SecondsSince(phaseStart));
+}
+
+int IgorCLSessionRegistry::_addSession(const std::shared_ptr<IgorCLSession>& session) {
+    std::lock_guard<std::mutex> lock(_sessionMutex);
+    
+    int sessionID = _nextSessionID++;
+    _sessions[sessionID] = session;
+    return sessionID;
+}
+
+int IgorCLSessionRegistry::createSession(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::vector<double>& fillValues, const std::vector<IgorCLScalarArgument>& scalarArgs, const std::vector<bool>& isDynamic, const std::string& sourceText) {
+    std::shared_ptr<IgorCLSession> session(new IgorCLSession(platformIndex, deviceIndex, globalRange, workgroupSize, kernelName, waves, memFlags, fillValues, scalarArgs, isDynamic, &sourceText, NULL));
+    return _addSession(session);
+}
+
+int IgorCLSessionRegistry::createSession(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::vector<double>& fillValues, const std::vector<IgorCLScalarArgument>& scalarArgs, const std::vector<bool>& isDynamic, const std::vector<char>& sourceBinary) {
+    std::shared_ptr<IgorCLSession> session(new IgorCLSession(platformIndex, deviceIndex, globalRange, workgroupSize, kernelName, waves, memFlags, fillValues, scalarArgs, isDynamic, NULL, &sourceBinary));
+    return _addSession(session);
+}
+
+void IgorCLSessionRegistry::runSession(const int sessionID, const std::vector<waveHndl>& waves) {
+    std::shared_ptr<IgorCLSession> session;
+    {
+        std::lock_guard<std::mutex> lock(_sessionMutex);
+        std::map<int, std::shared_ptr<IgorCLSession> >::iterator it = _sessions.find(sessionID);
+        if (it == _sessions.end())
+            throw std::runtime_error("No session with this ID");
+        session = it->second;
+    }
+    // a session that is released while it runs is destroyed when the run finishes
+    session->run(waves);
+}
+
+void IgorCLSessionRegistry::releaseSession(const int sessionID) {
+    std::lock_guard<std::mutex> lock(_sessionMutex);
+    
+    if (_sessions.erase(sessionID) == 0)
+        throw std::runtime_error("No session with this ID");
+}
+
+void IgorCLSessionRegistry::clear() {
+    std::lock_guard<std::mutex> lock(_sessionMutex);
+    
+    _sessions.clear();
+}
+
+IgorCLSessionRegistry sessions;
@@ -26,9 +26,163 @@ this program with Igor Pro, developed by WaveMetrics Inc. (www.wavemetrics.com).
 #include "XOPStandardHeaders.h"
 #include <vector>
 
-void DoOpenCLCalculation(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::string& sourceText);
-void DoOpenCLCalculation(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::vector<char>& sourceBinary);
+#include "IgorCLUtilities.h"
+
+// if wavesMayHaveChanged is provided, it is set once the kernel has been enqueued. From then on the kernel may have written
+// into wave memory (IgorCLUseHostPointer) or results may have been copied back, so the call must not be repeated after an error.
+void DoOpenCLCalculation(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::vector<double>& fillValues, const std::vector<IgorCLScalarArgument>& scalarArgs, const std::string& sourceText, bool* wavesMayHaveChanged = NULL);
+void DoOpenCLCalculation(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::vector<double>& fillValues, const std::vector<IgorCLScalarArgument>& scalarArgs, const std::vector<char>& sourceBinary, bool* wavesMayHaveChanged = NULL);
 
 std::vector<char> CompileSource(const int platformIndex, const int deviceIndex, const std::string programSource, std::string& buildLog);
 
+// results of IgorCLBench for a single device. Bandwidths are in bytes per second, times in seconds.
+struct IgorCLBenchmarkResult {
+    std::vector<size_t> transferSizes;
+    std::vector<double> h2dBandwidth[IgorCLNTransferStrategies];   // one point per transfer size
+    std::vector<double> d2hBandwidth[IgorCLNTransferStrategies];
+    double launchLatency;       // enqueue and finish an empty kernel
+    double finishLatency;       // finish on an empty queue
+    double compileTime;         // build a small program that is not in the program cache
+};
+
+// the device cost model calibrates with this as well, without measuring compileTime (which is then NaN).
+IgorCLBenchmarkResult BenchmarkDevice(const int platformIndex, const int deviceIndex, const std::vector<size_t>& transferSizes, const int nRepeats, const bool measureCompileTime = true);
+
+// resource usage of a kernel on a device, as reported by clGetKernelWorkGroupInfo, and the metadata of its arguments.
+// The argument metadata is empty if the implementation does not provide it, which is allowed for programs built from binaries.
+struct IgorCLKernelArgumentInfo {
+    std::string name;
+    std::string typeName;
+    std::string addressQualifier;   // global, local, constant or private
+    std::string accessQualifier;    // read_only, write_only, read_write or none (only images have access qualifiers)
+    std::string typeQualifier;      // any of const, restrict and volatile, or none
+    int memFlags;                   // IgorCL memory flags derived from the qualifiers
+};
+
+struct IgorCLKernelInfo {
+    size_t workGroupSize;
+    size_t preferredWorkGroupSizeMultiple;
+    cl_ulong localMemSize;          // in bytes, including any local memory arguments that have been set
+    cl_ulong privateMemSize;        // in bytes, per work item
+    int nArguments;
+    bool haveArgumentInfo;
+    std::vector<IgorCLKernelArgumentInfo> arguments;
+};
+
+IgorCLKernelInfo GetKernelInfo(const int platformIndex, const int deviceIndex, const std::string& kernelName, const std::string& sourceText);
+IgorCLKernelInfo GetKernelInfo(const int platformIndex, const int deviceIndex, const std::string& kernelName, const std::vector<char>& sourceBinary);
+
+// the names of all kernels in the program
+std::vector<std::string> GetKernelNames(const int platformIndex, const int deviceIndex, const std::string& sourceText);
+std::vector<std::string> GetKernelNames(const int platformIndex, const int deviceIndex, const std::vector<char>& sourceBinary);
+
+// Kernel templates (IgorCL /TMPL) contain type wildcards (ICLT_0, ICLT_1, ...) instead of argument types. The first time
+// a template and kernel are seen, the template is compiled once with placeholder types (int, or float if that fails)
+// to find the kernel arguments that use each wildcard. After that, each call only derives the types from the waves and
+// defines the wildcards accordingly. Every type signature therefore yields its own source, that is compiled once by the
+// program cache. All waves that share a wildcard must have the same type. A wildcard that no argument of the kernel
+// uses keeps the placeholder type if it is an argument type of another kernel in the template, and is an error otherwise.
+class IgorCLTemplateCache {
+public:
+    IgorCLTemplateCache() {;}
+    ~IgorCLTemplateCache() {;}
+    
+    std::string instantiate(const int platformIndex, const int deviceIndex, const std::string& templateSource, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::vector<IgorCLScalarArgument>& scalarArgs);
+    void clear();
+    
+    // the kernels of a template and their arguments, for IgorCLKernelInfo /TMPL. The template is compiled with the placeholder
+    // type in the same way, so arguments that use a wildcard report the wildcard as their type name.
+    static std::vector<std::string> kernelNames(const int platformIndex, const int deviceIndex, const std::string& templateSource);
+    static IgorCLKernelInfo kernelInfo(const int platformIndex, const int deviceIndex, const std::string& templateSource, const std::string& kernelName);
+    
+private:
+    struct WildcardBinding {
+        std::vector<std::string> wildcards;
+        std::vector<std::vector<int> > argumentIndices;     // kernel arguments that have this wildcard type
+        std::string placeholderType;                        // the type that the template compiled with
+    };
+    
+    static const size_t kMaxCachedBindings = 64;
+    
+    static std::vector<std::string> _findWildcards(const std::string& templateSource);
+    static int _wildcardIndexForArgumentType(const std::vector<std::string>& wildcards, std::string typeName);
+    static cl::Program _buildIntrospectionProgram(const int platformIndex, const int deviceIndex, const std::string& templateSource, const std::vector<std::string>& wildcards, std::string& placeholderType);
+    static WildcardBinding _bindWildcards(const int platformIndex, const int deviceIndex, const std::string& templateSource, const std::string& kernelName);
+    
+    std::map<std::pair<std::string, std::string>, WildcardBinding> _bindings;     // keyed on template and kernel name
+    std::deque<std::pair<std::string, std::string> > _insertionOrder;
+    
+    std::mutex _bindingMutex;
+};
+
+extern IgorCLTemplateCache templateCache;
+
+// A calculation that is set up once and then run many times (IgorCLSession), e.g. on every new frame from a camera.
+// Creating a session resolves the context, program, kernel and memory flags, creates a command queue of its own,
+// allocates all buffers, and uploads and binds every argument. A run only transfers the arguments that are flagged
+// as dynamic, launches the kernel, and reads back the dynamic arguments that the kernel may write. Arguments that are
+// not dynamic keep their buffer between runs. Resident buffers are looked up again on every run, since they may have
+// been moved to another device in the meantime. Runs of the same session are serialized.
+class IgorCLSession {
+public:
+    IgorCLSession(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::vector<double>& fillValues, const std::vector<IgorCLScalarArgument>& scalarArgs, const std::vector<bool>& isDynamic, const std::string* sourceText, const std::vector<char>* sourceBinary);
+    ~IgorCLSession() {;}
+    
+    // waves are the same arguments that the session was created with. Dynamic waves must keep their type and size.
+    void run(const std::vector<waveHndl>& waves);
+    
+private:
+    struct Argument {
+        int memFlags;
+        int openCLMemFlags;
+        bool isDynamic;
+        cl_uint argumentIndex;
+        int waveType;
+        size_t sizeInBytes;
+        double fillValue;
+        cl::Buffer buffer;                  // not used by local memory and scalar arguments
+        cl::Buffer stagingBuffer;           // pinned memory, only for IgorCLUsePinnedMemory
+        std::vector<char> conversionBuffer; // only for arguments that are stored as a different type on the device
+    };
+    
+    void _bindArgument(Argument& argument, waveHndl wave);
+    void _uploadArgument(Argument& argument, waveHndl wave, double& uploadedBytes);
+    void _downloadArgument(Argument& argument, waveHndl wave, double& downloadedBytes);
+    
+    int _platformIndex;
+    int _deviceIndex;
+    cl::NDRange _globalRange;
+    cl::NDRange _workgroupSize;
+    cl::Context _context;
+    cl::Device _device;
+    cl::Kernel _kernel;
+    cl::CommandQueue _commandQueue;
+    std::vector<Argument> _arguments;
+    
+    std::mutex _runMutex;
+};
+
+// Sessions created with IgorCLSession, referred to by an integer ID.
+class IgorCLSessionRegistry {
+public:
+    IgorCLSessionRegistry() : _nextSessionID(1) {;}
+    ~IgorCLSessionRegistry() {;}
+    
+    int createSession(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::vector<double>& fillValues, const std::vector<IgorCLScalarArgument>& scalarArgs, const std::vector<bool>& isDynamic, const std::string& sourceText);
+    int createSession(const int platformIndex, const int deviceIndex, const cl::NDRange globalRange, const cl::NDRange workgroupSize, const std::string& kernelName, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const std::vector<double>& fillValues, const std::vector<IgorCLScalarArgument>& scalarArgs, const std::vector<bool>& isDynamic, const std::vector<char>& sourceBinary);
+    void runSession(const int sessionID, const std::vector<waveHndl>& waves);
+    void releaseSession(const int sessionID);
+    void clear();
+    
+private:
+    int _addSession(const std::shared_ptr<IgorCLSession>& session);
+    
+    std::map<int, std::shared_ptr<IgorCLSession> > _sessions;
+    int _nextSessionID;
+    
+    std::mutex _sessionMutex;
+};
+
+extern IgorCLSessionRegistry sessions;
+
 #endif
@@ -23,8 +23,21 @@ this program with Igor Pro, developed by WaveMetrics Inc. (www.wavemetrics.com).
 #include <string>
 #include <cctype>
 #include <memory>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <future>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define IGORCL_HAVE_SSE2
+#include <emmintrin.h>
+#endif
 
 #include "IgorCLUtilities.h"
+#include "IgorCLOperations.h"
 #include "IgorCLConstants.h"
 
 void StoreStringInTextWave(const std::string str, waveHndl textWave, IndexInt* indices) {
@@ -90,6 +103,11 @@ size_t WaveDataSizeInBytes(waveHndl wave) {
         case NT_FP64:
             bytesPerPoint = 8;
             break;
+#ifdef NT_I64
+        case NT_I64:
+            bytesPerPoint = 8;  // long or ulong on the device
+            break;
+#endif
         default:
             throw int(NOMEM);
             break;
@@ -115,11 +133,349 @@ size_t SharedMemorySizeFromWave(waveHndl wave) {
     return static_cast<size_t>(dMemorySize);
 }
 
-int GetFirstDeviceOfType(const int platformIndex, const std::string& deviceTypeStr) {
+int ResidentBufferIDFromWave(waveHndl wave) {
+    int err = 0;
+    
+    if ((WavePoints(wave) != 1) || (WaveType(wave) & NT_CMPLX))
+        throw std::runtime_error("A resident buffer must be specified in a numeric, non-complex wave with a single point containing its ID");
+    
+    double dBufferID;
+    err = MDGetDPDataFromNumericWave(wave, &dBufferID);
+    if (err)
+        throw err;
+    
+    return static_cast<int>(dBufferID + 0.5);
+}
+
+static void ConvertDoubleToFloat(const double* source, float* destination, const size_t nValues) {
+    size_t i = 0;
+#ifdef IGORCL_HAVE_SSE2
+    for (; i + 4 <= nValues; i += 4) {
+        __m128 lower = _mm_cvtpd_ps(_mm_loadu_pd(source + i));
+        __m128 upper = _mm_cvtpd_ps(_mm_loadu_pd(source + i + 2));
+        _mm_storeu_ps(destination + i, _mm_movelh_ps(lower, upper));
+    }
+#endif
+    for (; i < nValues; ++i) {
+        destination[i] = static_cast<float>(source[i]);
+    }
+}
+
+static void ConvertFloatToDouble(const float* source, double* destination, const size_t nValues) {
+    size_t i = 0;
+#ifdef IGORCL_HAVE_SSE2
+    for (; i + 4 <= nValues; i += 4) {
+        __m128 values = _mm_loadu_ps(source + i);
+        _mm_storeu_pd(destination + i, _mm_cvtps_pd(values));
+        _mm_storeu_pd(destination + i + 2, _mm_cvtps_pd(_mm_movehl_ps(values, values)));
+    }
+#endif
+    for (; i < nValues; ++i) {
+        destination[i] = source[i];
+    }
+}
+
+// IEEE 754 binary16 conversions with round-to-nearest-even.
+// The device reads and writes these values using vload_half / vstore_half.
+static cl_half FloatToHalf(const float value) {
+    cl_uint bits;
+    memcpy(&bits, &value, sizeof(bits));
+    
+    cl_uint sign = (bits >> 16) & 0x8000;
+    cl_uint floatExponent = (bits >> 23) & 0xff;
+    cl_uint mantissa = bits & 0x7fffff;
+    
+    if (floatExponent == 0xff) {
+        // infinity or NaN (keep NaNs quiet)
+        return static_cast<cl_half>(sign | 0x7c00 | ((mantissa != 0) ? (0x200 | (mantissa >> 13)) : 0));
+    }
+    
+    int exponent = static_cast<int>(floatExponent) - 127 + 15;
+    if (exponent >= 0x1f)
+        return static_cast<cl_half>(sign | 0x7c00);   // overflow to infinity
+    
+    if (exponent <= 0) {
+        // subnormal half or zero
+        if (exponent < -10)
+            return static_cast<cl_half>(sign);
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        cl_uint halfMantissa = mantissa >> shift;
+        cl_uint remainder = mantissa & ((1u << shift) - 1);
+        cl_uint halfway = 1u << (shift - 1);
+        if ((remainder > halfway) || ((remainder == halfway) && (halfMantissa & 1)))
+            halfMantissa += 1;
+        return static_cast<cl_half>(sign | halfMantissa);
+    }
+    
+    cl_uint half = sign | (static_cast<cl_uint>(exponent) << 10) | (mantissa >> 13);
+    cl_uint remainder = mantissa & 0x1fff;
+    if ((remainder > 0x1000) || ((remainder == 0x1000) && (half & 1)))
+        half += 1;  // a carry into the exponent correctly rounds up to the next power of two (or infinity)
+    return static_cast<cl_half>(half);
+}
+
+static float HalfToFloat(const cl_half half) {
+    cl_uint sign = static_cast<cl_uint>(half & 0x8000) << 16;
+    cl_uint exponent = (half >> 10) & 0x1f;
+    cl_uint mantissa = half & 0x3ff;
+    cl_uint bits;
+    
+    if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        bits = sign;
+    } else {
+        // subnormal half, normalize
+        exponent = 127 - 15 + 1;
+        while ((mantissa & 0x400) == 0) {
+            mantissa <<= 1;
+            exponent -= 1;
+        }
+        mantissa &= 0x3ff;
+        bits = sign | (exponent << 23) | (mantissa << 13);
+    }
+    
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+bool RequiresTransferConversion(const int igorCLFlags) {
+    return ((igorCLFlags & (IgorCLTransferAsSingle | IgorCLTransferAsHalf)) != 0);
+}
+
+size_t TransferDataSizeInBytes(waveHndl wave, const int igorCLFlags) {
+    if (!RequiresTransferConversion(igorCLFlags))
+        return WaveDataSizeInBytes(wave);
+    
+    int waveType = WaveType(wave);
+    int baseType = waveType & ~NT_CMPLX;
+    size_t bytesPerPoint;
+    if (igorCLFlags & IgorCLTransferAsSingle) {
+        if (baseType != NT_FP64)
+            throw int(NT_INCOMPATIBLE);
+        bytesPerPoint = sizeof(cl_float);
+    } else {
+        if ((baseType != NT_FP32) && (baseType != NT_FP64))
+            throw int(NT_INCOMPATIBLE);
+        bytesPerPoint = sizeof(cl_half);
+    }
+    
+    if (waveType & NT_CMPLX)
+        bytesPerPoint *= 2;
+    
+    return WavePoints(wave) * bytesPerPoint;
+}
+
+void ConvertWaveDataForTransfer(waveHndl wave, const int igorCLFlags, void* destination) {
+    int waveType = WaveType(wave);
+    size_t nValues = WavePoints(wave);
+    if (waveType & NT_CMPLX)
+        nValues *= 2;
+    
+    if (igorCLFlags & IgorCLTransferAsSingle) {
+        ConvertDoubleToFloat(reinterpret_cast<const double*>(WaveData(wave)), reinterpret_cast<float*>(destination), nValues);
+    } else if ((waveType & ~NT_CMPLX) == NT_FP32) {
+        const float* source = reinterpret_cast<const float*>(WaveData(wave));
+        cl_half* halfDestination = reinterpret_cast<cl_half*>(destination);
+        for (size_t i = 0; i < nValues; ++i) {
+            halfDestination[i] = FloatToHalf(source[i]);
+        }
+    } else {
+        const double* source = reinterpret_cast<const double*>(WaveData(wave));
+        cl_half* halfDestination = reinterpret_cast<cl_half*>(destination);
+        for (size_t i = 0; i < nValues; ++i) {
+            halfDestination[i] = FloatToHalf(static_cast<float>(source[i]));
+        }
+    }
+}
+
+void ConvertTransferredDataToWave(const void* source, const int igorCLFlags, waveHndl wave) {
+    int waveType = WaveType(wave);
+    size_t nValues = WavePoints(wave);
+    if (waveType & NT_CMPLX)
+        nValues *= 2;
+    
+    if (igorCLFlags & IgorCLTransferAsSingle) {
+        ConvertFloatToDouble(reinterpret_cast<const float*>(source), reinterpret_cast<double*>(WaveData(wave)), nValues);
+    } else if ((waveType & ~NT_CMPLX) == NT_FP32) {
+        const cl_half* halfSource = reinterpret_cast<const cl_half*>(source);
+        float* destination = reinterpret_cast<float*>(WaveData(wave));
+        for (size_t i = 0; i < nValues; ++i) {
+            destination[i] = HalfToFloat(halfSource[i]);
+        }
+    } else {
+        const cl_half* halfSource = reinterpret_cast<const cl_half*>(source);
+        double* destination = reinterpret_cast<double*>(WaveData(wave));
+        for (size_t i = 0; i < nValues; ++i) {
+            destination[i] = HalfToFloat(halfSource[i]);
+        }
+    }
+}
+
+template <typename T> static void AppendToPattern(std::vector<char>& pattern, const T value) {
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    pattern.insert(pattern.end(), bytes, bytes + sizeof(T));
+}
+
+std::vector<char> FillPatternForWave(waveHndl wave, const int igorCLFlags, const double fillValue) {
+    int waveType = WaveType(wave);
+    bool isComplex = ((waveType & NT_CMPLX) != 0);
+    
+    // a complex pattern sets the real part, the imaginary part is zero
+    std::vector<char> pattern;
+    int nComponents = (isComplex) ? 2 : 1;
+    for (int i = 0; i < nComponents; ++i) {
+        double value = (i == 0) ? fillValue : 0.0;
+        if (igorCLFlags & IgorCLTransferAsSingle) {
+            AppendToPattern(pattern, static_cast<cl_float>(value));
+            continue;
+        }
+        if (igorCLFlags & IgorCLTransferAsHalf) {
+            AppendToPattern(pattern, FloatToHalf(static_cast<float>(value)));
+            continue;
+        }
+        switch (waveType & ~NT_CMPLX) {
+            case NT_I8:
+                AppendToPattern(pattern, static_cast<cl_char>(value));
+                break;
+            case NT_I8 | NT_UNSIGNED:
+                AppendToPattern(pattern, static_cast<cl_uchar>(value));
+                break;
+            case NT_I16:
+                AppendToPattern(pattern, static_cast<cl_short>(value));
+                break;
+            case NT_I16 | NT_UNSIGNED:
+                AppendToPattern(pattern, static_cast<cl_ushort>(value));
+                break;
+            case NT_I32:
+                AppendToPattern(pattern, static_cast<cl_int>(value));
+                break;
+            case NT_I32 | NT_UNSIGNED:
+                AppendToPattern(pattern, static_cast<cl_uint>(value));
+                break;
+#ifdef NT_I64
+            case NT_I64:
+                AppendToPattern(pattern, static_cast<cl_long>(value));
+                break;
+            case NT_I64 | NT_UNSIGNED:
+                AppendToPattern(pattern, static_cast<cl_ulong>(value));
+                break;
+#endif
+            case NT_FP32:
+                AppendToPattern(pattern, static_cast<cl_float>(value));
+                break;
+            case NT_FP64:
+                AppendToPattern(pattern, static_cast<cl_double>(value));
+                break;
+            default:
+                throw int(NT_INCOMPATIBLE);
+                break;
+        }
+    }
+    
+    return pattern;
+}
+
+void EstimateTransferBytes(const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, double& bytesToDevice, double& bytesFromDevice) {
+    bytesToDevice = 0;
+    bytesFromDevice = 0;
+    for (size_t i = 0; i < waves.size(); ++i) {
+        int flags = (memFlags.size() > i) ? memFlags.at(i) : 0;
+        if (flags & (IgorCLIsLocalMemory | IgorCLIsScalarArgument | IgorCLIsResidentBuffer))
+            continue;
+        // zero-copy buffers are counted as well, on a discrete device their data still crosses the bus
+        double nBytes = TransferDataSizeInBytes(waves.at(i), flags);
+        if (!(flags & (IgorCLWriteOnly | IgorCLFillOnDevice)))
+            bytesToDevice += nBytes;
+        if (!(flags & IgorCLReadOnly))
+            bytesFromDevice += nBytes;
+    }
+}
+
+IgorCLScalarArgument MakeScalarArgument(const int argumentIndex, const int waveTypeCode, const double value, const cl_long* exactIntegerValue) {
+    IgorCLScalarArgument scalarArg;
+    scalarArg.argumentIndex = argumentIndex;
+    
+    // the type codes are the Igor wave types, e.g. as returned by WaveType()
+    switch (waveTypeCode) {
+        case NT_I8:
+            AppendToPattern(scalarArg.value, static_cast<cl_char>(value));
+            break;
+        case NT_I8 | NT_UNSIGNED:
+            AppendToPattern(scalarArg.value, static_cast<cl_uchar>(value));
+            break;
+        case NT_I16:
+            AppendToPattern(scalarArg.value, static_cast<cl_short>(value));
+            break;
+        case NT_I16 | NT_UNSIGNED:
+            AppendToPattern(scalarArg.value, static_cast<cl_ushort>(value));
+            break;
+        case NT_I32:
+            AppendToPattern(scalarArg.value, static_cast<cl_int>(value));
+            break;
+        case NT_I32 | NT_UNSIGNED:
+            AppendToPattern(scalarArg.value, static_cast<cl_uint>(value));
+            break;
+#ifdef NT_I64
+        case NT_I64:
+            AppendToPattern(scalarArg.value, (exactIntegerValue != NULL) ? *exactIntegerValue : static_cast<cl_long>(value));
+            break;
+        case NT_I64 | NT_UNSIGNED:
+            AppendToPattern(scalarArg.value, (exactIntegerValue != NULL) ? static_cast<cl_ulong>(*exactIntegerValue) : static_cast<cl_ulong>(value));
+            break;
+#endif
+        case NT_FP32:
+            AppendToPattern(scalarArg.value, static_cast<cl_float>(value));
+            break;
+        case NT_FP64:
+            AppendToPattern(scalarArg.value, static_cast<cl_double>(value));
+            break;
+        default:
+            throw int(NT_INCOMPATIBLE);
+            break;
+    }
+    
+    return scalarArg;
+}
+
+std::vector<cl_uint> KernelArgumentIndicesForWaves(const size_t nWaves, const std::vector<IgorCLScalarArgument>& scalarArgs) {
+    // scalar arguments occupy the kernel argument index they were given,
+    // the waves fill the remaining indices in order.
+    size_t nArguments = nWaves + scalarArgs.size();
+    std::vector<bool> isScalarIndex(nArguments, false);
+    for (size_t i = 0; i < scalarArgs.size(); ++i) {
+        int argumentIndex = scalarArgs[i].argumentIndex;
+        if ((argumentIndex < 0) || (argumentIndex >= nArguments))
+            throw int(INDEX_OUT_OF_RANGE);
+        if (isScalarIndex[argumentIndex])
+            throw std::runtime_error("The same kernel argument index was given to more than one scalar argument");
+        isScalarIndex[argumentIndex] = true;
+    }
+    
+    std::vector<cl_uint> waveArgumentIndices;
+    waveArgumentIndices.reserve(nWaves);
+    for (size_t i = 0; i < nArguments; ++i) {
+        if (!isScalarIndex[i])
+            waveArgumentIndices.push_back(i);
+    }
+    
+    return waveArgumentIndices;
+}
+
+std::string NormalizeDeviceTypeString(const std::string& deviceTypeStr) {
     std::string upperCaseStr(deviceTypeStr);
     for (int i = 0; i < upperCaseStr.size(); ++i) {
         upperCaseStr[i] = std::toupper(upperCaseStr[i]);
     }
+    return upperCaseStr;
+}
+
+int GetFirstDeviceOfType(const int platformIndex, const std::string& deviceTypeStr) {
+    std::string upperCaseStr = NormalizeDeviceTypeString(deviceTypeStr);
     
     int deviceType;
     if (upperCaseStr == "CPU") {
@@ -132,30 +488,287 @@ int GetFirstDeviceOfType(const int platformIndex, const std::string& deviceTypeS
         throw std::runtime_error("Unknown device type string");
     }
     
-    // initialize the platform
+    const std::vector<IgorCLDeviceDescription>& devices = deviceTable.getDeviceDescriptions(platformIndex);
+    for (int i = 0; i < devices.size(); ++i) {
+        if (devices.at(i).type == deviceType)
+            return i;
+    }
+    
+    // still here? No matching device.
+    throw std::runtime_error("No device of requested type available");
+}
+
+IgorCLDeviceDescription DescribeDevice(const cl::Device& device) {
+    IgorCLDeviceDescription description;
+    description.device = device;
+    description.name = device.getInfo<CL_DEVICE_NAME>();
+    description.type = device.getInfo<CL_DEVICE_TYPE>();
+    
+    double* capabilities = description.capabilities;
+    capabilities[IgorCLCapabilityType] = description.type;
+    capabilities[IgorCLCapabilityAvailable] = (device.getInfo<CL_DEVICE_AVAILABLE>() != CL_FALSE);
+    capabilities[IgorCLCapabilityHostUnifiedMemory] = (device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>() != CL_FALSE);
+    capabilities[IgorCLCapabilityGlobalMemSize] = device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+    capabilities[IgorCLCapabilityGlobalMemCacheSize] = device.getInfo<CL_DEVICE_GLOBAL_MEM_CACHE_SIZE>();
+    capabilities[IgorCLCapabilityMaxMemAllocSize] = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+    capabilities[IgorCLCapabilityLocalMemType] = device.getInfo<CL_DEVICE_LOCAL_MEM_TYPE>();
+    capabilities[IgorCLCapabilityLocalMemSize] = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+    capabilities[IgorCLCapabilityMaxConstantBufferSize] = device.getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>();
+    capabilities[IgorCLCapabilityMaxComputeUnits] = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+    capabilities[IgorCLCapabilityMaxClockFrequency] = device.getInfo<CL_DEVICE_MAX_CLOCK_FREQUENCY>();
+    std::vector<size_t> maxWorkItemSizes = device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+    maxWorkItemSizes.resize(3, 1);
+    capabilities[IgorCLCapabilityMaxWorkItemSize0] = maxWorkItemSizes[0];
+    capabilities[IgorCLCapabilityMaxWorkItemSize1] = maxWorkItemSizes[1];
+    capabilities[IgorCLCapabilityMaxWorkItemSize2] = maxWorkItemSizes[2];
+    capabilities[IgorCLCapabilityMaxWorkGroupSize] = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+    capabilities[IgorCLCapabilityPreferredVectorWidthChar] = device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_CHAR>();
+    capabilities[IgorCLCapabilityPreferredVectorWidthShort] = device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_SHORT>();
+    capabilities[IgorCLCapabilityPreferredVectorWidthInt] = device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT>();
+    capabilities[IgorCLCapabilityPreferredVectorWidthLong] = device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_LONG>();
+    capabilities[IgorCLCapabilityPreferredVectorWidthFloat] = device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT>();
+    capabilities[IgorCLCapabilityPreferredVectorWidthDouble] = device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE>();
+    capabilities[IgorCLCapabilityPreferredVectorWidthHalf] = device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_HALF>();
+    capabilities[IgorCLCapabilitySupportsDouble] = (device.getInfo<CL_DEVICE_EXTENSIONS>().find("cl_khr_fp64") != std::string::npos);
+    capabilities[IgorCLCapabilitySupportsImages] = (device.getInfo<CL_DEVICE_IMAGE_SUPPORT>() != CL_FALSE);
+    capabilities[IgorCLCapabilityImage2DMaxHeight] = device.getInfo<CL_DEVICE_IMAGE2D_MAX_HEIGHT>();
+    capabilities[IgorCLCapabilityImage2DMaxWidth] = device.getInfo<CL_DEVICE_IMAGE2D_MAX_WIDTH>();
+    capabilities[IgorCLCapabilityImage3DMaxDepth] = device.getInfo<CL_DEVICE_IMAGE3D_MAX_DEPTH>();
+    capabilities[IgorCLCapabilityImage3DMaxHeight] = device.getInfo<CL_DEVICE_IMAGE3D_MAX_HEIGHT>();
+    capabilities[IgorCLCapabilityImage3DMaxWidth] = device.getInfo<CL_DEVICE_IMAGE3D_MAX_WIDTH>();
+    
+    return description;
+}
+
+const char* DeviceCapabilityName(const IgorCLDeviceCapability capability) {
+    switch (capability) {
+        case IgorCLCapabilityType:
+            return "Type";
+        case IgorCLCapabilityAvailable:
+            return "Available";
+        case IgorCLCapabilityHostUnifiedMemory:
+            return "Host Unified Memory";
+        case IgorCLCapabilityGlobalMemSize:
+            return "Global Mem Size";
+        case IgorCLCapabilityGlobalMemCacheSize:
+            return "Global Mem Cache Size";
+        case IgorCLCapabilityMaxMemAllocSize:
+            return "Max Mem Alloc";
+        case IgorCLCapabilityLocalMemType:
+            return "Local Mem Type";
+        case IgorCLCapabilityLocalMemSize:
+            return "Local Mem Size";
+        case IgorCLCapabilityMaxConstantBufferSize:
+            return "Max Constant Buffer Size";
+        case IgorCLCapabilityMaxComputeUnits:
+            return "Max Compute Units";
+        case IgorCLCapabilityMaxClockFrequency:
+            return "Max Clock Frequency";
+        case IgorCLCapabilityMaxWorkItemSize0:
+            return "Max Work Item Size 0";
+        case IgorCLCapabilityMaxWorkItemSize1:
+            return "Max Work Item Size 1";
+        case IgorCLCapabilityMaxWorkItemSize2:
+            return "Max Work Item Size 2";
+        case IgorCLCapabilityMaxWorkGroupSize:
+            return "Max Work Group Size";
+        case IgorCLCapabilityPreferredVectorWidthChar:
+            return "Preferred Vector Width Char";
+        case IgorCLCapabilityPreferredVectorWidthShort:
+            return "Preferred Vector Width Short";
+        case IgorCLCapabilityPreferredVectorWidthInt:
+            return "Preferred Vector Width Int";
+        case IgorCLCapabilityPreferredVectorWidthLong:
+            return "Preferred Vector Width Long";
+        case IgorCLCapabilityPreferredVectorWidthFloat:
+            return "Preferred Vector Width Float";
+        case IgorCLCapabilityPreferredVectorWidthDouble:
+            return "Preferred Vector Width Double";
+        case IgorCLCapabilityPreferredVectorWidthHalf:
+            return "Preferred Vector Width Half";
+        case IgorCLCapabilitySupportsDouble:
+            return "Supports Double";
+        case IgorCLCapabilitySupportsImages:
+            return "Supports Images";
+        case IgorCLCapabilityImage2DMaxHeight:
+            return "Image2D Max Height";
+        case IgorCLCapabilityImage2DMaxWidth:
+            return "Image2D Max Width";
+        case IgorCLCapabilityImage3DMaxDepth:
+            return "Image3D Max Depth";
+        case IgorCLCapabilityImage3DMaxHeight:
+            return "Image3D Max Height";
+        case IgorCLCapabilityImage3DMaxWidth:
+            return "Image3D Max Width";
+        default:
+            return "Unknown";
+    }
+}
+
+void IgorCLDeviceTable::_enumerate() {
+    if (_isEnumerated.load(std::memory_order_acquire))
+        return;
+    
+    std::lock_guard<std::mutex> lock(_enumerationMutex);
+    if (_isEnumerated.load(std::memory_order_relaxed))
+        return;
+    
     cl_int status;
     std::vector<cl::Platform> platforms;
     status = cl::Platform::get(&platforms);
     if (status != CL_SUCCESS)
         throw IgorCLError(status);
-    if (platforms.size() <= platformIndex)
-        throw std::runtime_error("Invalid OpenCL platform index");
-    cl::Platform platform = platforms.at(platformIndex);
     
+    std::vector<std::vector<IgorCLDeviceDescription> > devices(platforms.size());
+    for (size_t i = 0; i < platforms.size(); ++i) {
+        std::vector<cl::Device> platformDevices;
+        status = platforms[i].getDevices(CL_DEVICE_TYPE_ALL, &platformDevices);
+        if (status != CL_SUCCESS)
+            throw IgorCLError(status);
+        for (size_t j = 0; j < platformDevices.size(); ++j) {
+            devices[i].push_back(DescribeDevice(platformDevices[j]));
+        }
+    }
+    
+    _platforms = platforms;
+    _devices = devices;
+    _isEnumerated.store(true, std::memory_order_release);
+}
+
+size_t IgorCLDeviceTable::nPlatforms() {
+    _enumerate();
+    return _platforms.size();
+}
+
+cl::Platform IgorCLDeviceTable::getPlatform(const int platformIndex) {
+    _enumerate();
+    if ((platformIndex < 0) || (_platforms.size() <= platformIndex))
+        throw std::runtime_error("Invalid OpenCL platform index");
+    return _platforms[platformIndex];
+}
+
+std::vector<cl::Device> IgorCLDeviceTable::getDevices(const int platformIndex) {
+    const std::vector<IgorCLDeviceDescription>& descriptions = getDeviceDescriptions(platformIndex);
     std::vector<cl::Device> devices;
-    status = platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
-    if (status != CL_SUCCESS)
-        throw IgorCLError(status);
-    for (int i = 0; i < devices.size(); ++i) {
-        cl_device_type thisDeviceType = devices.at(i).getInfo<CL_DEVICE_TYPE>();
-        if (thisDeviceType == deviceType)
-            return i;
+    devices.reserve(descriptions.size());
+    for (size_t i = 0; i < descriptions.size(); ++i) {
+        devices.push_back(descriptions[i].device);
+    }
+    return devices;
+}
+
+const std::vector<IgorCLDeviceDescription>& IgorCLDeviceTable::getDeviceDescriptions(const int platformIndex) {
+    _enumerate();
+    if ((platformIndex < 0) || (_devices.size() <= platformIndex))
+        throw std::runtime_error("Invalid OpenCL platform index");
+    return _devices[platformIndex];
+}
+
+IgorCLDeviceTable deviceTable;
+
+std::pair<int, int> IgorCLDeviceSelector::selectDevice(const std::string& selector) {
+    {
+        std::lock_guard<std::mutex> lock(_selectionMutex);
+        std::map<std::string, std::pair<int, int> >::const_iterator it = _selections.find(selector);
+        if (it != _selections.end())
+            return it->second;
     }
     
-    // still here? No matching device.
-    throw std::runtime_error("No device of requested type available");
+    // evaluated outside of the lock, two threads racing on a new selector reach the same result.
+    std::pair<int, int> selection = _evaluateSelector(selector);
+    
+    std::lock_guard<std::mutex> lock(_selectionMutex);
+    _selections[selector] = selection;
+    return selection;
+}
+
+std::pair<int, int> IgorCLDeviceSelector::_evaluateSelector(const std::string& selector) {
+    // parse the criteria
+    cl_device_type requiredType = 0;
+    std::vector<std::string> requiredNames;
+    bool requireDouble = false;
+    std::vector<IgorCLDeviceCapability> preferences;
+    std::stringstream ss(selector);
+    std::string criterion;
+    while (std::getline(ss, criterion, ';')) {
+        size_t first = criterion.find_first_not_of(" \t");
+        if (first == std::string::npos)
+            continue;
+        criterion = criterion.substr(first, criterion.find_last_not_of(" \t") - first + 1);
+        for (size_t i = 0; i < criterion.size(); ++i) {
+            criterion[i] = std::toupper(criterion[i]);
+        }
+        
+        if ((criterion == "CPU") || (criterion == "GPU") || (criterion == "ACCELERATOR")) {
+            cl_device_type type = CL_DEVICE_TYPE_ACCELERATOR;
+            if (criterion == "CPU") {
+                type = CL_DEVICE_TYPE_CPU;
+            } else if (criterion == "GPU") {
+                type = CL_DEVICE_TYPE_GPU;
+            }
+            // a device has a single type, so a second type could never match
+            if ((requiredType != 0) && (requiredType != type))
+                throw std::runtime_error("The device selector \"" + selector + "\" names more than one device type");
+            requiredType = type;
+        } else if (criterion.compare(0, 5, "NAME:") == 0) {
+            requiredNames.push_back(criterion.substr(5));
+        } else if (criterion == "FP64") {
+            requireDouble = true;
+        } else if (criterion == "MAXMEM") {
+            preferences.push_back(IgorCLCapabilityGlobalMemSize);
+        } else if (criterion == "MAXCU") {
+            preferences.push_back(IgorCLCapabilityMaxComputeUnits);
+        } else {
+            throw std::runtime_error("Unknown device selector criterion \"" + criterion + "\"");
+        }
+    }
+    
+    std::pair<int, int> selection(-1, -1);
+    const IgorCLDeviceDescription* selectedDevice = NULL;
+    for (size_t platformIndex = 0; platformIndex < deviceTable.nPlatforms(); ++platformIndex) {
+        const std::vector<IgorCLDeviceDescription>& devices = deviceTable.getDeviceDescriptions(platformIndex);
+        for (size_t deviceIndex = 0; deviceIndex < devices.size(); ++deviceIndex) {
+            const IgorCLDeviceDescription& device = devices[deviceIndex];
+            if ((requiredType != 0) && !(device.type & requiredType))
+                continue;
+            if (requireDouble && (device.capabilities[IgorCLCapabilitySupportsDouble] == 0))
+                continue;
+            std::string upperCaseName(device.name);
+            for (size_t i = 0; i < upperCaseName.size(); ++i) {
+                upperCaseName[i] = std::toupper(upperCaseName[i]);
+            }
+            bool nameMatches = true;
+            for (size_t i = 0; i < requiredNames.size(); ++i) {
+                if (upperCaseName.find(requiredNames[i]) == std::string::npos)
+                    nameMatches = false;
+            }
+            if (!nameMatches)
+                continue;
+            
+            // the earlier preferences take precedence, on a tie the first device is kept
+            bool isBetter = (selectedDevice == NULL);
+            for (size_t i = 0; (i < preferences.size()) && !isBetter; ++i) {
+                double thisValue = device.capabilities[preferences[i]];
+                double selectedValue = selectedDevice->capabilities[preferences[i]];
+                if (thisValue != selectedValue) {
+                    isBetter = (thisValue > selectedValue);
+                    break;
+                }
+            }
+            if (isBetter) {
+                selectedDevice = &device;
+                selection = std::pair<int, int>(platformIndex, deviceIndex);
+            }
+        }
+    }
+    
+    if (selectedDevice == NULL)
+        throw std::runtime_error("No device matches the device selector \"" + selector + "\"");
+    return selection;
 }
 
+IgorCLDeviceSelector deviceSelector;
+
 int ConvertIgorCLFlagsToOpenCLFlags(const int igorCLFlags) {
     int openCLFlags = 0;
     
@@ -166,6 +779,20 @@ int ConvertIgorCLFlagsToOpenCLFlags(const int igorCLFlags) {
     if ((igorCLFlags & IgorCLUsePinnedMemory) && (igorCLFlags & IgorCLUseHostPointer)) {
         throw int(INCOMPATIBLE_FLAGS);
     }
+    if ((igorCLFlags & IgorCLTransferAsSingle) && (igorCLFlags & IgorCLTransferAsHalf)) {
+        throw int(INCOMPATIBLE_FLAGS);
+    }
+    // converted data cannot alias the wave memory
+    if (RequiresTransferConversion(igorCLFlags) && (igorCLFlags & (IgorCLUseHostPointer | IgorCLIsLocalMemory))) {
+        throw int(INCOMPATIBLE_FLAGS);
+    }
+    if ((igorCLFlags & IgorCLFillOnDevice) && (igorCLFlags & (IgorCLUseHostPointer | IgorCLIsLocalMemory | IgorCLIsScalarArgument))) {
+        throw int(INCOMPATIBLE_FLAGS);
+    }
+    // resident buffers are never transferred
+    if ((igorCLFlags & IgorCLIsResidentBuffer) && (igorCLFlags & ~(IgorCLIsResidentBuffer | IgorCLReadWrite | IgorCLWriteOnly | IgorCLReadOnly))) {
+        throw int(INCOMPATIBLE_FLAGS);
+    }
     
     // convert all IgorCL flags for which there is an equivalent OpenCL flag.
     if (igorCLFlags & IgorCLReadWrite)
@@ -180,126 +807,1527 @@ int ConvertIgorCLFlagsToOpenCLFlags(const int igorCLFlags) {
     return openCLFlags;
 }
 
-void IgorCLContextAndDeviceProvider::getContextForPlatformAndDevice(const int platformIndex, const int deviceIndex, cl::Context& context, cl::Device &device) {
-    std::lock_guard<std::mutex> lock(this->contextMutex);
-    
-    // check if we already have a context for this combination.
-    std::pair<int, int> requestedIndices(platformIndex, deviceIndex);
-    for (int i = 0; i < availableContextIndices.size(); ++i) {
-        if (availableContextIndices[i] == requestedIndices) {
-            context = availableContexts.at(i);
-            device = deviceForContext.at(i);
-            return;
-        }
+static std::vector<cl_device_partition_property> ParsePartitionSpecification(const std::string& partitionSpecification) {
+    std::string upperCaseStr(partitionSpecification);
+    for (int i = 0; i < upperCaseStr.size(); ++i) {
+        upperCaseStr[i] = std::toupper(upperCaseStr[i]);
     }
     
-    // if we are still here then the context needs to be created.
-    // initialize the platforms
-    cl_int status;
-    std::vector<cl::Platform> platforms;
-    status = cl::Platform::get(&platforms);
-    if (status != CL_SUCCESS)
-        throw IgorCLError(status);
-    cl::Platform platform = platforms.at(platformIndex);
+    std::vector<cl_device_partition_property> properties;
+    if (upperCaseStr == "NUMA") {
+        properties.push_back(CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN);
+        properties.push_back(CL_DEVICE_AFFINITY_DOMAIN_NUMA);
+        properties.push_back(0);
+        return properties;
+    }
     
-    // fetch the device
-    std::vector<cl::Device> devices;
-    status = platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
-    if (status != CL_SUCCESS)
-        throw IgorCLError(status);
-    if (devices.size() <= deviceIndex)
-        throw IgorCLError(CL_DEVICE_NOT_FOUND);
-    device = devices.at(deviceIndex);
+    size_t separator = upperCaseStr.find(':');
+    if (separator == std::string::npos)
+        throw std::runtime_error("Invalid partition specification, expected EQUALLY:n, COUNTS:n1,n2,... or NUMA");
+    std::string partitionType = upperCaseStr.substr(0, separator);
+    std::vector<int> counts;
+    std::string countsStr = upperCaseStr.substr(separator + 1);
+    size_t start = 0;
+    while (start <= countsStr.size()) {
+        size_t end = countsStr.find(',', start);
+        if (end == std::string::npos)
+            end = countsStr.size();
+        int count = atoi(countsStr.substr(start, end - start).c_str());
+        if (count <= 0)
+            throw std::runtime_error("Invalid partition specification, the number of compute units must be positive");
+        counts.push_back(count);
+        start = end + 1;
+    }
     
-    // initialize the context
-    std::vector<cl::Device> deviceAsVector;
-    deviceAsVector.push_back(device);
-    context = cl::Context(deviceAsVector, NULL, NULL, NULL, &status);
-    if (status != CL_SUCCESS)
-        throw IgorCLError(status);
+    if ((partitionType == "EQUALLY") && (counts.size() == 1)) {
+        properties.push_back(CL_DEVICE_PARTITION_EQUALLY);
+        properties.push_back(counts[0]);
+    } else if (partitionType == "COUNTS") {
+        properties.push_back(CL_DEVICE_PARTITION_BY_COUNTS);
+        for (size_t i = 0; i < counts.size(); ++i) {
+            properties.push_back(counts[i]);
+        }
+        properties.push_back(CL_DEVICE_PARTITION_BY_COUNTS_LIST_END);
+    } else {
+        throw std::runtime_error("Invalid partition specification, expected EQUALLY:n, COUNTS:n1,n2,... or NUMA");
+    }
+    properties.push_back(0);
+    return properties;
+}
+
+std::vector<cl::Device> IgorCLDeviceFission::getDevices(const int platformIndex, const bool includeSubDevices) {
+    std::vector<cl::Device> devices = deviceTable.getDevices(platformIndex);
     
-    availableContextIndices.push_back(requestedIndices);
-    availableContexts.push_back(context);
-    deviceForContext.push_back(device);
+    if (!includeSubDevices || (_nPartitions.load() == 0))
+        return devices;
     
-    return;
+    std::lock_guard<std::mutex> lock(_partitionMutex);
+    for (size_t i = 0; i < _partitions.size(); ++i) {
+        if (_partitions[i].platformIndex == platformIndex)
+            devices.insert(devices.end(), _partitions[i].subDevices.begin(), _partitions[i].subDevices.end());
+    }
+    return devices;
 }
 
-IgorCLContextAndDeviceProvider contextAndDeviceProvider;
-
-cl::CommandQueue IgorCLCommandQueueFactory::getCommandQueue(const int platformIndex, const int deviceIndex) {
-    std::lock_guard<std::mutex> lock(this->_queueMutex);
+int IgorCLDeviceFission::partitionDevice(const int platformIndex, const int deviceIndex, const std::string& partitionSpecification, int& nSubDevices) {
+    std::vector<cl_device_partition_property> properties = ParsePartitionSpecification(partitionSpecification);
+    std::vector<cl::Device> physicalDevices = getDevices(platformIndex, false);
+    if (physicalDevices.size() <= deviceIndex)
+        throw IgorCLError(CL_DEVICE_NOT_FOUND);
     
-    // do we have a queue available?
-    bool haveCacheForMatchingQueues = false;
-    std::pair<int, int> requestedIndices(platformIndex, deviceIndex);
-    for (int i = 0; i < _availableQueueIndices.size(); ++i) {
-        if (_availableQueueIndices[i] == requestedIndices) {
-            haveCacheForMatchingQueues = true;
-            std::vector<cl::CommandQueue>* matchingQueues = &_availableQueues.at(i);
-            int nMatchingQueues = matchingQueues->size();
-            if (nMatchingQueues > 0) {
-                cl::CommandQueue theQueue = matchingQueues->at(nMatchingQueues - 1);
-                matchingQueues->erase(matchingQueues->end() - 1);
-                return theQueue;
-            }
-        }
+    std::lock_guard<std::mutex> lock(_partitionMutex);
+    
+    int firstSubDeviceIndex = physicalDevices.size();
+    for (size_t i = 0; i < _partitions.size(); ++i) {
+        if (_partitions[i].platformIndex != platformIndex)
+            continue;
+        if (_partitions[i].parentDeviceIndex == deviceIndex)
+            throw std::runtime_error("This device has already been partitioned");
+        firstSubDeviceIndex += _partitions[i].subDevices.size();
     }
     
-    // if we're still here then we need to add a new queue and return that.
-    cl::Context context;
-    cl::Device device;
-    contextAndDeviceProvider.getContextForPlatformAndDevice(platformIndex, deviceIndex, context, device);
-    cl_int status;
-    cl::CommandQueue commandQueue(context, device, 0, &status);
+    Partition partition;
+    partition.platformIndex = platformIndex;
+    partition.parentDeviceIndex = deviceIndex;
+    partition.firstSubDeviceIndex = firstSubDeviceIndex;
+    partition.nThreadsAssigned = 0;
+    cl_int status = physicalDevices.at(deviceIndex).createSubDevices(&properties[0], &partition.subDevices);
     if (status != CL_SUCCESS)
         throw IgorCLError(status);
+    if (partition.subDevices.empty())
+        throw IgorCLError(CL_DEVICE_PARTITION_FAILED);
     
-    if (!haveCacheForMatchingQueues) {
-        // add storage for this platform/device combination,
-        // but do not store the queue itself since it is in use and therefore unavailable.
-        _availableQueueIndices.push_back(requestedIndices);
-        _availableQueues.push_back(std::vector<cl::CommandQueue>());
-    }
+    _partitions.push_back(partition);
+    _nPartitions.store(_partitions.size());
     
-    return commandQueue;
+    nSubDevices = partition.subDevices.size();
+    return firstSubDeviceIndex;
 }
 
-void IgorCLCommandQueueFactory::returnCommandQueue(const cl::CommandQueue commandQueue, const int platformIndex, const int deviceIndex) {
-    std::lock_guard<std::mutex> lock(this->_queueMutex);
+// assignments made by a thread, remembered along with the number of partitions at that time.
+struct IgorCLThreadDeviceAssignment {
+    std::pair<int, int> requestedIndices;
+    int assignedDeviceIndex;
+    int nPartitions;
+};
+
+static IgorCLThreadLocal<std::vector<IgorCLThreadDeviceAssignment> > threadDeviceAssignments;
+
+int IgorCLDeviceFission::deviceIndexForThread(const int platformIndex, const int deviceIndex) {
+    int nPartitions = _nPartitions.load();
+    if ((nPartitions == 0) || !_routeThreadsToPartitions.load())
+        return deviceIndex;
     
+    std::vector<IgorCLThreadDeviceAssignment>& threadAssignments = threadDeviceAssignments.get();
     std::pair<int, int> requestedIndices(platformIndex, deviceIndex);
-    for (int i = 0; i < _availableQueueIndices.size(); ++i) {
-        if (_availableQueueIndices[i] == requestedIndices) {
-            std::vector<cl::CommandQueue>* matchingQueues = &_availableQueues.at(i);
-            matchingQueues->push_back(commandQueue);
-            return;
+    for (size_t i = 0; i < threadAssignments.size(); ++i) {
+        if (threadAssignments[i].requestedIndices == requestedIndices) {
+            if (threadAssignments[i].nPartitions == nPartitions)
+                return threadAssignments[i].assignedDeviceIndex;
+            threadAssignments.erase(threadAssignments.begin() + i);
+            break;
         }
     }
     
-    // still here? Shouldn't happen.
-    throw std::logic_error("Returning command queue but no matching storage");
+    IgorCLThreadDeviceAssignment assignment;
+    assignment.requestedIndices = requestedIndices;
+    assignment.assignedDeviceIndex = deviceIndex;
+    assignment.nPartitions = nPartitions;
+    {
+        std::lock_guard<std::mutex> lock(_partitionMutex);
+        for (size_t i = 0; i < _partitions.size(); ++i) {
+            Partition& partition = _partitions[i];
+            if ((partition.platformIndex == platformIndex) && (partition.parentDeviceIndex == deviceIndex)) {
+                assignment.assignedDeviceIndex = partition.firstSubDeviceIndex + (partition.nThreadsAssigned % partition.subDevices.size());
+                partition.nThreadsAssigned += 1;
+                break;
+            }
+        }
+    }
+    threadAssignments.push_back(assignment);
+    return assignment.assignedDeviceIndex;
 }
 
-void IgorCLCommandQueueFactory::deleteAllCommandQueues() {
-    std::lock_guard<std::mutex> lock(_queueMutex);
-    
-    _availableQueueIndices.clear();
-    _availableQueues.clear();
-    
-}
+IgorCLDeviceFission deviceFission;
 
-IgorCLCommandQueueFactory commandQueueFactory;
+bool IgorCLContextAndDeviceProvider::findPublishedContext(const std::pair<int, int>& requestedIndices, const bool isShared, cl::Context& context, cl::Device &device) const {
+    int nContexts = nPublishedContexts.load(std::memory_order_acquire);
+    for (int i = 0; i < nContexts; ++i) {
+        if ((publishedContextIndices[i] == requestedIndices) && (publishedContextIsShared[i] == isShared)) {
+            context = publishedContexts[i];
+            device = publishedDevices[i];
+            return true;
+        }
+    }
+    return false;
+}
 
-IgorCLCommandQueueProvider::IgorCLCommandQueueProvider(const int platformIndex, const int deviceIndex) :
-    _platformIndex(platformIndex),
-    _deviceIndex(deviceIndex)
-{
-    _commandQueue = commandQueueFactory.getCommandQueue(platformIndex, deviceIndex);
+bool IgorCLContextAndDeviceProvider::findSharedContextForPlatform(const int platformIndex, cl::Context& context) const {
+    // contextMutex must be held by the caller.
+    int nContexts = nPublishedContexts.load(std::memory_order_acquire);
+    for (int i = 0; i < nContexts; ++i) {
+        if ((publishedContextIndices[i].first == platformIndex) && publishedContextSpansPlatform[i]) {
+            context = publishedContexts[i];
+            return true;
+        }
+    }
+    for (int i = 0; i < availableContextIndices.size(); ++i) {
+        if ((availableContextIndices[i].first == platformIndex) && availableContextSpansPlatform[i]) {
+            context = availableContexts.at(i);
+            return true;
+        }
+    }
+    return false;
 }
 
-IgorCLCommandQueueProvider::~IgorCLCommandQueueProvider() {
-    commandQueueFactory.returnCommandQueue(_commandQueue, _platformIndex, _deviceIndex);
+void IgorCLContextAndDeviceProvider::getContextForPlatformAndDevice(const int platformIndex, const int deviceIndex, cl::Context& context, cl::Device &device) {
+    // fast path: no locking for contexts that have already been created.
+    std::pair<int, int> requestedIndices(platformIndex, deviceIndex);
+    bool isShared = executionSettings.useSharedContexts();
+    if (findPublishedContext(requestedIndices, isShared, context, device))
+        return;
+    
+    std::lock_guard<std::mutex> lock(this->contextMutex);
+    
+    // check if we already have a context for this combination.
+    // another thread may have published it while we were waiting for the lock.
+    if (findPublishedContext(requestedIndices, isShared, context, device))
+        return;
+    for (int i = 0; i < availableContextIndices.size(); ++i) {
+        if ((availableContextIndices[i] == requestedIndices) && (availableContextIsShared[i] == isShared)) {
+            context = availableContexts.at(i);
+            device = deviceForContext.at(i);
+            return;
+        }
+    }
+    
+    // if we are still here then the context needs to be created.
+    // fetch the device, sub-devices follow the physical devices.
+    cl_int status;
+    std::vector<cl::Device> devices = deviceFission.getDevices(platformIndex, true);
+    if (devices.size() <= deviceIndex)
+        throw IgorCLError(CL_DEVICE_NOT_FOUND);
+    device = devices.at(deviceIndex);
+    std::vector<cl::Device> physicalDevices = deviceFission.getDevices(platformIndex, false);
+    bool spansPlatform = isShared && (deviceIndex < physicalDevices.size());
+    
+    // initialize the context. A shared context is created once per platform, for all of its physical devices.
+    if (!spansPlatform) {
+        std::vector<cl::Device> deviceAsVector;
+        deviceAsVector.push_back(device);
+        context = cl::Context(deviceAsVector, NULL, NULL, NULL, &status);
+        if (status != CL_SUCCESS)
+            throw IgorCLError(status);
+    } else if (!findSharedContextForPlatform(platformIndex, context)) {
+        context = cl::Context(physicalDevices, NULL, NULL, NULL, &status);
+        if (status != CL_SUCCESS)
+            throw IgorCLError(status);
+    }
+    
+    publishContext(requestedIndices, isShared, spansPlatform, context, device);
+}
+
+void IgorCLContextAndDeviceProvider::publishContext(const std::pair<int, int>& indices, const bool isShared, const bool spansPlatform, const cl::Context& context, const cl::Device& device) {
+    // contextMutex must be held by the caller.
+    // only writers modify nPublishedContexts, and they hold contextMutex
+    int nContexts = nPublishedContexts.load(std::memory_order_relaxed);
+    if (nContexts < kMaxPublishedContexts) {
+        publishedContextIndices[nContexts] = indices;
+        publishedContextIsShared[nContexts] = isShared;
+        publishedContextSpansPlatform[nContexts] = spansPlatform;
+        publishedContexts[nContexts] = context;
+        publishedDevices[nContexts] = device;
+        nPublishedContexts.store(nContexts + 1, std::memory_order_release);
+    } else {
+        availableContextIndices.push_back(indices);
+        availableContextIsShared.push_back(isShared);
+        availableContextSpansPlatform.push_back(spansPlatform);
+        availableContexts.push_back(context);
+        deviceForContext.push_back(device);
+    }
+}
+
+IgorCLContextAndDeviceProvider contextAndDeviceProvider;
+
+// the number of leases held by this thread
+static IgorCLThreadLocal<int> contextModeLeaseDepth;
+
+void IgorCLExecutionSettings::acquireContextModeLease() {
+    int& leaseDepth = contextModeLeaseDepth.get();
+    if (leaseDepth > 0) {
+        // nested, the mode cannot change while the outer lease is held.
+        leaseDepth += 1;
+        return;
+    }
+    
+    for ( ; ; ) {
+        // sequentially consistent, so that either we see the change in progress or changeContextMode() sees this lease.
+        _nContextModeLeases.fetch_add(1);
+        if (!_isChangingContextMode.load())
+            break;
+        
+        // back off until the change is done
+        std::unique_lock<std::mutex> lock(_contextModeMutex);
+        _nContextModeLeases.fetch_sub(1);
+        _contextModeCondition.notify_all();
+        while (_isChangingContextMode.load())
+            _contextModeCondition.wait(lock);
+    }
+    leaseDepth = 1;
+}
+
+void IgorCLExecutionSettings::releaseContextModeLease() {
+    int& leaseDepth = contextModeLeaseDepth.get();
+    leaseDepth -= 1;
+    if (leaseDepth > 0)
+        return;
+    
+    if ((_nContextModeLeases.fetch_sub(1) == 1) && _isChangingContextMode.load()) {
+        std::lock_guard<std::mutex> lock(_contextModeMutex);
+        _contextModeCondition.notify_all();
+    }
+}
+
+void IgorCLExecutionSettings::changeContextMode(const bool useSharedContexts) {
+    {
+        std::unique_lock<std::mutex> lock(_contextModeMutex);
+        while (_isChangingContextMode.load())
+            _contextModeCondition.wait(lock);
+        if (useSharedContexts == _useSharedContexts.load())
+            return;
+        
+        // hold off new calls and wait for the ones in progress, which may still use queues of the current mode.
+        _isChangingContextMode.store(true);
+        while (_nContextModeLeases.load() > 0)
+            _contextModeCondition.wait(lock);
+        _useSharedContexts.store(useSharedContexts);
+    }
+    
+    // queues belong to the context of the previous mode. Programs are cached per context and need no reset.
+    try {
+        submissionThreads.stopAll();
+        commandQueueFactory.deleteAllCommandQueues();
+    }
+    catch (...) {
+        std::lock_guard<std::mutex> lock(_contextModeMutex);
+        _isChangingContextMode.store(false);
+        _contextModeCondition.notify_all();
+        throw;
+    }
+    
+    std::lock_guard<std::mutex> lock(_contextModeMutex);
+    _isChangingContextMode.store(false);
+    _contextModeCondition.notify_all();
+}
+
+IgorCLExecutionSettings executionSettings;
+
+IgorCLStatisticsCounters::IgorCLStatisticsCounters() {
+    for (int i = 0; i < IgorCLNCounters; ++i) {
+        _counters[i].store(0);
+    }
+    for (int i = 0; i < IgorCLNPhases; ++i) {
+        _phaseNanoseconds[i].store(0);
+    }
+    for (int i = 0; i < kMaxPlatforms; ++i) {
+        for (int j = 0; j < kMaxDevicesPerPlatform; ++j) {
+            _deviceBytesUploaded[i][j].store(0);
+            _deviceBytesDownloaded[i][j].store(0);
+        }
+    }
+}
+
+void IgorCLStatisticsCounters::addTransferredBytes(const int platformIndex, const int deviceIndex, const unsigned long long bytesUploaded, const unsigned long long bytesDownloaded) {
+    increment(IgorCLCounterBytesUploaded, bytesUploaded);
+    increment(IgorCLCounterBytesDownloaded, bytesDownloaded);
+    if ((platformIndex < 0) || (platformIndex >= kMaxPlatforms) || (deviceIndex < 0) || (deviceIndex >= kMaxDevicesPerPlatform))
+        return;
+    _deviceBytesUploaded[platformIndex][deviceIndex].fetch_add(bytesUploaded, std::memory_order_relaxed);
+    _deviceBytesDownloaded[platformIndex][deviceIndex].fetch_add(bytesDownloaded, std::memory_order_relaxed);
+}
+
+static double ReadCounter(std::atomic<unsigned long long>& counter, const bool reset) {
+    return static_cast<double>(reset ? counter.exchange(0, std::memory_order_relaxed) : counter.load(std::memory_order_relaxed));
+}
+
+void IgorCLStatisticsCounters::getCounters(std::vector<double>& counters, std::vector<double>& phaseTimes, const bool reset) {
+    counters.resize(IgorCLNCounters);
+    for (int i = 0; i < IgorCLNCounters; ++i) {
+        counters[i] = ReadCounter(_counters[i], reset);
+    }
+    phaseTimes.resize(IgorCLNPhases);
+    for (int i = 0; i < IgorCLNPhases; ++i) {
+        phaseTimes[i] = ReadCounter(_phaseNanoseconds[i], reset) * 1e-9;
+    }
+}
+
+std::vector<std::vector<double> > IgorCLStatisticsCounters::getDeviceBytes(const bool reset) {
+    std::vector<std::vector<double> > deviceBytes;
+    for (int i = 0; i < kMaxPlatforms; ++i) {
+        for (int j = 0; j < kMaxDevicesPerPlatform; ++j) {
+            double bytesUploaded = ReadCounter(_deviceBytesUploaded[i][j], reset);
+            double bytesDownloaded = ReadCounter(_deviceBytesDownloaded[i][j], reset);
+            if ((bytesUploaded == 0) && (bytesDownloaded == 0))
+                continue;
+            std::vector<double> row;
+            row.push_back(i);
+            row.push_back(j);
+            row.push_back(bytesUploaded);
+            row.push_back(bytesDownloaded);
+            deviceBytes.push_back(row);
+        }
+    }
+    return deviceBytes;
+}
+
+const char* IgorCLStatisticsCounters::counterName(const IgorCLCounter counter) {
+    switch (counter) {
+        case IgorCLCounterCalculations: return "Calculations";
+        case IgorCLCounterCompiles: return "Compiles";
+        case IgorCLCounterProgramCacheHits: return "Program Cache Hits";
+        case IgorCLCounterProgramCacheMisses: return "Program Cache Misses";
+        case IgorCLCounterBuffersAllocated: return "Buffers Allocated";
+        case IgorCLCounterKernelLaunches: return "Kernel Launches";
+        case IgorCLCounterQueuesCreated: return "Queues Created";
+        case IgorCLCounterBytesUploaded: return "Bytes Uploaded";
+        case IgorCLCounterBytesDownloaded: return "Bytes Downloaded";
+        default: return "Unknown";
+    }
+}
+
+const char* IgorCLStatisticsCounters::phaseName(const IgorCLPhase phase) {
+    switch (phase) {
+        case IgorCLPhasePrepare: return "Prepare Time";
+        case IgorCLPhaseBuild: return "Build Time";
+        case IgorCLPhaseExecute: return "Execute Time";
+        case IgorCLPhaseConvert: return "Convert Time";
+        default: return "Unknown";
+    }
+}
+
+IgorCLStatisticsCounters statisticsCounters;
+
+IgorCLCommandQueueFactory::DeviceQueues& IgorCLCommandQueueFactory::_queuesForDevice(const int platformIndex, const int deviceIndex) {
+    // _queueMutex must be held by the caller.
+    std::pair<int, int> requestedIndices(platformIndex, deviceIndex);
+    for (size_t i = 0; i < _deviceQueues.size(); ++i) {
+        if (_deviceQueues[i].indices == requestedIndices)
+            return _deviceQueues[i];
+    }
+    
+    DeviceQueues deviceQueues;
+    deviceQueues.indices = requestedIndices;
+    deviceQueues.nextSharedQueue = 0;
+    deviceQueues.statistics.platformIndex = platformIndex;
+    deviceQueues.statistics.deviceIndex = deviceIndex;
+    deviceQueues.statistics.nQueues = 0;
+    deviceQueues.statistics.nAcquisitions = 0;
+    deviceQueues.statistics.nWaits = 0;
+    deviceQueues.statistics.totalWaitTime = 0;
+    deviceQueues.statistics.maxWaitTime = 0;
+    _deviceQueues.push_back(deviceQueues);
+    return _deviceQueues.back();
+}
+
+cl::CommandQueue IgorCLCommandQueueFactory::_createCommandQueue(DeviceQueues& deviceQueues) {
+    // _queueMutex must be held by the caller.
+    cl::Context context;
+    cl::Device device;
+    contextAndDeviceProvider.getContextForPlatformAndDevice(deviceQueues.indices.first, deviceQueues.indices.second, context, device);
+    cl_int status;
+    cl::CommandQueue commandQueue(context, device, 0, &status);
+    if (status != CL_SUCCESS)
+        throw IgorCLError(status);
+    statisticsCounters.increment(IgorCLCounterQueuesCreated);
+    
+    deviceQueues.allQueues.push_back(commandQueue);
+    deviceQueues.statistics.nQueues = deviceQueues.allQueues.size();
+    return commandQueue;
+}
+
+cl::CommandQueue IgorCLCommandQueueFactory::getCommandQueue(const int platformIndex, const int deviceIndex, unsigned int* generation) {
+    std::unique_lock<std::mutex> lock(this->_queueMutex);
+    
+    bool haveWaited = false;
+    std::chrono::steady_clock::time_point waitStart;
+    
+    for ( ; ; ) {
+        // look up the storage on every iteration since deleteAllCommandQueues() may have run while we were waiting.
+        DeviceQueues& deviceQueues = _queuesForDevice(platformIndex, deviceIndex);
+        
+        bool haveQueue = false;
+        cl::CommandQueue commandQueue;
+        if (!deviceQueues.availableQueues.empty()) {
+            // the least recently returned queue, so that the queues are used in turn.
+            commandQueue = deviceQueues.availableQueues.front();
+            deviceQueues.availableQueues.pop_front();
+            haveQueue = true;
+        } else {
+            int maxQueuesPerDevice = executionSettings.maxQueuesPerDevice();
+            if ((maxQueuesPerDevice <= 0) || (deviceQueues.allQueues.size() < static_cast<size_t>(maxQueuesPerDevice))) {
+                commandQueue = _createCommandQueue(deviceQueues);
+                haveQueue = true;
+            }
+        }
+        
+        if (haveQueue) {
+            IgorCLQueueStatistics& statistics = deviceQueues.statistics;
+            statistics.nAcquisitions += 1;
+            if (haveWaited) {
+                double waitTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count();
+                statistics.nWaits += 1;
+                statistics.totalWaitTime += waitTime;
+                if (waitTime > statistics.maxWaitTime)
+                    statistics.maxWaitTime = waitTime;
+            }
+            if (generation != NULL)
+                *generation = _generation.load(std::memory_order_relaxed);
+            return commandQueue;
+        }
+        
+        // all queues for this device are in use, wait until one is returned.
+        if (!haveWaited) {
+            haveWaited = true;
+            waitStart = std::chrono::steady_clock::now();
+        }
+        _queueReturned.wait(lock);
+    }
+}
+
+void IgorCLCommandQueueFactory::returnCommandQueue(const cl::CommandQueue commandQueue, const int platformIndex, const int deviceIndex, const unsigned int generation) {
+    {
+        std::lock_guard<std::mutex> lock(this->_queueMutex);
+        
+        // the queue was acquired before deleteAllCommandQueues(), it may belong to a context that is no longer used.
+        if (generation != _generation.load(std::memory_order_relaxed))
+            return;
+        
+        std::pair<int, int> requestedIndices(platformIndex, deviceIndex);
+        bool haveMatchingStorage = false;
+        for (size_t i = 0; i < _deviceQueues.size(); ++i) {
+            if (_deviceQueues[i].indices != requestedIndices)
+                continue;
+            haveMatchingStorage = true;
+            DeviceQueues& deviceQueues = _deviceQueues[i];
+            
+            // if the limit was lowered while this queue was in use then drop it instead.
+            int maxQueuesPerDevice = executionSettings.maxQueuesPerDevice();
+            if ((maxQueuesPerDevice > 0) && (deviceQueues.allQueues.size() > static_cast<size_t>(maxQueuesPerDevice))) {
+                for (size_t j = 0; j < deviceQueues.allQueues.size(); ++j) {
+                    if (deviceQueues.allQueues[j]() == commandQueue()) {
+                        deviceQueues.allQueues.erase(deviceQueues.allQueues.begin() + j);
+                        break;
+                    }
+                }
+                deviceQueues.statistics.nQueues = deviceQueues.allQueues.size();
+            } else {
+                deviceQueues.availableQueues.push_back(commandQueue);
+            }
+            break;
+        }
+        
+        if (!haveMatchingStorage) {
+            // still here? Shouldn't happen.
+            throw std::logic_error("Returning command queue but no matching storage");
+        }
+    }
+    
+    // waiters may be waiting on any device, so wake all of them.
+    _queueReturned.notify_all();
+}
+
+cl::CommandQueue IgorCLCommandQueueFactory::getSharedCommandQueue(const int platformIndex, const int deviceIndex, unsigned int* generation) {
+    std::lock_guard<std::mutex> lock(this->_queueMutex);
+    
+    if (generation != NULL)
+        *generation = _generation.load(std::memory_order_relaxed);
+    
+    DeviceQueues& deviceQueues = _queuesForDevice(platformIndex, deviceIndex);
+    deviceQueues.statistics.nAcquisitions += 1;
+    int maxQueuesPerDevice = executionSettings.maxQueuesPerDevice();
+    if ((maxQueuesPerDevice <= 0) || (deviceQueues.allQueues.size() < static_cast<size_t>(maxQueuesPerDevice))) {
+        // a new queue that is shared from the start, so it is also available to getCommandQueue().
+        cl::CommandQueue commandQueue = _createCommandQueue(deviceQueues);
+        deviceQueues.availableQueues.push_back(commandQueue);
+        return commandQueue;
+    }
+    
+    cl::CommandQueue commandQueue = deviceQueues.allQueues.at(deviceQueues.nextSharedQueue % deviceQueues.allQueues.size());
+    deviceQueues.nextSharedQueue += 1;
+    return commandQueue;
+}
+
+void IgorCLCommandQueueFactory::deleteAllCommandQueues() {
+    {
+        std::lock_guard<std::mutex> lock(_queueMutex);
+        
+        _deviceQueues.clear();
+        
+        _generation.fetch_add(1, std::memory_order_release);
+    }
+    
+    _queueReturned.notify_all();
+}
+
+std::vector<IgorCLQueueStatistics> IgorCLCommandQueueFactory::getQueueStatistics() {
+    std::lock_guard<std::mutex> lock(_queueMutex);
+    
+    std::vector<IgorCLQueueStatistics> statistics;
+    for (size_t i = 0; i < _deviceQueues.size(); ++i) {
+        statistics.push_back(_deviceQueues[i].statistics);
+    }
+    return statistics;
+}
+
+IgorCLCommandQueueFactory commandQueueFactory;
+
+IgorCLThreadLocalQueueCache::~IgorCLThreadLocalQueueCache() {
+    // the thread is exiting, make its queues available to other threads.
+    try {
+        for (size_t i = 0; i < _queues.size(); ++i) {
+            if (_isShared[i])
+                continue;
+            commandQueueFactory.returnCommandQueue(_queues[i], _queueIndices[i].first, _queueIndices[i].second, _queueGenerations[i]);
+        }
+    }
+    catch (...) {
+        // the queues will simply be released.
+    }
+}
+
+bool IgorCLThreadLocalQueueCache::getCommandQueue(const int platformIndex, const int deviceIndex, cl::CommandQueue& commandQueue) {
+    unsigned int factoryGeneration = commandQueueFactory.generation();
+    std::pair<int, int> requestedIndices(platformIndex, deviceIndex);
+    for (size_t i = 0; i < _queueIndices.size(); ++i) {
+        if (_queueIndices[i] != requestedIndices)
+            continue;
+        if (_queueGenerations[i] == factoryGeneration) {
+            commandQueue = _queues[i];
+            return true;
+        }
+        // stale, drop it
+        _queueIndices.erase(_queueIndices.begin() + i);
+        _queues.erase(_queues.begin() + i);
+        _isShared.erase(_isShared.begin() + i);
+        _queueGenerations.erase(_queueGenerations.begin() + i);
+        return false;
+    }
+    return false;
+}
+
+void IgorCLThreadLocalQueueCache::storeCommandQueue(const cl::CommandQueue commandQueue, const int platformIndex, const int deviceIndex, const bool isShared, const unsigned int generation) {
+    _queueIndices.push_back(std::pair<int, int>(platformIndex, deviceIndex));
+    _queues.push_back(commandQueue);
+    _isShared.push_back(isShared);
+    _queueGenerations.push_back(generation);
+}
+
+static IgorCLThreadLocal<IgorCLThreadLocalQueueCache> threadLocalQueueCache;
+
+IgorCLCommandQueueProvider::IgorCLCommandQueueProvider(const int platformIndex, const int deviceIndex) :
+    _platformIndex(platformIndex),
+    _deviceIndex(deviceIndex),
+    _isThreadLocal(executionSettings.useThreadLocalQueues()),
+    _generation(0)
+{
+    if (_isThreadLocal) {
+        IgorCLThreadLocalQueueCache& queueCache = threadLocalQueueCache.get();
+        if (queueCache.getCommandQueue(platformIndex, deviceIndex, _commandQueue))
+            return;
+        // first use of this device on this thread: the queue stays with the thread.
+        // If the number of queues is limited then the thread cannot have a queue of its own.
+        bool isShared = (executionSettings.maxQueuesPerDevice() > 0);
+        if (isShared) {
+            _commandQueue = commandQueueFactory.getSharedCommandQueue(platformIndex, deviceIndex, &_generation);
+        } else {
+            _commandQueue = commandQueueFactory.getCommandQueue(platformIndex, deviceIndex, &_generation);
+        }
+        queueCache.storeCommandQueue(_commandQueue, platformIndex, deviceIndex, isShared, _generation);
+        return;
+    }
+    
+    _commandQueue = commandQueueFactory.getCommandQueue(platformIndex, deviceIndex, &_generation);
+}
+
+IgorCLCommandQueueProvider::~IgorCLCommandQueueProvider() {
+    if (_isThreadLocal)
+        return;
+    commandQueueFactory.returnCommandQueue(_commandQueue, _platformIndex, _deviceIndex, _generation);
+}
+
+IgorCLSubmissionThread::IgorCLSubmissionThread(const int platformIndex, const int deviceIndex) :
+    _platformIndex(platformIndex),
+    _deviceIndex(deviceIndex),
+    _pendingRequests(NULL),
+    _stopRequested(false),
+    _nSubmitting(0)
+{
+    _thread = std::thread(&IgorCLSubmissionThread::_run, this);
+}
+
+IgorCLSubmissionThread::~IgorCLSubmissionThread() {
+    stop();
+}
+
+void IgorCLSubmissionThread::submit(const std::function<void(cl::CommandQueue&)>& enqueueWork) {
+    std::unique_ptr<Request> request(new Request);
+    request->enqueueWork = enqueueWork;
+    std::future<void> completion = request->completion.get_future();
+    
+    // announce the push before checking for stop(), which waits for _nSubmitting to drop to zero after setting
+    // _stopRequested. Either stop() sees this submitter and waits, or this submitter sees the stop request.
+    _nSubmitting.fetch_add(1);
+    if (_stopRequested.load()) {
+        _nSubmitting.fetch_sub(1);
+        throw IgorCLError(CL_INVALID_COMMAND_QUEUE);
+    }
+    
+    // lock-free push
+    Request* head = _pendingRequests.load(std::memory_order_relaxed);
+    do {
+        request->next = head;
+    } while (!_pendingRequests.compare_exchange_weak(head, request.get(), std::memory_order_release, std::memory_order_relaxed));
+    request.release();
+    
+    // only wake the thread if the list was empty, otherwise it will pick this request up with the others.
+    // Taking the mutex guarantees that the wakeup cannot get lost between its check and its wait.
+    if (head == NULL) {
+        std::lock_guard<std::mutex> lock(_wakeMutex);
+        _wakeCondition.notify_one();
+    }
+    _nSubmitting.fetch_sub(1);
+    
+    completion.get();
+}
+
+IgorCLSubmissionThread::Request* IgorCLSubmissionThread::_takePendingRequests() {
+    Request* requests = _pendingRequests.exchange(NULL, std::memory_order_acquire);
+    
+    // the list holds the most recent request first, reverse it to get submission order.
+    Request* inOrder = NULL;
+    while (requests != NULL) {
+        Request* next = requests->next;
+        requests->next = inOrder;
+        inOrder = requests;
+        requests = next;
+    }
+    return inOrder;
+}
+
+void IgorCLSubmissionThread::_run() {
+    cl::CommandQueue commandQueue;
+    bool haveQueue = false;
+    unsigned int queueGeneration = 0;
+    
+    for ( ; ; ) {
+        {
+            std::unique_lock<std::mutex> lock(_wakeMutex);
+            while ((_pendingRequests.load(std::memory_order_acquire) == NULL) && !_stopRequested.load())
+                _wakeCondition.wait(lock);
+        }
+        
+        Request* requests = _takePendingRequests();
+        if (requests == NULL)
+            break;      // stop requested and nothing left to do
+        
+        // enqueue the whole batch. Errors are only reported after finish(), since work that was already enqueued
+        // for a failed request may still write into the memory of its caller.
+        std::vector<std::pair<Request*, std::exception_ptr> > batch;
+        std::exception_ptr queueError;
+        try {
+            if (!haveQueue) {
+                commandQueue = commandQueueFactory.getCommandQueue(_platformIndex, _deviceIndex, &queueGeneration);
+                haveQueue = true;
+            }
+        }
+        catch (...) {
+            queueError = std::current_exception();
+        }
+        
+        for (Request* request = requests; request != NULL; request = request->next) {
+            std::exception_ptr requestError = queueError;
+            if (!queueError) {
+                try {
+                    request->enqueueWork(commandQueue);
+                }
+                catch (...) {
+                    requestError = std::current_exception();
+                }
+            }
+            batch.push_back(std::pair<Request*, std::exception_ptr>(request, requestError));
+        }
+        
+        cl_int status = CL_SUCCESS;
+        if (haveQueue)
+            status = commandQueue.finish();
+        
+        for (size_t i = 0; i < batch.size(); ++i) {
+            Request* request = batch[i].first;
+            if (batch[i].second) {
+                request->completion.set_exception(batch[i].second);
+            } else if (status != CL_SUCCESS) {
+                request->completion.set_exception(std::make_exception_ptr(IgorCLError(status)));
+            } else {
+                request->completion.set_value();
+            }
+            delete request;
+        }
+    }
+    
+    if (haveQueue) {
+        try {
+            commandQueueFactory.returnCommandQueue(commandQueue, _platformIndex, _deviceIndex, queueGeneration);
+        }
+        catch (...) {
+            // the queue will simply be released.
+        }
+    }
+}
+
+void IgorCLSubmissionThread::stop() {
+    if (!_thread.joinable())
+        return;
+    
+    _stopRequested.store(true);
+    // submitters that got past the check before the store finish their push. Their critical section is short
+    // and never blocks on the thread, so spinning is fine here.
+    while (_nSubmitting.load() != 0)
+        std::this_thread::yield();
+    {
+        std::lock_guard<std::mutex> lock(_wakeMutex);
+        _wakeCondition.notify_one();
+    }
+    _thread.join();
+    
+    // nothing can be pushed any more. The thread only exits once the list is empty, fail anything that is left
+    // all the same, so that no caller can be left waiting.
+    Request* requests = _takePendingRequests();
+    while (requests != NULL) {
+        Request* next = requests->next;
+        requests->completion.set_exception(std::make_exception_ptr(IgorCLError(CL_INVALID_COMMAND_QUEUE)));
+        delete requests;
+        requests = next;
+    }
+}
+
+void IgorCLSubmissionThreadPool::submit(const int platformIndex, const int deviceIndex, const std::function<void(cl::CommandQueue&)>& enqueueWork) {
+    std::shared_ptr<IgorCLSubmissionThread> submissionThread;
+    {
+        std::lock_guard<std::mutex> lock(_threadMutex);
+        std::pair<int, int> requestedIndices(platformIndex, deviceIndex);
+        for (size_t i = 0; i < _threadIndices.size(); ++i) {
+            if (_threadIndices[i] == requestedIndices) {
+                submissionThread = _threads[i];
+                break;
+            }
+        }
+        if (!submissionThread) {
+            submissionThread = std::make_shared<IgorCLSubmissionThread>(platformIndex, deviceIndex);
+            _threadIndices.push_back(requestedIndices);
+            _threads.push_back(submissionThread);
+        }
+    }
+    
+    submissionThread->submit(enqueueWork);
+}
+
+void IgorCLSubmissionThreadPool::stopAll() {
+    std::vector<std::shared_ptr<IgorCLSubmissionThread> > threads;
+    {
+        std::lock_guard<std::mutex> lock(_threadMutex);
+        threads.swap(_threads);
+        _threadIndices.clear();
+    }
+    
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i]->stop();
+    }
+}
+
+IgorCLSubmissionThreadPool submissionThreads;
+
+bool IgorCLProgramCache::ProgramKey::operator<(const ProgramKey& other) const {
+    if (context != other.context)
+        return context < other.context;
+    if (deviceIndex != other.deviceIndex)
+        return deviceIndex < other.deviceIndex;
+    if (isBinary != other.isBinary)
+        return isBinary < other.isBinary;
+    if (buildOptions != other.buildOptions)
+        return buildOptions < other.buildOptions;
+    return source < other.source;
+}
+
+cl::Program IgorCLProgramCache::getProgram(const int platformIndex, const int deviceIndex, const std::string* sourceText, const std::vector<char>* sourceBinary, const std::string& buildOptions) {
+    cl::Context context;
+    cl::Device device;
+    contextAndDeviceProvider.getContextForPlatformAndDevice(platformIndex, deviceIndex, context, device);
+    
+    ProgramKey key;
+    key.context = context();
+    key.isBinary = (sourceText == NULL);
+    key.deviceIndex = deviceIndex;
+    if (sourceText != NULL) {
+        key.source = *sourceText;
+    } else {
+        key.source.assign(sourceBinary->begin(), sourceBinary->end());
+    }
+    key.buildOptions = buildOptions;
+    
+    std::promise<cl::Program> buildPromise;
+    std::shared_future<cl::Program> existingProgram;
+    bool haveExistingProgram = false;
+    unsigned long buildID = 0;
+    {
+        std::lock_guard<std::mutex> lock(_programMutex);
+        std::map<ProgramKey, ProgramEntry>::iterator it = _programs.find(key);
+        if (it != _programs.end()) {
+            // either built already or being built by another thread.
+            existingProgram = it->second.program;
+            haveExistingProgram = true;
+        } else {
+            // we are the builder for this key.
+            buildID = _nextBuildID++;
+            ProgramEntry entry;
+            entry.program = buildPromise.get_future().share();
+            entry.buildID = buildID;
+            _programs[key] = entry;
+            _insertionOrder.push_back(key);
+            
+            // evict the oldest entries. Threads that are still waiting on those hold their own reference to the result.
+            while (_insertionOrder.size() > kMaxCachedPrograms) {
+                _programs.erase(_insertionOrder.front());
+                _insertionOrder.pop_front();
+            }
+        }
+    }
+    
+    // wait outside of the lock. Rethrows the error if the build failed.
+    if (haveExistingProgram) {
+        statisticsCounters.increment(IgorCLCounterProgramCacheHits);
+        return existingProgram.get();
+    }
+    statisticsCounters.increment(IgorCLCounterProgramCacheMisses);
+    
+    try {
+        cl::Program program = _buildProgram(context, device, sourceText, sourceBinary, buildOptions, true);
+        buildPromise.set_value(program);
+        return program;
+    }
+    catch (...) {
+        buildPromise.set_exception(std::current_exception());
+        
+        // do not cache the failure
+        std::lock_guard<std::mutex> lock(_programMutex);
+        std::map<ProgramKey, ProgramEntry>::iterator it = _programs.find(key);
+        if ((it != _programs.end()) && (it->second.buildID == buildID)) {
+            _programs.erase(it);
+            for (std::deque<ProgramKey>::iterator orderIt = _insertionOrder.begin(); orderIt != _insertionOrder.end(); ++orderIt) {
+                if (!(*orderIt < key) && !(key < *orderIt)) {
+                    _insertionOrder.erase(orderIt);
+                    break;
+                }
+            }
+        }
+        throw;
+    }
+}
+
+cl::Program IgorCLProgramCache::buildUncachedProgram(const int platformIndex, const int deviceIndex, const std::string& sourceText, const std::string& buildOptions, const bool reportBuildLog) {
+    cl::Context context;
+    cl::Device device;
+    contextAndDeviceProvider.getContextForPlatformAndDevice(platformIndex, deviceIndex, context, device);
+    
+    return _buildProgram(context, device, &sourceText, NULL, buildOptions, reportBuildLog);
+}
+
+cl::Program IgorCLProgramCache::_buildProgram(const cl::Context& context, const cl::Device& device, const std::string* sourceText, const std::vector<char>* sourceBinary, const std::string& buildOptions, const bool reportBuildLog) {
+    std::vector<cl::Device> deviceAsVector(1, device);
+    
+    // get the program, either using text or using source
+    cl_int status;
+    cl::Program program;
+    if (sourceText != NULL) {
+        // use text source
+        program = cl::Program(context, *sourceText, false, &status);
+    } else {
+        // use binary
+        const void* programPointer = &(sourceBinary->at(0));
+        size_t programSize = sourceBinary->size();
+        std::pair<const void*, size_t> sourcePair(programPointer, programSize);
+        std::vector<std::pair<const void*, size_t> > binaryAsVector;
+        binaryAsVector.push_back(sourcePair);
+        program = cl::Program(context, deviceAsVector, binaryAsVector, NULL, &status);
+    }
+    if (status != CL_SUCCESS)
+        throw IgorCLError(status);
+    
+    // build the program for the requested device only, even if the context spans others.
+    statisticsCounters.increment(IgorCLCounterCompiles);
+    const char* options = buildOptions.empty() ? NULL : buildOptions.c_str();
+    status = program.build(deviceAsVector, options);
+    if ((status != CL_SUCCESS) && !reportBuildLog)
+        throw IgorCLError(status);
+    if (status != CL_SUCCESS) {
+        // only the thread that ran the build reports the log
+        std::string buildLog = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
+        for (int i = 0; i < buildLog.size(); ++i) {
+            if (buildLog[i] == '\n')
+                buildLog[i] = '\r';
+        }
+        XOPNotice(buildLog.c_str());
+        throw IgorCLError(status);
+    }
+    
+    return program;
+}
+
+void IgorCLProgramCache::clear() {
+    std::lock_guard<std::mutex> lock(_programMutex);
+    
+    _programs.clear();
+    _insertionOrder.clear();
+}
+
+IgorCLProgramCache programCache;
+
+void FirstTouchBufferOnDevice(const cl::CommandQueue& commandQueue, const cl::Buffer& buffer, const size_t nBytes) {
+    cl_uchar zero = 0;
+    cl_int status = ::clEnqueueFillBuffer(commandQueue(), buffer(), &zero, sizeof(zero), 0, nBytes, 0, NULL, NULL);
+    if (status != CL_SUCCESS)
+        throw IgorCLError(status);
+}
+
+cl::Buffer IgorCLStagingPool::acquireBuffer(const int platformIndex, const int deviceIndex, const cl::Context& context, const cl::CommandQueue& commandQueue, const size_t nBytes, bool& wasFirstTouched) {
+    wasFirstTouched = false;
+    std::pair<int, int> requestedIndices(platformIndex, deviceIndex);
+    {
+        std::lock_guard<std::mutex> lock(_stagingMutex);
+        
+        // the smallest buffer that is large enough
+        std::deque<StagingBuffer>::iterator bestMatch = _availableBuffers.end();
+        for (std::deque<StagingBuffer>::iterator it = _availableBuffers.begin(); it != _availableBuffers.end(); ++it) {
+            if ((it->indices != requestedIndices) || (it->context != context()) || (it->sizeInBytes < nBytes))
+                continue;
+            if ((bestMatch == _availableBuffers.end()) || (it->sizeInBytes < bestMatch->sizeInBytes))
+                bestMatch = it;
+        }
+        if (bestMatch != _availableBuffers.end()) {
+            cl::Buffer buffer = bestMatch->buffer;
+            _availableBytes -= bestMatch->sizeInBytes;
+            _availableBuffers.erase(bestMatch);
+            return buffer;
+        }
+    }
+    
+    cl_int status;
+    cl::Buffer buffer(context, CL_MEM_ALLOC_HOST_PTR, nBytes, NULL, &status);
+    if (status != CL_SUCCESS)
+        throw IgorCLError(status);
+    statisticsCounters.increment(IgorCLCounterBuffersAllocated);
+    // only a CPU device shares the host's NUMA nodes, elsewhere a first touch just costs a kernel launch
+    if (executionSettings.firstTouchOnDevice() && (commandQueue.getInfo<CL_QUEUE_DEVICE>().getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU)) {
+        FirstTouchBufferOnDevice(commandQueue, buffer, nBytes);
+        wasFirstTouched = true;
+    }
+    return buffer;
+}
+
+void IgorCLStagingPool::releaseBuffer(const int platformIndex, const int deviceIndex, const cl::Context& context, const cl::Buffer& buffer) {
+    StagingBuffer stagingBuffer;
+    stagingBuffer.indices = std::pair<int, int>(platformIndex, deviceIndex);
+    stagingBuffer.context = context();
+    stagingBuffer.buffer = buffer;
+    stagingBuffer.sizeInBytes = buffer.getInfo<CL_MEM_SIZE>();
+    if (stagingBuffer.sizeInBytes > kMaxAvailableBytes)
+        return;     // would push out everything else
+    
+    std::lock_guard<std::mutex> lock(_stagingMutex);
+    _availableBuffers.push_back(stagingBuffer);
+    _availableBytes += stagingBuffer.sizeInBytes;
+    while ((_availableBuffers.size() > kMaxAvailableBuffers) || (_availableBytes > kMaxAvailableBytes)) {
+        _availableBytes -= _availableBuffers.front().sizeInBytes;
+        _availableBuffers.pop_front();
+    }
+}
+
+void IgorCLStagingPool::clear() {
+    std::lock_guard<std::mutex> lock(_stagingMutex);
+    
+    _availableBuffers.clear();
+    _availableBytes = 0;
+}
+
+IgorCLStagingPool stagingPool;
+
+static bool IsNUMANode(const cl::Device& device) {
+    std::vector<cl_device_partition_property> partitionType;
+    if (device.getInfo(CL_DEVICE_PARTITION_TYPE, &partitionType) != CL_SUCCESS)
+        return false;
+    return ((partitionType.size() >= 2) && (partitionType[0] == CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN) && (partitionType[1] == CL_DEVICE_AFFINITY_DOMAIN_NUMA));
+}
+
+void IgorCLTransferStatisticsCollector::recordTransfers(const int platformIndex, const int deviceIndex, const cl::Device& device, const double directBytes, const double stagedBytes, const double zeroCopyBytes, const double firstTouchedBytes) {
+    std::lock_guard<std::mutex> lock(_statisticsMutex);
+    
+    IgorCLTransferStatistics* statistics = NULL;
+    for (size_t i = 0; i < _statistics.size(); ++i) {
+        if ((_statistics[i].platformIndex == platformIndex) && (_statistics[i].deviceIndex == deviceIndex)) {
+            statistics = &_statistics[i];
+            break;
+        }
+    }
+    if (statistics == NULL) {
+        IgorCLTransferStatistics newStatistics;
+        newStatistics.platformIndex = platformIndex;
+        newStatistics.deviceIndex = deviceIndex;
+        newStatistics.isNUMANode = IsNUMANode(device);
+        newStatistics.directBytes = 0;
+        newStatistics.stagedBytes = 0;
+        newStatistics.zeroCopyBytes = 0;
+        newStatistics.firstTouchedBytes = 0;
+        _statistics.push_back(newStatistics);
+        statistics = &_statistics.back();
+    }
+    
+    statistics->directBytes += directBytes;
+    statistics->stagedBytes += stagedBytes;
+    statistics->zeroCopyBytes += zeroCopyBytes;
+    statistics->firstTouchedBytes += firstTouchedBytes;
+}
+
+std::vector<IgorCLTransferStatistics> IgorCLTransferStatisticsCollector::getStatistics() {
+    std::lock_guard<std::mutex> lock(_statisticsMutex);
+    
+    return _statistics;
+}
+
+IgorCLTransferStatisticsCollector transferStatistics;
+
+int IgorCLResidentBufferRegistry::_addBuffer(const IgorCLResidentBuffer& buffer) {
+    std::lock_guard<std::mutex> lock(_bufferMutex);
+    
+    int bufferID = _nextBufferID++;
+    Entry& entry = _buffers[bufferID];
+    entry.buffer = buffer;
+    entry.entryMutex = std::make_shared<std::mutex>();
+    return bufferID;
+}
+
+std::shared_ptr<std::mutex> IgorCLResidentBufferRegistry::_entryMutex(const int bufferID) {
+    std::lock_guard<std::mutex> lock(_bufferMutex);
+    
+    std::map<int, Entry>::iterator it = _buffers.find(bufferID);
+    if (it == _buffers.end())
+        throw std::runtime_error("No resident buffer with this ID");
+    return it->second.entryMutex;
+}
+
+// A queue for the device and context of a resident buffer. The queue comes from the pool, unless the buffer was created
+// before a change of the context mode and lives in a context that the pool no longer serves.
+static cl::CommandQueue CommandQueueForResidentBuffer(const IgorCLResidentBuffer& residentBuffer, std::unique_ptr<IgorCLCommandQueueProvider>& commandQueueProvider) {
+    cl::Context context;
+    cl::Device device;
+    contextAndDeviceProvider.getContextForPlatformAndDevice(residentBuffer.platformIndex, residentBuffer.deviceIndex, context, device);
+    if (context() == residentBuffer.context()) {
+        commandQueueProvider.reset(new IgorCLCommandQueueProvider(residentBuffer.platformIndex, residentBuffer.deviceIndex));
+        return commandQueueProvider->getCommandQueue();
+    }
+    
+    cl_int status;
+    cl::CommandQueue commandQueue(residentBuffer.context, residentBuffer.device, 0, &status);
+    if (status != CL_SUCCESS)
+        throw IgorCLError(status);
+    statisticsCounters.increment(IgorCLCounterQueuesCreated);
+    return commandQueue;
+}
+
+int IgorCLResidentBufferRegistry::createBuffer(const int platformIndex, const int deviceIndex, const size_t sizeInBytes, const void* initialData) {
+    IgorCLContextModeLease contextModeLease;
+    IgorCLResidentBuffer residentBuffer;
+    residentBuffer.platformIndex = platformIndex;
+    residentBuffer.deviceIndex = deviceIndex;
+    residentBuffer.sizeInBytes = sizeInBytes;
+    contextAndDeviceProvider.getContextForPlatformAndDevice(platformIndex, deviceIndex, residentBuffer.context, residentBuffer.device);
+    
+    cl_int status;
+    int flags = CL_MEM_READ_WRITE;
+    if (initialData != NULL)
+        flags |= CL_MEM_COPY_HOST_PTR;
+    residentBuffer.buffer = cl::Buffer(residentBuffer.context, flags, sizeInBytes, const_cast<void*>(initialData), &status);
+    if (status != CL_SUCCESS)
+        throw IgorCLError(status);
+    statisticsCounters.increment(IgorCLCounterBuffersAllocated);
+    // initial data overwrites the whole buffer, so only empty buffers are first touched.
+    if ((initialData == NULL) && executionSettings.firstTouchOnDevice() && (residentBuffer.device.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU)) {
+        IgorCLCommandQueueProvider commandQueueProvider(platformIndex, deviceIndex);
+        cl::CommandQueue commandQueue = commandQueueProvider.getCommandQueue();
+        FirstTouchBufferOnDevice(commandQueue, residentBuffer.buffer, sizeInBytes);
+        status = commandQueue.finish();
+        if (status != CL_SUCCESS)
+            throw IgorCLError(status);
+    }
+    if (initialData != NULL)
+        statisticsCounters.addTransferredBytes(platformIndex, deviceIndex, sizeInBytes, 0);
+    
+    return _addBuffer(residentBuffer);
+}
+
+IgorCLResidentBuffer IgorCLResidentBufferRegistry::getBuffer(const int bufferID) {
+    std::lock_guard<std::mutex> lock(_bufferMutex);
+    
+    std::map<int, Entry>::iterator it = _buffers.find(bufferID);
+    if (it == _buffers.end())
+        throw std::runtime_error("No resident buffer with this ID");
+    return it->second.buffer;
+}
+
+IgorCLResidentBuffer IgorCLResidentBufferRegistry::getBufferOnDevice(const int bufferID, const int platformIndex, const int deviceIndex) {
+    IgorCLContextModeLease contextModeLease;
+    IgorCLResidentBuffer residentBuffer = getBuffer(bufferID);
+    
+    cl::Context context;
+    cl::Device device;
+    contextAndDeviceProvider.getContextForPlatformAndDevice(platformIndex, deviceIndex, context, device);
+    if ((residentBuffer.platformIndex == platformIndex) && (residentBuffer.deviceIndex == deviceIndex) && (residentBuffer.context() == context()))
+        return residentBuffer;
+    
+    return _migrateBuffer(bufferID, platformIndex, deviceIndex);
+}
+
+void IgorCLResidentBufferRegistry::readBuffer(const int bufferID, void* destination, const size_t nBytes) {
+    IgorCLContextModeLease contextModeLease;
+    std::shared_ptr<std::mutex> entryMutex = _entryMutex(bufferID);
+    std::lock_guard<std::mutex> entryLock(*entryMutex);
+    IgorCLResidentBuffer residentBuffer = getBuffer(bufferID);
+    if (nBytes != residentBuffer.sizeInBytes)
+        throw std::runtime_error("The size of the wave does not match the size of the resident buffer");
+    
+    std::unique_ptr<IgorCLCommandQueueProvider> commandQueueProvider;
+    cl::CommandQueue commandQueue = CommandQueueForResidentBuffer(residentBuffer, commandQueueProvider);
+    cl_int status = commandQueue.enqueueReadBuffer(residentBuffer.buffer, true, 0, nBytes, destination);
+    if (status != CL_SUCCESS)
+        throw IgorCLError(status);
+    statisticsCounters.addTransferredBytes(residentBuffer.platformIndex, residentBuffer.deviceIndex, 0, nBytes);
+}
+
+IgorCLResidentBuffer IgorCLResidentBufferRegistry::_transferBuffer(const IgorCLResidentBuffer& source, const int platformIndex, const int deviceIndex, const bool makeCopy) {
+    IgorCLResidentBuffer target;
+    target.platformIndex = platformIndex;
+    target.deviceIndex = deviceIndex;
+    target.sizeInBytes = source.sizeInBytes;
+    contextAndDeviceProvider.getContextForPlatformAndDevice(platformIndex, deviceIndex, target.context, target.device);
+    
+    // the target lives in the current context of its device, so its queue always comes from the pool.
+    IgorCLCommandQueueProvider targetQueueProvider(platformIndex, deviceIndex);
+    cl::CommandQueue targetQueue = targetQueueProvider.getCommandQueue();
+    cl_int status;
+    
+    if (target.context() == source.context()) {
+        if (!makeCopy) {
+            // the runtime moves the contents to the target device
+            target.buffer = source.buffer;
+            cl_mem memObject = source.buffer();
+            status = ::clEnqueueMigrateMemObjects(targetQueue(), 1, &memObject, 0, 0, NULL, NULL);
+        } else {
+            target.buffer = cl::Buffer(target.context, CL_MEM_READ_WRITE, target.sizeInBytes, NULL, &status);
+            if (status != CL_SUCCESS)
+                throw IgorCLError(status);
+            statisticsCounters.increment(IgorCLCounterBuffersAllocated);
+            status = targetQueue.enqueueCopyBuffer(source.buffer, target.buffer, 0, 0, target.sizeInBytes);
+        }
+        if (status != CL_SUCCESS)
+            throw IgorCLError(status);
+        status = targetQueue.finish();
+        if (status != CL_SUCCESS)
+            throw IgorCLError(status);
+        return target;
+    }
+    
+    // different contexts: read into pinned memory of the source context and write that to the target device.
+    std::unique_ptr<IgorCLCommandQueueProvider> sourceQueueProvider;
+    cl::CommandQueue sourceQueue = CommandQueueForResidentBuffer(source, sourceQueueProvider);
+    cl::Buffer pinnedBuffer(source.context, CL_MEM_ALLOC_HOST_PTR, source.sizeInBytes, NULL, &status);
+    if (status != CL_SUCCESS)
+        throw IgorCLError(status);
+    statisticsCounters.increment(IgorCLCounterBuffersAllocated);
+    void* mappedBuffer = sourceQueue.enqueueMapBuffer(pinnedBuffer, true, CL_MAP_READ | CL_MAP_WRITE, 0, source.sizeInBytes, NULL, NULL, &status);
+    if (status != CL_SUCCESS)
+        throw IgorCLError(status);
+    status = sourceQueue.enqueueReadBuffer(source.buffer, true, 0, source.sizeInBytes, mappedBuffer);
+    if (status == CL_SUCCESS) {
+        target.buffer = cl::Buffer(target.context, CL_MEM_READ_WRITE, target.sizeInBytes, NULL, &status);
+        if (status == CL_SUCCESS)
+            status = targetQueue.enqueueWriteBuffer(target.buffer, true, 0, target.sizeInBytes, mappedBuffer);
+    }
+    cl_int unmapStatus = sourceQueue.enqueueUnmapMemObject(pinnedBuffer, mappedBuffer);
+    if (status != CL_SUCCESS)
+        throw IgorCLError(status);
+    if (unmapStatus != CL_SUCCESS)
+        throw IgorCLError(unmapStatus);
+    status = sourceQueue.finish();
+    if (status != CL_SUCCESS)
+        throw IgorCLError(status);
+    statisticsCounters.increment(IgorCLCounterBuffersAllocated);
+    statisticsCounters.addTransferredBytes(source.platformIndex, source.deviceIndex, 0, source.sizeInBytes);
+    statisticsCounters.addTransferredBytes(platformIndex, deviceIndex, source.sizeInBytes, 0);
+    
+    return target;
+}
+
+void IgorCLResidentBufferRegistry::migrateBuffer(const int bufferID, const int platformIndex, const int deviceIndex) {
+    IgorCLContextModeLease contextModeLease;
+    _migrateBuffer(bufferID, platformIndex, deviceIndex);
+}
+
+IgorCLResidentBuffer IgorCLResidentBufferRegistry::_migrateBuffer(const int bufferID, const int platformIndex, const int deviceIndex) {
+    std::shared_ptr<std::mutex> entryMutex = _entryMutex(bufferID);
+    std::lock_guard<std::mutex> entryLock(*entryMutex);
+    
+    // another thread may have moved the buffer here while we were waiting for the entry.
+    IgorCLResidentBuffer source = getBuffer(bufferID);
+    cl::Context context;
+    cl::Device device;
+    contextAndDeviceProvider.getContextForPlatformAndDevice(platformIndex, deviceIndex, context, device);
+    if ((source.platformIndex == platformIndex) && (source.deviceIndex == deviceIndex) && (source.context() == context()))
+        return source;
+    
+    IgorCLResidentBuffer target = _transferBuffer(source, platformIndex, deviceIndex, false);
+    
+    std::lock_guard<std::mutex> lock(_bufferMutex);
+    std::map<int, Entry>::iterator it = _buffers.find(bufferID);
+    if (it == _buffers.end())
+        throw std::runtime_error("No resident buffer with this ID");
+    it->second.buffer = target;
+    return target;
+}
+
+int IgorCLResidentBufferRegistry::copyBuffer(const int bufferID, const int platformIndex, const int deviceIndex) {
+    IgorCLContextModeLease contextModeLease;
+    std::shared_ptr<std::mutex> entryMutex = _entryMutex(bufferID);
+    std::lock_guard<std::mutex> entryLock(*entryMutex);
+    IgorCLResidentBuffer source = getBuffer(bufferID);
+    IgorCLResidentBuffer target = _transferBuffer(source, platformIndex, deviceIndex, true);
+    return _addBuffer(target);
+}
+
+void IgorCLResidentBufferRegistry::releaseBuffer(const int bufferID) {
+    std::lock_guard<std::mutex> lock(_bufferMutex);
+    
+    if (_buffers.erase(bufferID) == 0)
+        throw std::runtime_error("No resident buffer with this ID");
+}
+
+void IgorCLResidentBufferRegistry::clear() {
+    std::lock_guard<std::mutex> lock(_bufferMutex);
+    
+    _buffers.clear();
+}
+
+IgorCLResidentBufferRegistry residentBuffers;
+
+static const double kKernelTimingWeight = 0.3;     // weight of the most recent call in the moving average
+static const size_t kCalibrationBytes = 1 << 20;
+static const int kCalibrationRepeats = 3;
+
+size_t IgorCLDeviceCostModel::kernelHash(const std::string& programSource, const std::string& kernelName) {
+    return std::hash<std::string>()(programSource + '\0' + kernelName);
+}
+
+IgorCLDeviceCostModel::DeviceCalibration IgorCLDeviceCostModel::_calibrateDevice(const int platformIndex, const int deviceIndex) {
+    // the same measurement as IgorCLBench, so that both report the same numbers for a device
+    IgorCLBenchmarkResult benchmark = BenchmarkDevice(platformIndex, deviceIndex, std::vector<size_t>(1, kCalibrationBytes), kCalibrationRepeats, false);
+    
+    DeviceCalibration calibration;
+    calibration.launchLatency = benchmark.launchLatency;
+    calibration.h2dBandwidth = benchmark.h2dBandwidth[IgorCLTransferDefault].at(0);
+    calibration.d2hBandwidth = benchmark.d2hBandwidth[IgorCLTransferDefault].at(0);
+    calibration.isUsable = true;
+    return calibration;
+}
+
+IgorCLDeviceCostModel::DeviceCalibration IgorCLDeviceCostModel::_getCalibration(const int platformIndex, const int deviceIndex) {
+    DeviceIndices indices(platformIndex, deviceIndex);
+    {
+        std::lock_guard<std::mutex> lock(_costMutex);
+        std::map<DeviceIndices, DeviceCalibration>::const_iterator it = _calibrations.find(indices);
+        if (it != _calibrations.end())
+            return it->second;
+    }
+    
+    // calibrate without holding the lock. Threads that race here calibrate twice, which is harmless.
+    // A device that cannot run the calibration kernel is remembered as unusable rather than failing every selection.
+    DeviceCalibration calibration;
+    try {
+        calibration = _calibrateDevice(platformIndex, deviceIndex);
+    }
+    catch (const IgorCLError&) {
+        calibration.isUsable = false;
+    }
+    catch (const std::runtime_error&) {
+        calibration.isUsable = false;
+    }
+    std::lock_guard<std::mutex> lock(_costMutex);
+    _calibrations.insert(std::pair<DeviceIndices, DeviceCalibration>(indices, calibration));
+    return _calibrations[indices];
+}
+
+int IgorCLDeviceCostModel::selectDevice(const int platformIndex, const size_t kernelHash, const double bytesToDevice, const double bytesFromDevice, const double nWorkItems) {
+    size_t nDevices = deviceFission.getDevices(platformIndex, false).size();
+    if (nDevices == 0)
+        throw std::runtime_error("No devices available on this platform");
+    
+    int bestDevice = -1;
+    double bestTime = 0;
+    for (size_t i = 0; i < nDevices; ++i) {
+        std::pair<size_t, DeviceIndices> key(kernelHash, DeviceIndices(platformIndex, i));
+        KernelTiming timing = {0, 0};
+        {
+            std::lock_guard<std::mutex> lock(_costMutex);
+            if (_kernelFailures.count(key) != 0)
+                continue;   // not worth calibrating a device that cannot run this kernel
+            std::map<std::pair<size_t, DeviceIndices>, KernelTiming>::const_iterator it = _kernelTimings.find(key);
+            if (it != _kernelTimings.end())
+                timing = it->second;
+        }
+        
+        DeviceCalibration calibration = _getCalibration(platformIndex, i);
+        if (!calibration.isUsable)
+            continue;
+        if (timing.nCalls < 2)
+            return i;   // no timings for this kernel yet, explore this device
+        
+        double predictedTime = calibration.launchLatency + bytesToDevice / calibration.h2dBandwidth + bytesFromDevice / calibration.d2hBandwidth + timing.secondsPerWorkItem * nWorkItems;
+        if ((bestDevice < 0) || (predictedTime < bestTime)) {
+            bestDevice = i;
+            bestTime = predictedTime;
+        }
+    }
+    
+    // recordFailure() never leaves a kernel without a usable device, so this only happens if none could be calibrated.
+    if (bestDevice < 0)
+        throw std::runtime_error("None of the devices on this platform could be calibrated for automatic device selection");
+    return bestDevice;
+}
+
+bool IgorCLDeviceCostModel::_isUnusable(const DeviceIndices& indices) const {
+    std::map<DeviceIndices, DeviceCalibration>::const_iterator it = _calibrations.find(indices);
+    return (it != _calibrations.end()) && !it->second.isUsable;
+}
+
+bool IgorCLDeviceCostModel::recordFailure(const int platformIndex, const int deviceIndex, const size_t kernelHash) {
+    size_t nDevices = deviceFission.getDevices(platformIndex, false).size();
+    
+    std::lock_guard<std::mutex> lock(_costMutex);
+    _kernelFailures.insert(std::make_pair(kernelHash, DeviceIndices(platformIndex, deviceIndex)));
+    for (size_t i = 0; i < nDevices; ++i) {
+        if ((_kernelFailures.count(std::make_pair(kernelHash, DeviceIndices(platformIndex, i))) == 0) && !_isUnusable(DeviceIndices(platformIndex, i)))
+            return true;
+    }
+    
+    for (size_t i = 0; i < nDevices; ++i) {
+        _kernelFailures.erase(std::make_pair(kernelHash, DeviceIndices(platformIndex, i)));
+    }
+    return false;
+}
+
+void IgorCLDeviceCostModel::recordExecution(const int platformIndex, const int deviceIndex, const size_t kernelHash, const double bytesToDevice, const double bytesFromDevice, const double nWorkItems, const double elapsedSeconds) {
+    DeviceCalibration calibration = _getCalibration(platformIndex, deviceIndex);
+    if (!calibration.isUsable)
+        return;
+    
+    // whatever is not explained by latency and transfers is attributed to the kernel itself
+    double kernelTime = elapsedSeconds - calibration.launchLatency - bytesToDevice / calibration.h2dBandwidth - bytesFromDevice / calibration.d2hBandwidth;
+    double secondsPerWorkItem = std::max(kernelTime, 0.0) / std::max(nWorkItems, 1.0);
+    
+    std::lock_guard<std::mutex> lock(_costMutex);
+    KernelTiming& timing = _kernelTimings[std::make_pair(kernelHash, DeviceIndices(platformIndex, deviceIndex))];
+    timing.nCalls += 1;
+    if (timing.nCalls == 2) {
+        timing.secondsPerWorkItem = secondsPerWorkItem;
+    } else if (timing.nCalls > 2) {
+        timing.secondsPerWorkItem += kKernelTimingWeight * (secondsPerWorkItem - timing.secondsPerWorkItem);
+    }
+}
+
+void IgorCLDeviceCostModel::setCalibration(const int platformIndex, const int deviceIndex, const double launchLatency, const double h2dBandwidth, const double d2hBandwidth) {
+    if ((launchLatency < 0) || (h2dBandwidth <= 0) || (d2hBandwidth <= 0))
+        throw int(EXPECT_POS_NUM);
+    
+    DeviceCalibration calibration;
+    calibration.launchLatency = launchLatency;
+    calibration.h2dBandwidth = h2dBandwidth;
+    calibration.d2hBandwidth = d2hBandwidth;
+    calibration.isUsable = true;
+    
+    std::lock_guard<std::mutex> lock(_costMutex);
+    _calibrations[DeviceIndices(platformIndex, deviceIndex)] = calibration;
+}
+
+void IgorCLDeviceCostModel::clear() {
+    std::lock_guard<std::mutex> lock(_costMutex);
+    
+    _calibrations.clear();
+    _kernelTimings.clear();
+    _kernelFailures.clear();
+}
+
+IgorCLDeviceCostModel costModel;
+
+static std::string NativeFilePath(const std::string& filePath) {
+    if (filePath.size() > MAX_PATH_LEN)
+        throw std::runtime_error("The file path is too long");
+    char nativePath[MAX_PATH_LEN + 1];
+    int err = GetNativePath(filePath.c_str(), nativePath);
+    if (err)
+        throw int(err);
+    return std::string(nativePath);
+}
+
+void WriteCalibrationFile(const std::string& filePath, const std::vector<IgorCLDeviceCalibrationRecord>& records) {
+    std::ofstream file(NativeFilePath(filePath).c_str());
+    if (!file)
+        throw std::runtime_error("Unable to open the calibration file for writing");
+    
+    file.precision(9);
+    file << "# IgorCL device calibration" << std::endl;
+    file << "# platform device launchLatency finishLatency compileTime h2dDefault d2hDefault h2dPinned d2hPinned h2dHostPointer d2hHostPointer" << std::endl;
+    for (size_t i = 0; i < records.size(); ++i) {
+        const IgorCLDeviceCalibrationRecord& record = records.at(i);
+        file << record.platformIndex << " " << record.deviceIndex << " " << record.launchLatency << " " << record.finishLatency << " " << record.compileTime;
+        for (int j = 0; j < IgorCLNTransferStrategies; ++j) {
+            file << " " << record.h2dBandwidth[j] << " " << record.d2hBandwidth[j];
+        }
+        file << std::endl;
+    }
+    if (!file)
+        throw std::runtime_error("Unable to write the calibration file");
+}
+
+std::vector<IgorCLDeviceCalibrationRecord> ReadCalibrationFile(const std::string& filePath) {
+    std::ifstream file(NativeFilePath(filePath).c_str());
+    if (!file)
+        throw std::runtime_error("Unable to open the calibration file");
+    
+    std::vector<IgorCLDeviceCalibrationRecord> records;
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t firstCharacter = line.find_first_not_of(" \t\r");
+        if ((firstCharacter == std::string::npos) || (line[firstCharacter] == '#'))
+            continue;
+        
+        std::istringstream lineStream(line);
+        IgorCLDeviceCalibrationRecord record;
+        lineStream >> record.platformIndex >> record.deviceIndex >> record.launchLatency >> record.finishLatency >> record.compileTime;
+        for (int j = 0; j < IgorCLNTransferStrategies; ++j) {
+            lineStream >> record.h2dBandwidth[j] >> record.d2hBandwidth[j];
+        }
+        if (!lineStream || (record.platformIndex < 0) || (record.deviceIndex < 0))
+            throw std::runtime_error("Invalid line in the calibration file");
+        records.push_back(record);
+    }
+    
+    return records;
 }
 
 std::string OpenCLErrorCodeToSymbolicName(int errorCode) {
@@ -26,28 +26,222 @@ this program with Igor Pro, developed by WaveMetrics Inc. (www.wavemetrics.com).
 #include <string>
 #include <vector>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <set>
+#include <future>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
 
 #include "XOPStandardHeaders.h"
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
 void StoreStringInTextWave(const std::string str, waveHndl textWave, IndexInt* indices);
 std::string GetStdStringFromHandle(const Handle handle);
 Handle PutStdStringInHandle(const std::string theString);
 
 size_t WaveDataSizeInBytes(waveHndl wave);
 size_t SharedMemorySizeFromWave(waveHndl wave);
+int ResidentBufferIDFromWave(waveHndl wave);
+
+// transfer type conversion (IgorCLTransferAsSingle and IgorCLTransferAsHalf)
+bool RequiresTransferConversion(const int igorCLFlags);
+size_t TransferDataSizeInBytes(waveHndl wave, const int igorCLFlags);
+void ConvertWaveDataForTransfer(waveHndl wave, const int igorCLFlags, void* destination);
+void ConvertTransferredDataToWave(const void* source, const int igorCLFlags, waveHndl wave);
+
+std::vector<char> FillPatternForWave(waveHndl wave, const int igorCLFlags, const double fillValue);
+
+// the number of bytes that a call will copy to and from the device, given the memflags of the waves.
+void EstimateTransferBytes(const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, double& bytesToDevice, double& bytesFromDevice);
+
+// scalar kernel argument passed by value (/SCLR) rather than using a single-point wave
+struct IgorCLScalarArgument {
+    int argumentIndex;
+    std::vector<char> value;    // bytes of the value in the kernel parameter type
+};
 
+IgorCLScalarArgument MakeScalarArgument(const int argumentIndex, const int waveTypeCode, const double value, const cl_long* exactIntegerValue);
+std::vector<cl_uint> KernelArgumentIndicesForWaves(const size_t nWaves, const std::vector<IgorCLScalarArgument>& scalarArgs);
+
+// device type strings (CPU, GPU, ACCELERATOR, AUTO) are case-insensitive
+std::string NormalizeDeviceTypeString(const std::string& deviceTypeStr);
 int GetFirstDeviceOfType(const int platformIndex, const std::string& deviceTypeStr);
 int ConvertIgorCLFlagsToOpenCLFlags(const int igorCLFlags);
 
+// numeric device properties, one labeled row of the M_OpenCLDeviceInfo<platform> wave made by IgorCLInfo.
+// Booleans are 0 or 1, sizes are in bytes and the clock frequency is in MHz.
+enum IgorCLDeviceCapability {
+    IgorCLCapabilityType = 0,           // CL_DEVICE_TYPE bitfield
+    IgorCLCapabilityAvailable,
+    IgorCLCapabilityHostUnifiedMemory,
+    IgorCLCapabilityGlobalMemSize,
+    IgorCLCapabilityGlobalMemCacheSize,
+    IgorCLCapabilityMaxMemAllocSize,
+    IgorCLCapabilityLocalMemType,       // CL_LOCAL, CL_GLOBAL or CL_NONE
+    IgorCLCapabilityLocalMemSize,
+    IgorCLCapabilityMaxConstantBufferSize,
+    IgorCLCapabilityMaxComputeUnits,
+    IgorCLCapabilityMaxClockFrequency,
+    IgorCLCapabilityMaxWorkItemSize0,
+    IgorCLCapabilityMaxWorkItemSize1,
+    IgorCLCapabilityMaxWorkItemSize2,
+    IgorCLCapabilityMaxWorkGroupSize,
+    IgorCLCapabilityPreferredVectorWidthChar,
+    IgorCLCapabilityPreferredVectorWidthShort,
+    IgorCLCapabilityPreferredVectorWidthInt,
+    IgorCLCapabilityPreferredVectorWidthLong,
+    IgorCLCapabilityPreferredVectorWidthFloat,
+    IgorCLCapabilityPreferredVectorWidthDouble,
+    IgorCLCapabilityPreferredVectorWidthHalf,
+    IgorCLCapabilitySupportsDouble,     // cl_khr_fp64
+    IgorCLCapabilitySupportsImages,
+    IgorCLCapabilityImage2DMaxHeight,
+    IgorCLCapabilityImage2DMaxWidth,
+    IgorCLCapabilityImage3DMaxDepth,
+    IgorCLCapabilityImage3DMaxHeight,
+    IgorCLCapabilityImage3DMaxWidth,
+    IgorCLNDeviceCapabilities
+};
+
+struct IgorCLDeviceDescription {
+    cl::Device device;
+    std::string name;
+    cl_device_type type;
+    double capabilities[IgorCLNDeviceCapabilities];
+};
+
+IgorCLDeviceDescription DescribeDevice(const cl::Device& device);
+const char* DeviceCapabilityName(const IgorCLDeviceCapability capability);
+
+// The platforms and their physical devices, enumerated once and then reused by all device lookups.
+// The table is filled the first time that it is needed, and is read-only after that so lookups take no lock.
+// If the enumeration fails then the error is reported and the next lookup tries again.
+class IgorCLDeviceTable {
+public:
+    IgorCLDeviceTable() : _isEnumerated(false) {;}
+    ~IgorCLDeviceTable() {;}
+    
+    size_t nPlatforms();
+    cl::Platform getPlatform(const int platformIndex);
+    std::vector<cl::Device> getDevices(const int platformIndex);
+    const std::vector<IgorCLDeviceDescription>& getDeviceDescriptions(const int platformIndex);
+    
+private:
+    void _enumerate();
+    
+    std::vector<cl::Platform> _platforms;
+    std::vector<std::vector<IgorCLDeviceDescription> > _devices;    // indexed by platform
+    std::atomic<bool> _isEnumerated;
+    
+    std::mutex _enumerationMutex;
+};
+
+extern IgorCLDeviceTable deviceTable;
+
+// Device selection with /DSEL. The selector is a semicolon-separated list of criteria, evaluated against
+// the physical devices of all platforms:
+//   CPU, GPU or ACCELERATOR    only devices of this type, at most one type per selector
+//   NAME:text                  only devices whose name contains text (not case-sensitive)
+//   FP64                       only devices that support double precision
+//   MAXMEM                     prefer the device with the most global memory
+//   MAXCU                      prefer the device with the most compute units
+// If more than one preference is given then the later ones break ties. Without a preference the first matching
+// device is used. The devices do not change while Igor is running, so the result is memoized per selector string.
+class IgorCLDeviceSelector {
+public:
+    IgorCLDeviceSelector() {;}
+    ~IgorCLDeviceSelector() {;}
+    
+    // returns the platform and device index
+    std::pair<int, int> selectDevice(const std::string& selector);
+    
+private:
+    static std::pair<int, int> _evaluateSelector(const std::string& selector);
+    
+    std::map<std::string, std::pair<int, int> > _selections;
+    
+    std::mutex _selectionMutex;
+};
+
+extern IgorCLDeviceSelector deviceSelector;
+
+// Sub-devices of CPU devices (device fission), created with IgorCLSettings /FISS. The sub-devices get device indices
+// after the physical devices of their platform, in the order in which they were created. Since contexts and queues
+// are cached per device index, a device can be partitioned only once.
+class IgorCLDeviceFission {
+public:
+    IgorCLDeviceFission() : _nPartitions(0), _routeThreadsToPartitions(false) {;}
+    ~IgorCLDeviceFission() {;}
+    
+    // partitionSpecification is "EQUALLY:n" (n compute units per sub-device), "COUNTS:n1,n2,..." or "NUMA".
+    // Returns the device index of the first sub-device.
+    int partitionDevice(const int platformIndex, const int deviceIndex, const std::string& partitionSpecification, int& nSubDevices);
+    
+    // the physical devices of the platform, followed by any sub-devices.
+    std::vector<cl::Device> getDevices(const int platformIndex, const bool includeSubDevices = true);
+    
+    // If routing is enabled and the device has been partitioned, then every calling thread is assigned
+    // one of the sub-devices (round-robin) and keeps using it. Otherwise returns deviceIndex.
+    int deviceIndexForThread(const int platformIndex, const int deviceIndex);
+    bool routeThreadsToPartitions() const {return _routeThreadsToPartitions.load();}
+    void setRouteThreadsToPartitions(const bool routeThreads) {_routeThreadsToPartitions.store(routeThreads);}
+    
+private:
+    struct Partition {
+        int platformIndex;
+        int parentDeviceIndex;
+        int firstSubDeviceIndex;
+        std::vector<cl::Device> subDevices;
+        unsigned int nThreadsAssigned;
+    };
+    
+    std::vector<Partition> _partitions;
+    std::atomic<int> _nPartitions;
+    std::atomic<bool> _routeThreadsToPartitions;
+    
+    std::mutex _partitionMutex;
+};
+
+extern IgorCLDeviceFission deviceFission;
+
 class IgorCLContextAndDeviceProvider {
 public:
-    IgorCLContextAndDeviceProvider() {;}
+    IgorCLContextAndDeviceProvider() : nPublishedContexts(0) {;}
     ~IgorCLContextAndDeviceProvider() {;}
     
+    // Depending on executionSettings.useSharedContexts(), the context contains only the requested device
+    // or all devices of the platform.
     void getContextForPlatformAndDevice(const int platformIndex, const int deviceIndex, cl::Context& context, cl::Device &device);
     
 private:
+    bool findPublishedContext(const std::pair<int, int>& requestedIndices, const bool isShared, cl::Context& context, cl::Device &device) const;
+    bool findSharedContextForPlatform(const int platformIndex, cl::Context& context) const;
+    void publishContext(const std::pair<int, int>& indices, const bool isShared, const bool spansPlatform, const cl::Context& context, const cl::Device& device);
+    
+    // Contexts are never removed, so the published entries are append-only:
+    // an entry is fully written before nPublishedContexts is incremented (release),
+    // and lookups read nPublishedContexts (acquire) and scan without taking contextMutex.
+    // Only the creation of a new context, and the (unlikely) overflow beyond
+    // kMaxPublishedContexts, go through contextMutex.
+    static const int kMaxPublishedContexts = 64;
+    std::pair<int, int> publishedContextIndices[kMaxPublishedContexts];
+    bool publishedContextIsShared[kMaxPublishedContexts];
+    bool publishedContextSpansPlatform[kMaxPublishedContexts];     // sub-devices get their own context, even in shared mode
+    cl::Context publishedContexts[kMaxPublishedContexts];
+    cl::Device publishedDevices[kMaxPublishedContexts];
+    std::atomic<int> nPublishedContexts;
+    
     std::vector<std::pair<int, int> > availableContextIndices;
+    std::vector<bool> availableContextIsShared;
+    std::vector<bool> availableContextSpansPlatform;
     std::vector<cl::Context> availableContexts;
     std::vector<cl::Device> deviceForContext;
     
@@ -56,24 +250,265 @@ private:
 
 extern IgorCLContextAndDeviceProvider contextAndDeviceProvider;
 
+// XOP-wide settings, changed using the IgorCLSettings operation.
+class IgorCLExecutionSettings {
+public:
+    IgorCLExecutionSettings() : _useThreadLocalQueues(false), _maxQueuesPerDevice(0), _useSubmissionThread(false), _useSharedContexts(false), _firstTouchOnDevice(false), _nContextModeLeases(0), _isChangingContextMode(false) {;}
+    ~IgorCLExecutionSettings() {;}
+    
+    bool useThreadLocalQueues() const {return _useThreadLocalQueues.load();}
+    void setUseThreadLocalQueues(const bool useThreadLocalQueues) {_useThreadLocalQueues.store(useThreadLocalQueues);}
+    
+    // maximum number of command queues per device, 0 means no limit.
+    int maxQueuesPerDevice() const {return _maxQueuesPerDevice.load();}
+    void setMaxQueuesPerDevice(const int maxQueuesPerDevice) {_maxQueuesPerDevice.store(maxQueuesPerDevice);}
+    
+    // if set, all OpenCL work is submitted by a dedicated thread per device.
+    bool useSubmissionThread() const {return _useSubmissionThread.load();}
+    void setUseSubmissionThread(const bool useSubmissionThread) {_useSubmissionThread.store(useSubmissionThread);}
+    
+    // if set, a single context spans all devices of a platform, so that programs and buffers can be shared between them.
+    // Command queues belong to a context, so changeContextMode() waits until no call holds an IgorCLContextModeLease,
+    // holds off new calls, switches, and then stops the submission threads and deletes all command queues.
+    bool useSharedContexts() const {return _useSharedContexts.load();}
+    void changeContextMode(const bool useSharedContexts);
+    
+    // see IgorCLContextModeLease
+    void acquireContextModeLease();
+    void releaseContextModeLease();
+    
+    // if set, pinned staging memory, and buffers for CPU devices that outlive a call without being uploaded to (empty
+    // resident buffers, write-only session arguments), are first written by the device itself, so that the operating
+    // system places their pages on the NUMA node of the (sub-)device that uses them.
+    bool firstTouchOnDevice() const {return _firstTouchOnDevice.load();}
+    void setFirstTouchOnDevice(const bool firstTouchOnDevice) {_firstTouchOnDevice.store(firstTouchOnDevice);}
+    
+private:
+    std::atomic<bool> _useThreadLocalQueues;
+    std::atomic<int> _maxQueuesPerDevice;
+    std::atomic<bool> _useSubmissionThread;
+    std::atomic<bool> _useSharedContexts;
+    std::atomic<bool> _firstTouchOnDevice;
+    
+    std::atomic<int> _nContextModeLeases;
+    std::atomic<bool> _isChangingContextMode;
+    std::mutex _contextModeMutex;
+    std::condition_variable _contextModeCondition;
+};
+
+extern IgorCLExecutionSettings executionSettings;
+
+// Held for the duration of every operation that looks up contexts, programs, command queues or resident buffers,
+// so that a call never pairs objects from one context mode with a context of the other. Leases nest on a thread,
+// and taking one costs two atomic operations unless the mode is being changed.
+class IgorCLContextModeLease {
+public:
+    IgorCLContextModeLease() {executionSettings.acquireContextModeLease();}
+    ~IgorCLContextModeLease() {executionSettings.releaseContextModeLease();}
+    
+private:
+    IgorCLContextModeLease(const IgorCLContextModeLease&);
+    IgorCLContextModeLease& operator=(const IgorCLContextModeLease&);
+};
+
+// Counters of what the XOP has done since it was loaded or last reset, reported by the IgorCLStats operation.
+// The counters are relaxed atomics, so they can be updated on every call without noticeable cost.
+enum IgorCLCounter {
+    IgorCLCounterCalculations = 0,      // IgorCL calls that reached DoOpenCLCalculation
+    IgorCLCounterCompiles,              // programs built from source or binary, including IgorCLCompile
+    IgorCLCounterProgramCacheHits,
+    IgorCLCounterProgramCacheMisses,
+    IgorCLCounterBuffersAllocated,      // device buffers, pinned staging buffers and resident buffers
+    IgorCLCounterKernelLaunches,
+    IgorCLCounterQueuesCreated,
+    IgorCLCounterBytesUploaded,
+    IgorCLCounterBytesDownloaded,
+    IgorCLNCounters
+};
+
+// phases of DoOpenCLCalculation
+enum IgorCLPhase {
+    IgorCLPhasePrepare = 0,     // memflag conversion, wave data preparation, resident buffer lookup
+    IgorCLPhaseBuild,           // context, program (cached or built) and kernel
+    IgorCLPhaseExecute,         // buffer creation, transfers, launch and finish
+    IgorCLPhaseConvert,         // converting transferred data back to the wave type
+    IgorCLNPhases
+};
+
+class IgorCLStatisticsCounters {
+public:
+    IgorCLStatisticsCounters();
+    ~IgorCLStatisticsCounters() {;}
+    
+    void increment(const IgorCLCounter counter, const unsigned long long amount = 1) {_counters[counter].fetch_add(amount, std::memory_order_relaxed);}
+    void addPhaseTime(const IgorCLPhase phase, const double seconds) {_phaseNanoseconds[phase].fetch_add(static_cast<unsigned long long>(seconds * 1e9), std::memory_order_relaxed);}
+    // also counted per device, for the first kMaxPlatforms platforms and kMaxDevicesPerPlatform devices of each
+    void addTransferredBytes(const int platformIndex, const int deviceIndex, const unsigned long long bytesUploaded, const unsigned long long bytesDownloaded);
+    
+    // if reset is set then the counters are zeroed while they are read
+    void getCounters(std::vector<double>& counters, std::vector<double>& phaseTimes, const bool reset);
+    // rows of platform index, device index, bytes uploaded, bytes downloaded for the devices that have transferred data
+    std::vector<std::vector<double> > getDeviceBytes(const bool reset);
+    
+    static const char* counterName(const IgorCLCounter counter);
+    static const char* phaseName(const IgorCLPhase phase);
+    
+    static const int kMaxPlatforms = 8;
+    static const int kMaxDevicesPerPlatform = 32;
+    
+private:
+    std::atomic<unsigned long long> _counters[IgorCLNCounters];
+    std::atomic<unsigned long long> _phaseNanoseconds[IgorCLNPhases];
+    std::atomic<unsigned long long> _deviceBytesUploaded[kMaxPlatforms][kMaxDevicesPerPlatform];
+    std::atomic<unsigned long long> _deviceBytesDownloaded[kMaxPlatforms][kMaxDevicesPerPlatform];
+};
+
+extern IgorCLStatisticsCounters statisticsCounters;
+
+struct IgorCLQueueStatistics {
+    int platformIndex;
+    int deviceIndex;
+    int nQueues;
+    double nAcquisitions;
+    double nWaits;
+    double totalWaitTime;   // in seconds
+    double maxWaitTime;     // in seconds
+};
+
+// Hands out command queues per device. If executionSettings.maxQueuesPerDevice() is non-zero, at most that many
+// queues are created per device, and getCommandQueue() blocks until another caller returns a queue.
+// Available queues are handed out in FIFO order, so that successive callers rotate over all queues of a device
+// (and therefore over the hardware engines that the driver assigned to them).
 class IgorCLCommandQueueFactory {
 public:
-    IgorCLCommandQueueFactory() {;}
+    IgorCLCommandQueueFactory() : _generation(0) {;}
     ~IgorCLCommandQueueFactory() {;}
     
-    cl::CommandQueue getCommandQueue(const int platformIndex, const int deviceIndex);
-    void returnCommandQueue(const cl::CommandQueue commandQueue, const int platformIndex, const int deviceIndex);
+    // if generation is not NULL then it receives the generation that the queue belongs to,
+    // which must be passed back when returning the queue. Queues from an earlier generation are simply dropped.
+    cl::CommandQueue getCommandQueue(const int platformIndex, const int deviceIndex, unsigned int* generation = NULL);
+    void returnCommandQueue(const cl::CommandQueue commandQueue, const int platformIndex, const int deviceIndex, const unsigned int generation);
+    // for callers that keep their queue indefinitely (thread-local queues): if the number of queues is limited
+    // then the limited set of queues is shared round-robin between callers. OpenCL command queues are thread-safe.
+    cl::CommandQueue getSharedCommandQueue(const int platformIndex, const int deviceIndex, unsigned int* generation = NULL);
     void deleteAllCommandQueues();
     
+    std::vector<IgorCLQueueStatistics> getQueueStatistics();
+    
+    // incremented by deleteAllCommandQueues(), so that thread-local caches can detect that their queues are stale.
+    unsigned int generation() const {return _generation.load(std::memory_order_acquire);}
+    
 private:
-    std::vector<std::pair<int, int> > _availableQueueIndices;
-    std::vector<std::vector<cl::CommandQueue> > _availableQueues;
+    struct DeviceQueues {
+        std::pair<int, int> indices;
+        std::vector<cl::CommandQueue> allQueues;
+        std::deque<cl::CommandQueue> availableQueues;
+        size_t nextSharedQueue;
+        IgorCLQueueStatistics statistics;
+    };
+    
+    DeviceQueues& _queuesForDevice(const int platformIndex, const int deviceIndex);
+    cl::CommandQueue _createCommandQueue(DeviceQueues& deviceQueues);
+    
+    std::atomic<unsigned int> _generation;
+    
+    std::vector<DeviceQueues> _deviceQueues;
     
     std::mutex _queueMutex;
+    std::condition_variable _queueReturned;
 };
 
 extern IgorCLCommandQueueFactory commandQueueFactory;
 
+// A separate, value-initialized T for every thread that calls get(), deleted when that thread exits.
+// Stands in for thread_local, which the VC11 and Xcode 4 toolchains do not support. Declare it at namespace scope,
+// since function-local statics are not initialized thread-safely by VC11 either.
+template <typename T>
+class IgorCLThreadLocal {
+public:
+    IgorCLThreadLocal();
+    ~IgorCLThreadLocal();
+    
+    T& get();
+    
+private:
+    IgorCLThreadLocal(const IgorCLThreadLocal&);
+    IgorCLThreadLocal& operator=(const IgorCLThreadLocal&);
+    
+#ifdef _WIN32
+    static void NTAPI _deleteValue(void* value) {delete static_cast<T*>(value);}
+    DWORD _key;
+#else
+    static void _deleteValue(void* value) {delete static_cast<T*>(value);}
+    pthread_key_t _key;
+#endif
+};
+
+#ifdef _WIN32
+// fiber local storage, unlike TlsAlloc, calls _deleteValue when a thread exits.
+template <typename T>
+IgorCLThreadLocal<T>::IgorCLThreadLocal() {
+    _key = FlsAlloc(&IgorCLThreadLocal<T>::_deleteValue);
+    if (_key == FLS_OUT_OF_INDEXES)
+        throw std::runtime_error("Unable to allocate thread local storage");
+}
+
+template <typename T>
+IgorCLThreadLocal<T>::~IgorCLThreadLocal() {
+    FlsFree(_key);
+}
+
+template <typename T>
+T& IgorCLThreadLocal<T>::get() {
+    T* value = static_cast<T*>(FlsGetValue(_key));
+    if (value == NULL) {
+        value = new T();
+        FlsSetValue(_key, value);
+    }
+    return *value;
+}
+#else
+template <typename T>
+IgorCLThreadLocal<T>::IgorCLThreadLocal() {
+    if (pthread_key_create(&_key, &IgorCLThreadLocal<T>::_deleteValue) != 0)
+        throw std::runtime_error("Unable to allocate thread local storage");
+}
+
+template <typename T>
+IgorCLThreadLocal<T>::~IgorCLThreadLocal() {
+    pthread_key_delete(_key);
+}
+
+template <typename T>
+T& IgorCLThreadLocal<T>::get() {
+    T* value = static_cast<T*>(pthread_getspecific(_key));
+    if (value == NULL) {
+        value = new T();
+        pthread_setspecific(_key, value);
+    }
+    return *value;
+}
+#endif
+
+// Per-thread cache of command queues, used if executionSettings.useThreadLocalQueues() is set.
+// A thread keeps its queue for each device without any locking. The queues are handed back
+// to the factory when the thread exits, and dropped when the factory generation changes
+// (CLEANUP, or a change of the context mode).
+class IgorCLThreadLocalQueueCache {
+public:
+    IgorCLThreadLocalQueueCache() {;}
+    ~IgorCLThreadLocalQueueCache();
+    
+    bool getCommandQueue(const int platformIndex, const int deviceIndex, cl::CommandQueue& commandQueue);
+    void storeCommandQueue(const cl::CommandQueue commandQueue, const int platformIndex, const int deviceIndex, const bool isShared, const unsigned int generation);
+    
+private:
+    std::vector<std::pair<int, int> > _queueIndices;
+    std::vector<cl::CommandQueue> _queues;
+    std::vector<bool> _isShared;   // shared queues are not returned to the factory
+    std::vector<unsigned int> _queueGenerations;
+};
+
 class IgorCLCommandQueueProvider {
 public:
     IgorCLCommandQueueProvider(const int platformIndex, const int deviceIndex);
@@ -84,9 +519,301 @@ public:
 private:
     int _platformIndex;
     int _deviceIndex;
+    bool _isThreadLocal;
+    unsigned int _generation;
     cl::CommandQueue _commandQueue;
 };
 
+// A thread that owns a command queue for a single device and submits all work for that device.
+// Callers push requests onto a lock-free multi-producer list. The thread takes all pending requests at once,
+// enqueues them in order, and waits for the whole batch with a single finish().
+class IgorCLSubmissionThread {
+public:
+    IgorCLSubmissionThread(const int platformIndex, const int deviceIndex);
+    ~IgorCLSubmissionThread();
+    
+    // Calls enqueueWork with the queue of this thread, on this thread, and blocks until the queue has finished
+    // that work. Any error thrown by enqueueWork or reported by the queue is rethrown to the caller.
+    void submit(const std::function<void(cl::CommandQueue&)>& enqueueWork);
+    // Processes the requests submitted so far and joins the thread. Requests submitted after that fail.
+    void stop();
+    
+private:
+    struct Request {
+        std::function<void(cl::CommandQueue&)> enqueueWork;
+        std::promise<void> completion;
+        Request* next;
+    };
+    
+    void _run();
+    Request* _takePendingRequests();
+    
+    int _platformIndex;
+    int _deviceIndex;
+    
+    // Requests are pushed without a lock. Submitters announce themselves in _nSubmitting before they check
+    // _stopRequested, and stop() waits for that count to drop to zero after setting it, so that no request
+    // can be pushed once stop() has drained the list.
+    std::atomic<Request*> _pendingRequests;     // most recently submitted first
+    std::atomic<bool> _stopRequested;
+    std::atomic<int> _nSubmitting;
+    // only used to sleep and wake the thread, never held while pushing
+    std::mutex _wakeMutex;
+    std::condition_variable _wakeCondition;
+    
+    std::thread _thread;
+};
+
+class IgorCLSubmissionThreadPool {
+public:
+    IgorCLSubmissionThreadPool() {;}
+    ~IgorCLSubmissionThreadPool() {stopAll();}
+    
+    // submit work to the thread for this platform/device combination, starting the thread if needed.
+    void submit(const int platformIndex, const int deviceIndex, const std::function<void(cl::CommandQueue&)>& enqueueWork);
+    void stopAll();
+    
+private:
+    std::vector<std::pair<int, int> > _threadIndices;
+    std::vector<std::shared_ptr<IgorCLSubmissionThread> > _threads;
+    
+    std::mutex _threadMutex;
+};
+
+extern IgorCLSubmissionThreadPool submissionThreads;
+
+// zero-fills a buffer on the device that the queue belongs to. Only worthwhile for buffers that outlive the call
+// (staging and resident buffers) and that the host does not overwrite completely before the device uses them.
+void FirstTouchBufferOnDevice(const cl::CommandQueue& commandQueue, const cl::Buffer& buffer, const size_t nBytes);
+
+// Pinned host memory for staging transfers, kept per device and reused between calls. The buffers that are kept
+// are limited both in number and in total size, the least recently released are dropped first.
+class IgorCLStagingPool {
+public:
+    IgorCLStagingPool() : _availableBytes(0) {;}
+    ~IgorCLStagingPool() {;}
+    
+    // a pinned buffer of at least nBytes in the given context. Newly allocated buffers are first touched on CPU devices
+    // if executionSettings.firstTouchOnDevice() is set. The buffer must not be released before the queue has finished using it.
+    cl::Buffer acquireBuffer(const int platformIndex, const int deviceIndex, const cl::Context& context, const cl::CommandQueue& commandQueue, const size_t nBytes, bool& wasFirstTouched);
+    void releaseBuffer(const int platformIndex, const int deviceIndex, const cl::Context& context, const cl::Buffer& buffer);
+    void clear();
+    
+private:
+    struct StagingBuffer {
+        std::pair<int, int> indices;
+        cl_context context;
+        cl::Buffer buffer;
+        size_t sizeInBytes;
+    };
+    
+    static const size_t kMaxAvailableBuffers = 16;
+    static const size_t kMaxAvailableBytes = 256 << 20;
+    
+    std::deque<StagingBuffer> _availableBuffers;      // least recently released first
+    size_t _availableBytes;
+    std::mutex _stagingMutex;
+};
+
+extern IgorCLStagingPool stagingPool;
+
+struct IgorCLTransferStatistics {
+    int platformIndex;
+    int deviceIndex;
+    bool isNUMANode;            // a sub-device created by partitioning along NUMA affinity domains
+    double directBytes;         // copied between wave memory and device buffers
+    double stagedBytes;         // copied through pinned staging memory
+    double zeroCopyBytes;       // wave memory used by the device in place (IgorCLUseHostPointer)
+    double firstTouchedBytes;   // placed on the device's node by a first touch on the device
+};
+
+class IgorCLTransferStatisticsCollector {
+public:
+    IgorCLTransferStatisticsCollector() {;}
+    ~IgorCLTransferStatisticsCollector() {;}
+    
+    void recordTransfers(const int platformIndex, const int deviceIndex, const cl::Device& device, const double directBytes, const double stagedBytes, const double zeroCopyBytes, const double firstTouchedBytes);
+    std::vector<IgorCLTransferStatistics> getStatistics();
+    
+private:
+    std::vector<IgorCLTransferStatistics> _statistics;
+    std::mutex _statisticsMutex;
+};
+
+extern IgorCLTransferStatisticsCollector transferStatistics;
+
+// Buffers that stay on the device between calls, created with the IgorCLBuffer operation and referred to by an integer ID.
+// A kernel argument uses a resident buffer if its wave holds the ID and its memflags include IgorCLIsResidentBuffer.
+struct IgorCLResidentBuffer {
+    int platformIndex;
+    int deviceIndex;
+    cl::Context context;
+    cl::Device device;
+    cl::Buffer buffer;
+    size_t sizeInBytes;
+};
+
+class IgorCLResidentBufferRegistry {
+public:
+    IgorCLResidentBufferRegistry() : _nextBufferID(1) {;}
+    ~IgorCLResidentBufferRegistry() {;}
+    
+    int createBuffer(const int platformIndex, const int deviceIndex, const size_t sizeInBytes, const void* initialData);
+    IgorCLResidentBuffer getBuffer(const int bufferID);
+    // the buffer, moved to the given device first if it currently lives elsewhere.
+    IgorCLResidentBuffer getBufferOnDevice(const int bufferID, const int platformIndex, const int deviceIndex);
+    void readBuffer(const int bufferID, void* destination, const size_t nBytes);
+    
+    // Within a shared context, migrate uses clEnqueueMigrateMemObjects and copy uses enqueueCopyBuffer.
+    // Between contexts the contents are staged through pinned host memory.
+    void migrateBuffer(const int bufferID, const int platformIndex, const int deviceIndex);
+    int copyBuffer(const int bufferID, const int platformIndex, const int deviceIndex);
+    
+    void releaseBuffer(const int bufferID);
+    void clear();
+    
+private:
+    struct Entry {
+        IgorCLResidentBuffer buffer;
+        // held for the whole of a migration, copy or read, so that these are serialized per buffer
+        // without holding _bufferMutex while the device works.
+        std::shared_ptr<std::mutex> entryMutex;
+    };
+    
+    IgorCLResidentBuffer _migrateBuffer(const int bufferID, const int platformIndex, const int deviceIndex);
+    IgorCLResidentBuffer _transferBuffer(const IgorCLResidentBuffer& source, const int platformIndex, const int deviceIndex, const bool makeCopy);
+    int _addBuffer(const IgorCLResidentBuffer& buffer);
+    std::shared_ptr<std::mutex> _entryMutex(const int bufferID);
+    
+    std::map<int, Entry> _buffers;
+    int _nextBufferID;
+    
+    std::mutex _bufferMutex;
+};
+
+extern IgorCLResidentBufferRegistry residentBuffers;
+
+// Cache of built programs, keyed on context, device, program source or binary, and build options. Programs are only built for
+// the requested device, also when a shared context spans other devices, since building for every device of the context
+// would compile for devices that the call never uses and fail the call if any of them cannot build the program.
+// Concurrent requests for the same key are coalesced: the first caller builds the program
+// and the others wait for its result. If the build fails then all of them receive the error,
+// and the entry is removed so that a later call tries again.
+class IgorCLProgramCache {
+public:
+    IgorCLProgramCache() : _nextBuildID(0) {;}
+    ~IgorCLProgramCache() {;}
+    
+    // exactly one of sourceText or sourceBinary must be non-NULL.
+    cl::Program getProgram(const int platformIndex, const int deviceIndex, const std::string* sourceText, const std::vector<char>* sourceBinary, const std::string& buildOptions = std::string());
+    // builds a program that is only needed once, e.g. to inspect its kernels, without taking a slot in the cache.
+    // The build log of a failed build is only reported if reportBuildLog is set.
+    cl::Program buildUncachedProgram(const int platformIndex, const int deviceIndex, const std::string& sourceText, const std::string& buildOptions, const bool reportBuildLog);
+    void clear();
+    
+private:
+    struct ProgramKey {
+        cl_context context;     // kept alive by the cached program
+        int deviceIndex;
+        bool isBinary;
+        std::string source;
+        std::string buildOptions;
+        
+        bool operator<(const ProgramKey& other) const;
+    };
+    struct ProgramEntry {
+        std::shared_future<cl::Program> program;
+        unsigned long buildID;
+    };
+    
+    static const size_t kMaxCachedPrograms = 64;
+    
+    cl::Program _buildProgram(const cl::Context& context, const cl::Device& device, const std::string* sourceText, const std::vector<char>* sourceBinary, const std::string& buildOptions, const bool reportBuildLog);
+    
+    std::map<ProgramKey, ProgramEntry> _programs;
+    std::deque<ProgramKey> _insertionOrder;
+    unsigned long _nextBuildID;
+    
+    std::mutex _programMutex;
+};
+
+extern IgorCLProgramCache programCache;
+
+// Cost model for automatic device selection (/DTYP=AUTO). The predicted time of a call on a device is
+//   launch latency + bytes to device / h2d bandwidth + bytes from device / d2h bandwidth + time per work item * work items.
+// Latency and bandwidths are calibrated once per device, the first time the device is considered. The time per work item
+// is a moving average over past calls with the same kernel (program source and kernel name) on that device.
+class IgorCLDeviceCostModel {
+public:
+    IgorCLDeviceCostModel() {;}
+    ~IgorCLDeviceCostModel() {;}
+    
+    // the physical device with the lowest predicted time, among the devices on which the kernel has not failed.
+    // Devices that have no timings for this kernel yet are tried first. Devices are calibrated the first time they are
+    // considered, a device that fails calibration is left out for every kernel until clear().
+    int selectDevice(const int platformIndex, const size_t kernelHash, const double bytesToDevice, const double bytesFromDevice, const double nWorkItems);
+    void recordExecution(const int platformIndex, const int deviceIndex, const size_t kernelHash, const double bytesToDevice, const double bytesFromDevice, const double nWorkItems, const double elapsedSeconds);
+    // the kernel failed on this device (e.g. it does not build there, or CL_OUT_OF_RESOURCES), so that selectDevice() no longer
+    // picks the device for it. Returns false if the kernel has now failed on every device that could be calibrated, in which
+    // case its failures are forgotten and a later call tries all devices again.
+    bool recordFailure(const int platformIndex, const int deviceIndex, const size_t kernelHash);
+    
+    // replaces the calibration of a device, e.g. with values measured by a benchmark.
+    void setCalibration(const int platformIndex, const int deviceIndex, const double launchLatency, const double h2dBandwidth, const double d2hBandwidth);
+    void clear();
+    
+    static size_t kernelHash(const std::string& programSource, const std::string& kernelName);
+    
+private:
+    struct DeviceCalibration {
+        double launchLatency;       // seconds
+        double h2dBandwidth;        // bytes per second
+        double d2hBandwidth;        // bytes per second
+        bool isUsable;              // false if the calibration failed
+    };
+    struct KernelTiming {
+        int nCalls;
+        double secondsPerWorkItem;  // only valid if nCalls > 1, the first call includes building the program
+    };
+    typedef std::pair<int, int> DeviceIndices;
+    
+    DeviceCalibration _getCalibration(const int platformIndex, const int deviceIndex);
+    bool _isUnusable(const DeviceIndices& indices) const;       // _costMutex must be held by the caller
+    static DeviceCalibration _calibrateDevice(const int platformIndex, const int deviceIndex);
+    
+    std::map<DeviceIndices, DeviceCalibration> _calibrations;
+    std::map<std::pair<size_t, DeviceIndices>, KernelTiming> _kernelTimings;
+    std::set<std::pair<size_t, DeviceIndices> > _kernelFailures;
+    
+    std::mutex _costMutex;
+};
+
+extern IgorCLDeviceCostModel costModel;
+
+// the ways in which DoOpenCLCalculation can move wave data to and from a device
+enum IgorCLTransferStrategy {
+    IgorCLTransferDefault = 0,      // enqueueWriteBuffer / enqueueReadBuffer from wave memory
+    IgorCLTransferPinned,           // staged through pinned memory (IgorCLUsePinnedMemory)
+    IgorCLTransferHostPointer,      // wave memory used by the device in place (IgorCLUseHostPointer)
+    IgorCLNTransferStrategies
+};
+
+// Calibration of a single device, as measured by IgorCLBench. Times are in seconds, bandwidths in bytes per second.
+struct IgorCLDeviceCalibrationRecord {
+    int platformIndex;
+    int deviceIndex;
+    double launchLatency;
+    double finishLatency;
+    double compileTime;
+    double h2dBandwidth[IgorCLNTransferStrategies];
+    double d2hBandwidth[IgorCLNTransferStrategies];
+};
+
+// Calibration files are plain text with one line per device, lines starting with '#' are comments.
+// The path is an Igor-style or native path.
+void WriteCalibrationFile(const std::string& filePath, const std::vector<IgorCLDeviceCalibrationRecord>& records);
+std::vector<IgorCLDeviceCalibrationRecord> ReadCalibrationFile(const std::string& filePath);
+
 std::string OpenCLErrorCodeToSymbolicName(int errorCode);
 
 
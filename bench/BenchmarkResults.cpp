@@ -0,0 +1,207 @@
+/*
+IgorCL - an XOP to use OpenCL in Igor Pro
+Copyright(C) 2013-2017 Peter Dedecker
+
+This program is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see <http://www.gnu.org/licenses/>.
+
+The developer(s) of this software hereby grants permission to link
+this program with Igor Pro, developed by WaveMetrics Inc. (www.wavemetrics.com).
+*/
+
+#include "BenchmarkResults.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+double Median(std::vector<double> values) {
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    size_t n = values.size();
+    return (n % 2) ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+}
+
+static std::string JSONString(const std::string& str) {
+    std::string escaped("\"");
+    for (size_t i = 0; i < str.size(); ++i) {
+        char c = str[i];
+        if ((c == '"') || (c == '\\')) {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char hex[8];
+            sprintf(hex, "\\u%04x", c);
+            escaped += hex;
+        } else {
+            escaped += c;
+        }
+    }
+    escaped += '"';
+    return escaped;
+}
+
+void WriteBenchmarkJSON(std::ostream& out, const BenchmarkRunInfo& runInfo, const std::vector<BenchmarkResult>& results) {
+    out.precision(9);
+    out << "{\n";
+    out << "  \"suite\": " << JSONString(runInfo.suite) << ",\n";
+    out << "  \"platform_index\": " << runInfo.platformIndex << ",\n";
+    out << "  \"device_index\": " << runInfo.deviceIndex << ",\n";
+    out << "  \"platform\": " << JSONString(runInfo.platformName) << ",\n";
+    out << "  \"device\": " << JSONString(runInfo.deviceName) << ",\n";
+    out << "  \"repeats\": " << runInfo.nRepeats << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult& result = results[i];
+        double mean = 0, variance = 0;
+        for (size_t j = 0; j < result.samples.size(); ++j) {
+            mean += result.samples[j] / result.samples.size();
+        }
+        for (size_t j = 0; j < result.samples.size(); ++j) {
+            variance += (result.samples[j] - mean) * (result.samples[j] - mean) / std::max<size_t>(result.samples.size() - 1, 1);
+        }
+        double median = Median(result.samples);
+        
+        out << "    {\"name\": " << JSONString(result.name) << ", \"bytes\": " << result.bytes;
+        out << ", \"min_s\": " << *std::min_element(result.samples.begin(), result.samples.end()) << ", \"median_s\": " << median;
+        out << ", \"mean_s\": " << mean << ", \"stddev_s\": " << std::sqrt(variance);
+        if (result.bytes > 0)
+            out << ", \"bandwidth_bytes_per_s\": " << result.bytes / median;
+        out << ", \"samples_s\": [";
+        for (size_t j = 0; j < result.samples.size(); ++j) {
+            out << ((j > 0) ? ", " : "") << result.samples[j];
+        }
+        out << "]}" << ((i + 1 < results.size()) ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+// Not a general JSON parser: it relies on every result object having a "name" string followed by a "samples_s" array,
+// which holds for files written by WriteBenchmarkJSON.
+std::vector<BenchmarkResult> ReadBenchmarkJSON(const std::string& filePath) {
+    std::ifstream file(filePath.c_str());
+    if (!file)
+        throw std::runtime_error("Unable to open " + filePath);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::string json = contents.str();
+    
+    std::vector<BenchmarkResult> results;
+    const std::string nameKey("\"name\":"), samplesKey("\"samples_s\":");
+    size_t position = 0;
+    while ((position = json.find(nameKey, position)) != std::string::npos) {
+        BenchmarkResult result;
+        result.bytes = 0;
+        
+        size_t nameStart = json.find('"', position + nameKey.size());
+        if (nameStart == std::string::npos)
+            throw std::runtime_error("Invalid result name in " + filePath);
+        size_t i = nameStart + 1;
+        for (; (i < json.size()) && (json[i] != '"'); ++i) {
+            if ((json[i] == '\\') && (i + 1 < json.size()))
+                ++i;
+            result.name += json[i];
+        }
+        
+        size_t samplesStart = json.find(samplesKey, i);
+        size_t arrayStart = (samplesStart == std::string::npos) ? std::string::npos : json.find('[', samplesStart);
+        size_t arrayEnd = (arrayStart == std::string::npos) ? std::string::npos : json.find(']', arrayStart);
+        if (arrayEnd == std::string::npos)
+            throw std::runtime_error("Missing samples for " + result.name + " in " + filePath);
+        std::string samples = json.substr(arrayStart + 1, arrayEnd - arrayStart - 1);
+        std::replace(samples.begin(), samples.end(), ',', ' ');
+        std::istringstream samplesStream(samples);
+        double sample;
+        while (samplesStream >> sample) {
+            result.samples.push_back(sample);
+        }
+        
+        results.push_back(result);
+        position = arrayEnd;
+    }
+    
+    return results;
+}
+
+// one-sided p-value for the hypothesis that the current samples are larger than the baseline samples,
+// using the normal approximation of the U statistic with a correction for ties
+static double MannWhitneyPValue(const std::vector<double>& current, const std::vector<double>& baseline) {
+    size_t n1 = current.size(), n2 = baseline.size();
+    if ((n1 == 0) || (n2 == 0))
+        return 1;
+    
+    std::vector<std::pair<double, int> > pooled;
+    for (size_t i = 0; i < n1; ++i) {
+        pooled.push_back(std::make_pair(current[i], 0));
+    }
+    for (size_t i = 0; i < n2; ++i) {
+        pooled.push_back(std::make_pair(baseline[i], 1));
+    }
+    std::sort(pooled.begin(), pooled.end());
+    
+    // average ranks for ties
+    double rankSumCurrent = 0, tieCorrection = 0;
+    size_t n = pooled.size();
+    for (size_t i = 0; i < n; ) {
+        size_t j = i;
+        while ((j < n) && (pooled[j].first == pooled[i].first))
+            ++j;
+        double averageRank = 0.5 * (i + 1 + j);
+        double nTied = j - i;
+        tieCorrection += nTied * nTied * nTied - nTied;
+        for (size_t k = i; k < j; ++k) {
+            if (pooled[k].second == 0)
+                rankSumCurrent += averageRank;
+        }
+        i = j;
+    }
+    
+    double u = rankSumCurrent - n1 * (n1 + 1) / 2.0;
+    double meanU = n1 * n2 / 2.0;
+    double varianceU = n1 * n2 / 12.0 * ((n + 1) - tieCorrection / (static_cast<double>(n) * (n - 1)));
+    if (varianceU <= 0)
+        return 1;
+    double z = (u - meanU - 0.5) / std::sqrt(varianceU);     // continuity correction
+    return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+std::vector<BaselineComparison> CompareWithBaseline(const std::vector<BenchmarkResult>& results, const std::vector<BenchmarkResult>& baseline, const double alpha, const double minSlowdown) {
+    std::vector<BaselineComparison> comparisons;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult* baselineResult = NULL;
+        for (size_t j = 0; j < baseline.size(); ++j) {
+            if (baseline[j].name == results[i].name) {
+                baselineResult = &baseline[j];
+                break;
+            }
+        }
+        if ((baselineResult == NULL) || (Median(baselineResult->samples) <= 0))
+            continue;   // a new scenario, nothing to compare with
+        
+        BaselineComparison comparison;
+        comparison.name = results[i].name;
+        comparison.baselineMedian = Median(baselineResult->samples);
+        comparison.currentMedian = Median(results[i].samples);
+        comparison.relativeChange = (comparison.currentMedian - comparison.baselineMedian) / comparison.baselineMedian;
+        comparison.pValue = MannWhitneyPValue(results[i].samples, baselineResult->samples);
+        comparison.isRegression = (comparison.pValue < alpha) && (comparison.relativeChange > minSlowdown);
+        comparisons.push_back(comparison);
+    }
+    return comparisons;
+}
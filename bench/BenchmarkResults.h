@@ -0,0 +1,63 @@
+/*
+IgorCL - an XOP to use OpenCL in Igor Pro
+Copyright(C) 2013-2017 Peter Dedecker
+
+This program is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see <http://www.gnu.org/licenses/>.
+
+The developer(s) of this software hereby grants permission to link
+this program with Igor Pro, developed by WaveMetrics Inc. (www.wavemetrics.com).
+*/
+
+#ifndef IgorCL_BenchmarkResults_h
+#define IgorCL_BenchmarkResults_h
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct BenchmarkResult {
+    std::string name;
+    double bytes;                   // bytes moved between host and device per call
+    std::vector<double> samples;    // seconds, one per repeat
+};
+
+struct BenchmarkRunInfo {
+    int platformIndex;
+    int deviceIndex;
+    std::string platformName;
+    std::string deviceName;
+    std::string suite;
+    int nRepeats;
+};
+
+void WriteBenchmarkJSON(std::ostream& out, const BenchmarkRunInfo& runInfo, const std::vector<BenchmarkResult>& results);
+// reads the names and samples of a file written by WriteBenchmarkJSON
+std::vector<BenchmarkResult> ReadBenchmarkJSON(const std::string& filePath);
+
+// A scenario is flagged as a regression if it is slower than the baseline according to a one-sided
+// Mann-Whitney U test at significance level alpha, and its median is more than minSlowdown (relative) above the baseline median.
+struct BaselineComparison {
+    std::string name;
+    double baselineMedian;
+    double currentMedian;
+    double relativeChange;          // (current - baseline) / baseline
+    double pValue;
+    bool isRegression;
+};
+
+std::vector<BaselineComparison> CompareWithBaseline(const std::vector<BenchmarkResult>& results, const std::vector<BenchmarkResult>& baseline, const double alpha, const double minSlowdown);
+
+double Median(std::vector<double> values);
+
+#endif
@@ -0,0 +1,416 @@
+/*
+IgorCL - an XOP to use OpenCL in Igor Pro
+Copyright(C) 2013-2017 Peter Dedecker
+
+This program is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see <http://www.gnu.org/licenses/>.
+
+The developer(s) of this software hereby grants permission to link
+this program with Igor Pro, developed by WaveMetrics Inc. (www.wavemetrics.com).
+*/
+
+// Runs representative kernels and transfer patterns through the IgorCL execution core and reports the timings as JSON.
+// Usage: IgorCLBenchmark [--platform n] [--device n | --device-type CPU|GPU|ACCELERATOR] [--repeats n] [--output file]
+//                        [--suite default|regression] [--baseline file] [--alpha p] [--threshold fraction]
+// With --baseline, every scenario is compared with the same scenario in the baseline file, and the exit status is 2
+// if any scenario is significantly slower.
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "XOPStandardHeaders.h"
+#include "IgorCLOperations.h"
+#include "IgorCLUtilities.h"
+#include "IgorCLConstants.h"
+#include "BenchmarkResults.h"
+
+static const char* kBenchmarkSource =
+    "__kernel void Empty(__global float* data) {}\n"
+    "__kernel void VectorAdd(__global const float* a, __global const float* b, __global float* c) {\n"
+    "    size_t i = get_global_id(0);\n"
+    "    c[i] = a[i] + b[i];\n"
+    "}\n"
+    "__kernel void Scale(__global float* data) {\n"
+    "    size_t i = get_global_id(0);\n"
+    "    data[i] = 2.0f * data[i] + 1.0f;\n"
+    "}\n";
+
+struct BenchmarkSettings {
+    int platformIndex;
+    int deviceIndex;
+    std::string deviceType;
+    int nRepeats;
+    std::string suite;
+    std::string outputPath;
+    std::string baselinePath;
+    double alpha;
+    double threshold;
+};
+
+// waves made with the stand-in are released when this goes out of scope
+class BenchmarkWaves {
+public:
+    BenchmarkWaves() {;}
+    BenchmarkWaves(const BenchmarkWaves&) = delete;
+    BenchmarkWaves& operator=(const BenchmarkWaves&) = delete;
+    ~BenchmarkWaves() {
+        for (size_t i = 0; i < waves.size(); ++i) {
+            IgorCLStandInKillWave(waves[i]);
+        }
+    }
+    
+    waveHndl makeFloatWave(const size_t nPoints, const float value) {
+        CountInt dimensionSizes[MAX_DIMENSIONS + 1] = {static_cast<CountInt>(nPoints), 0, 0, 0, 0};
+        waveHndl wave;
+        int err = MDMakeWave(&wave, "benchmarkWave", NULL, dimensionSizes, NT_FP32, 1);
+        if (err)
+            throw err;
+        float* data = static_cast<float*>(WaveData(wave));
+        std::fill(data, data + nPoints, value);
+        waves.push_back(wave);
+        return wave;
+    }
+    
+    std::vector<waveHndl> waves;
+};
+
+static double SecondsSince(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void RunCalculation(const BenchmarkSettings& settings, const std::string& kernelName, const size_t nWorkItems, const std::vector<waveHndl>& waves, const std::vector<int>& memFlags) {
+    static const std::vector<double> fillValues;
+    static const std::vector<IgorCLScalarArgument> scalarArgs;
+    static const std::string source(kBenchmarkSource);
+    DoOpenCLCalculation(settings.platformIndex, settings.deviceIndex, cl::NDRange(nWorkItems), cl::NullRange, kernelName, waves, memFlags, fillValues, scalarArgs, source);
+}
+
+// one untimed call to build the program and warm up the queues, then nRepeats timed calls of nCallsPerSample calculations
+static BenchmarkResult TimeCalculation(const BenchmarkSettings& settings, const std::string& name, const std::string& kernelName, const size_t nWorkItems,
+                                       const std::vector<waveHndl>& waves, const std::vector<int>& memFlags, const double bytes, const int nCallsPerSample = 1) {
+    BenchmarkResult result;
+    result.name = name;
+    result.bytes = bytes * nCallsPerSample;
+    RunCalculation(settings, kernelName, nWorkItems, waves, memFlags);
+    for (int i = 0; i < settings.nRepeats; ++i) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int j = 0; j < nCallsPerSample; ++j) {
+            RunCalculation(settings, kernelName, nWorkItems, waves, memFlags);
+        }
+        result.samples.push_back(SecondsSince(start));
+    }
+    return result;
+}
+
+static BenchmarkResult BenchmarkLaunch(const BenchmarkSettings& settings, const std::string& name, const int nCallsPerSample) {
+    BenchmarkWaves waves;
+    waves.makeFloatWave(1, 0);
+    return TimeCalculation(settings, name, "Empty", 1, waves.waves, std::vector<int>(1, IgorCLReadWrite), 0, nCallsPerSample);
+}
+
+static BenchmarkResult BenchmarkVectorAdd(const BenchmarkSettings& settings, const size_t nPoints) {
+    BenchmarkWaves waves;
+    waves.makeFloatWave(nPoints, 1);
+    waves.makeFloatWave(nPoints, 2);
+    waves.makeFloatWave(nPoints, 0);
+    std::vector<int> memFlags;
+    memFlags.push_back(IgorCLReadOnly);
+    memFlags.push_back(IgorCLReadOnly);
+    memFlags.push_back(IgorCLWriteOnly);
+    std::ostringstream name;
+    name << "vector_add/" << nPoints;
+    return TimeCalculation(settings, name.str(), "VectorAdd", nPoints, waves.waves, memFlags, 3.0 * nPoints * sizeof(float));
+}
+
+static BenchmarkResult BenchmarkTransfer(const BenchmarkSettings& settings, const std::string& strategy, const int memFlag, const size_t nPoints) {
+    BenchmarkWaves waves;
+    waves.makeFloatWave(nPoints, 1);
+    std::ostringstream name;
+    name << "transfer/" << strategy << "/" << nPoints;
+    return TimeCalculation(settings, name.str(), "Scale", nPoints, waves.waves, std::vector<int>(1, memFlag), 2.0 * nPoints * sizeof(float));
+}
+
+// unique sources are never found in a driver cache, repeated sources may be
+// a unique source also has to differ between runs of the harness, otherwise a driver cache that persists on disk is hit
+static BenchmarkResult BenchmarkCompile(const BenchmarkSettings& settings, const std::string& name, const bool uniqueSource) {
+    static const long long processNonce = std::chrono::system_clock::now().time_since_epoch().count();
+    BenchmarkResult result;
+    result.name = name;
+    result.bytes = 0;
+    std::string buildLog;
+    for (int i = 0; i <= settings.nRepeats; ++i) {
+        std::ostringstream source;
+        if (uniqueSource)
+            source << "// build " << processNonce << " " << i << "\n";
+        source << kBenchmarkSource;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        CompileSource(settings.platformIndex, settings.deviceIndex, source.str(), buildLog);
+        if (i > 0)
+            result.samples.push_back(SecondsSince(start));
+    }
+    return result;
+}
+
+// nThreads threads that each submit nCallsPerThread small calculations, timed from start to the last finish
+static BenchmarkResult BenchmarkMultiThreadedSubmission(const BenchmarkSettings& settings, const int nThreads, const int nCallsPerThread) {
+    const size_t nPoints = 1 << 12;
+    std::vector<BenchmarkWaves> waves(nThreads);
+    for (int i = 0; i < nThreads; ++i) {
+        waves[i].makeFloatWave(nPoints, 1);
+    }
+    std::vector<int> memFlags(1, IgorCLReadWrite);
+    RunCalculation(settings, "Scale", nPoints, waves[0].waves, memFlags);
+    
+    BenchmarkResult result;
+    std::ostringstream name;
+    name << "multithreaded_submission/" << nThreads << "x" << nCallsPerThread;
+    result.name = name.str();
+    result.bytes = 2.0 * nPoints * sizeof(float) * nThreads * nCallsPerThread;
+    for (int i = 0; i < settings.nRepeats; ++i) {
+        std::vector<std::thread> threads;
+        std::vector<std::string> errors(nThreads);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int j = 0; j < nThreads; ++j) {
+            threads.push_back(std::thread([&, j]() {
+                try {
+                    for (int k = 0; k < nCallsPerThread; ++k) {
+                        RunCalculation(settings, "Scale", nPoints, waves[j].waves, memFlags);
+                    }
+                }
+                catch (IgorCLError& e) {
+                    errors[j] = "OpenCL error code " + std::to_string(e.getErrorCode());
+                }
+                catch (...) {
+                    errors[j] = "error in submission thread";
+                }
+            }));
+        }
+        for (int j = 0; j < nThreads; ++j) {
+            threads[j].join();
+        }
+        result.samples.push_back(SecondsSince(start));
+        for (int j = 0; j < nThreads; ++j) {
+            if (!errors[j].empty())
+                throw std::runtime_error(errors[j]);
+        }
+    }
+    return result;
+}
+
+// nThreads threads that each look up the context, the built program and a command queue nLookupsPerThread times,
+// as every IgorCL call does before it enqueues anything. No work is enqueued, so only the cost of the shared
+// caches and the queue factory (and any contention on them) is timed.
+static BenchmarkResult BenchmarkLookupContention(const BenchmarkSettings& settings, const int nThreads, const int nLookupsPerThread) {
+    static const std::string source(kBenchmarkSource);
+    programCache.getProgram(settings.platformIndex, settings.deviceIndex, &source, NULL);
+    
+    BenchmarkResult result;
+    std::ostringstream name;
+    name << "lookup_contention/" << nThreads;
+    result.name = name.str();
+    result.bytes = 0;
+    for (int i = 0; i < settings.nRepeats; ++i) {
+        std::vector<std::thread> threads;
+        std::vector<std::string> errors(nThreads);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int j = 0; j < nThreads; ++j) {
+            threads.push_back(std::thread([&, j]() {
+                try {
+                    for (int k = 0; k < nLookupsPerThread; ++k) {
+                        cl::Context context;
+                        cl::Device device;
+                        contextAndDeviceProvider.getContextForPlatformAndDevice(settings.platformIndex, settings.deviceIndex, context, device);
+                        cl::Program program = programCache.getProgram(settings.platformIndex, settings.deviceIndex, &source, NULL);
+                        IgorCLCommandQueueProvider commandQueueProvider(settings.platformIndex, settings.deviceIndex);
+                        cl::CommandQueue commandQueue = commandQueueProvider.getCommandQueue();
+                    }
+                }
+                catch (IgorCLError& e) {
+                    errors[j] = "OpenCL error code " + std::to_string(e.getErrorCode());
+                }
+                catch (...) {
+                    errors[j] = "error in lookup thread";
+                }
+            }));
+        }
+        for (int j = 0; j < nThreads; ++j) {
+            threads[j].join();
+        }
+        result.samples.push_back(SecondsSince(start));
+        for (int j = 0; j < nThreads; ++j) {
+            if (!errors[j].empty())
+                throw std::runtime_error(errors[j]);
+        }
+    }
+    return result;
+}
+
+static std::vector<BenchmarkResult> RunDefaultSuite(const BenchmarkSettings& settings) {
+    std::vector<BenchmarkResult> results;
+    results.push_back(BenchmarkLaunch(settings, "launch", 1));
+    results.push_back(BenchmarkCompile(settings, "compile", true));
+    for (size_t nPoints = 1 << 10; nPoints <= (1 << 24); nPoints *= 16) {
+        results.push_back(BenchmarkVectorAdd(settings, nPoints));
+    }
+    for (size_t nPoints = 1 << 16; nPoints <= (1 << 24); nPoints *= 16) {
+        results.push_back(BenchmarkTransfer(settings, "default", IgorCLReadWrite, nPoints));
+        results.push_back(BenchmarkTransfer(settings, "pinned", IgorCLReadWrite | IgorCLUsePinnedMemory, nPoints));
+        results.push_back(BenchmarkTransfer(settings, "host_pointer", IgorCLReadWrite | IgorCLUseHostPointer, nPoints));
+    }
+    for (int nThreads = 1; nThreads <= 8; nThreads *= 2) {
+        results.push_back(BenchmarkLookupContention(settings, nThreads, 10000));
+    }
+    return results;
+}
+
+// canonical workloads that guard against performance regressions
+static std::vector<BenchmarkResult> RunRegressionSuite(const BenchmarkSettings& settings) {
+    const size_t nStreamingPoints = 1 << 24;
+    const size_t nTransferPoints = 1 << 22;
+    std::vector<BenchmarkResult> results;
+    results.push_back(BenchmarkLaunch(settings, "launch_storm/200", 200));
+    results.push_back(BenchmarkTransfer(settings, "streaming", IgorCLReadWrite, nStreamingPoints));
+    results.push_back(BenchmarkTransfer(settings, "pageable", IgorCLReadWrite, nTransferPoints));
+    results.push_back(BenchmarkTransfer(settings, "pinned", IgorCLReadWrite | IgorCLUsePinnedMemory, nTransferPoints));
+    results.push_back(BenchmarkCompile(settings, "compile/repeated", false));
+    results.push_back(BenchmarkCompile(settings, "compile/unique", true));
+    results.push_back(BenchmarkMultiThreadedSubmission(settings, 4, 50));
+    return results;
+}
+
+static BenchmarkSettings ParseArguments(int argc, char* argv[]) {
+    BenchmarkSettings settings;
+    settings.platformIndex = 0;
+    settings.deviceIndex = 0;
+    settings.nRepeats = 10;
+    settings.suite = "default";
+    settings.alpha = 0.01;
+    settings.threshold = 0.05;
+    for (int i = 1; i < argc; ++i) {
+        std::string argument(argv[i]);
+        if (i + 1 >= argc)
+            throw std::runtime_error("Missing value for " + argument);
+        std::string value(argv[++i]);
+        if (argument == "--platform") {
+            settings.platformIndex = atoi(value.c_str());
+        } else if (argument == "--device") {
+            settings.deviceIndex = atoi(value.c_str());
+        } else if (argument == "--device-type") {
+            settings.deviceType = value;
+        } else if (argument == "--repeats") {
+            settings.nRepeats = atoi(value.c_str());
+        } else if (argument == "--suite") {
+            settings.suite = value;
+        } else if (argument == "--output") {
+            settings.outputPath = value;
+        } else if (argument == "--baseline") {
+            settings.baselinePath = value;
+        } else if (argument == "--alpha") {
+            settings.alpha = atof(value.c_str());
+        } else if (argument == "--threshold") {
+            settings.threshold = atof(value.c_str());
+        } else {
+            throw std::runtime_error("Unknown argument " + argument);
+        }
+    }
+    if ((settings.platformIndex < 0) || (settings.deviceIndex < 0) || (settings.nRepeats < 1))
+        throw std::runtime_error("The platform and device indices must be positive, and there must be at least one repeat");
+    if ((settings.suite != "default") && (settings.suite != "regression"))
+        throw std::runtime_error("Unknown suite " + settings.suite);
+    if (!settings.deviceType.empty())
+        settings.deviceIndex = GetFirstDeviceOfType(settings.platformIndex, settings.deviceType);
+    return settings;
+}
+
+// prints the comparison to stderr and returns the number of regressions
+static int ReportBaselineComparison(const std::vector<BaselineComparison>& comparisons) {
+    int nRegressions = 0;
+    for (size_t i = 0; i < comparisons.size(); ++i) {
+        const BaselineComparison& comparison = comparisons[i];
+        char line[256];
+        snprintf(line, sizeof(line), "%-40s %12.6g s -> %12.6g s  %+7.1f%%  p = %.3g%s", comparison.name.c_str(), comparison.baselineMedian, comparison.currentMedian,
+                 100 * comparison.relativeChange, comparison.pValue, comparison.isRegression ? "  REGRESSION" : "");
+        std::cerr << line << std::endl;
+        if (comparison.isRegression)
+            nRegressions += 1;
+    }
+    return nRegressions;
+}
+
+int main(int argc, char* argv[]) {
+    int nRegressions = 0;
+    try {
+        BenchmarkSettings settings = ParseArguments(argc, argv);
+        
+        // the baseline is read first, so that a missing baseline does not cost a full run of the suite
+        std::vector<BenchmarkResult> baseline;
+        if (!settings.baselinePath.empty()) {
+            if (!std::ifstream(settings.baselinePath.c_str()))
+                throw std::runtime_error("No baseline at " + settings.baselinePath + ", record one with --output (the regression_baseline target)");
+            baseline = ReadBenchmarkJSON(settings.baselinePath);
+        }
+        
+        cl::Context context;
+        cl::Device device;
+        contextAndDeviceProvider.getContextForPlatformAndDevice(settings.platformIndex, settings.deviceIndex, context, device);
+        BenchmarkRunInfo runInfo;
+        runInfo.platformIndex = settings.platformIndex;
+        runInfo.deviceIndex = settings.deviceIndex;
+        runInfo.platformName = deviceTable.getPlatform(settings.platformIndex).getInfo<CL_PLATFORM_NAME>();
+        runInfo.deviceName = device.getInfo<CL_DEVICE_NAME>();
+        runInfo.suite = settings.suite;
+        runInfo.nRepeats = settings.nRepeats;
+        
+        std::vector<BenchmarkResult> results = (settings.suite == "regression") ? RunRegressionSuite(settings) : RunDefaultSuite(settings);
+        
+        if (settings.outputPath.empty()) {
+            WriteBenchmarkJSON(std::cout, runInfo, results);
+        } else {
+            std::ofstream out(settings.outputPath.c_str());
+            WriteBenchmarkJSON(out, runInfo, results);
+            if (!out)
+                throw std::runtime_error("Unable to write " + settings.outputPath);
+        }
+        
+        if (!settings.baselinePath.empty()) {
+            nRegressions = ReportBaselineComparison(CompareWithBaseline(results, baseline, settings.alpha, settings.threshold));
+        }
+        
+        submissionThreads.stopAll();
+        commandQueueFactory.deleteAllCommandQueues();
+        programCache.clear();
+    }
+    catch (IgorCLError& e) {
+        std::cerr << "OpenCL error code " << e.getErrorCode() << " (" << OpenCLErrorCodeToSymbolicName(e.getErrorCode()) << ")" << std::endl;
+        return 1;
+    }
+    catch (int e) {
+        std::cerr << "error code " << e << std::endl;
+        return 1;
+    }
+    catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    
+    return (nRegressions > 0) ? 2 : 0;
+}
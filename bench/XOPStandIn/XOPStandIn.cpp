@@ -0,0 +1,320 @@
+/*
+IgorCL - an XOP to use OpenCL in Igor Pro
+Copyright(C) 2013-2017 Peter Dedecker
+
+This program is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see <http://www.gnu.org/licenses/>.
+
+The developer(s) of this software hereby grants permission to link
+this program with Igor Pro, developed by WaveMetrics Inc. (www.wavemetrics.com).
+*/
+
+#include "XOPStandardHeaders.h"
+
+#include <string>
+#include <vector>
+
+struct IgorCLStandInWave {
+    std::string name;
+    int type;
+    int numDimensions;
+    CountInt dimensionSizes[MAX_DIMENSIONS + 1];
+    std::vector<double> storage;            // numeric data, as doubles for alignment
+    std::vector<std::string> textPoints;    // text waves only
+};
+
+// a handle points to the data pointer, which is preceded by the size of the block
+struct StandInHandle {
+    char* data;
+    BCInt size;
+};
+
+Handle NewHandle(BCInt size) {
+    StandInHandle* handle = new StandInHandle;
+    handle->data = static_cast<char*>(malloc(size > 0 ? size : 1));
+    handle->size = size;
+    if (handle->data == NULL) {
+        delete handle;
+        return NULL;
+    }
+    return &handle->data;
+}
+
+void DisposeHandle(Handle handle) {
+    if (handle == NULL)
+        return;
+    StandInHandle* standInHandle = reinterpret_cast<StandInHandle*>(handle);
+    free(standInHandle->data);
+    delete standInHandle;
+}
+
+BCInt GetHandleSize(Handle handle) {
+    return reinterpret_cast<StandInHandle*>(handle)->size;
+}
+
+int SetHandleSize(Handle handle, BCInt size) {
+    StandInHandle* standInHandle = reinterpret_cast<StandInHandle*>(handle);
+    char* data = static_cast<char*>(realloc(standInHandle->data, size > 0 ? size : 1));
+    if (data == NULL)
+        return NOMEM;
+    standInHandle->data = data;
+    standInHandle->size = size;
+    return 0;
+}
+
+int PutCStringInHandle(const char* str, Handle handle) {
+    BCInt length = strlen(str);
+    int err = SetHandleSize(handle, length);
+    if (err)
+        return err;
+    memcpy(*handle, str, length);
+    return 0;
+}
+
+int GetCStringFromHandle(Handle handle, char* str, int maxChars) {
+    BCInt length = GetHandleSize(handle);
+    int err = 0;
+    if (length > maxChars) {
+        length = maxChars;
+        err = GENERAL_BAD_VIBS;
+    }
+    memcpy(str, *handle, length);
+    str[length] = '\0';
+    return err;
+}
+
+static size_t BytesPerPoint(const int type) {
+    size_t nBytes;
+    switch (type & ~(NT_CMPLX | NT_UNSIGNED)) {
+        case NT_I8:
+            nBytes = 1; break;
+        case NT_I16:
+            nBytes = 2; break;
+        case NT_I32:
+        case NT_FP32:
+            nBytes = 4; break;
+        case NT_I64:
+        case NT_FP64:
+            nBytes = 8; break;
+        default:
+            nBytes = 0; break;
+    }
+    return (type & NT_CMPLX) ? 2 * nBytes : nBytes;
+}
+
+int WaveType(waveHndl wave) {
+    return wave->type;
+}
+
+CountInt WavePoints(waveHndl wave) {
+    CountInt nPoints = 1;
+    for (int i = 0; i < wave->numDimensions; ++i) {
+        nPoints *= wave->dimensionSizes[i];
+    }
+    return nPoints;
+}
+
+void* WaveData(waveHndl wave) {
+    return wave->storage.empty() ? NULL : static_cast<void*>(&wave->storage[0]);
+}
+
+void WaveHandleModified(waveHndl wave) {
+}
+
+int MDMakeWave(waveHndl* wavePtr, const char* waveName, DataFolderHandle dataFolder, CountInt dimensionSizes[MAX_DIMENSIONS + 1], int type, int overwrite) {
+    if ((type != TEXT_WAVE_TYPE) && (BytesPerPoint(type) == 0))
+        return NT_INCOMPATIBLE;
+    
+    IgorCLStandInWave* wave = new IgorCLStandInWave;
+    wave->name = waveName;
+    wave->type = type;
+    wave->numDimensions = 0;
+    for (int i = 0; i <= MAX_DIMENSIONS; ++i) {
+        wave->dimensionSizes[i] = 0;
+    }
+    for (int i = 0; (i < MAX_DIMENSIONS) && (dimensionSizes[i] != 0); ++i) {
+        wave->dimensionSizes[i] = dimensionSizes[i];
+        wave->numDimensions += 1;
+    }
+    if (wave->numDimensions == 0)
+        wave->numDimensions = 1;
+    
+    CountInt nPoints = WavePoints(wave);
+    if (type == TEXT_WAVE_TYPE) {
+        wave->textPoints.resize(nPoints);
+    } else {
+        size_t nBytes = nPoints * BytesPerPoint(type);
+        wave->storage.resize((nBytes + sizeof(double) - 1) / sizeof(double), 0.0);
+    }
+    *wavePtr = wave;
+    return 0;
+}
+
+void IgorCLStandInKillWave(waveHndl wave) {
+    delete wave;
+}
+
+int MDGetWaveDimensions(waveHndl wave, int* numDimensionsPtr, CountInt dimensionSizes[MAX_DIMENSIONS + 1]) {
+    *numDimensionsPtr = wave->numDimensions;
+    for (int i = 0; i <= MAX_DIMENSIONS; ++i) {
+        dimensionSizes[i] = wave->dimensionSizes[i];
+    }
+    return 0;
+}
+
+static int PointIndex(waveHndl wave, IndexInt indices[MAX_DIMENSIONS], CountInt& pointIndex) {
+    pointIndex = 0;
+    CountInt stride = 1;
+    for (int i = 0; i < wave->numDimensions; ++i) {
+        if ((indices[i] < 0) || (indices[i] >= wave->dimensionSizes[i]))
+            return INDEX_OUT_OF_RANGE;
+        pointIndex += indices[i] * stride;
+        stride *= wave->dimensionSizes[i];
+    }
+    return 0;
+}
+
+template <typename T> static void GetPoint(const void* data, const CountInt pointIndex, const bool isComplex, double value[2]) {
+    const T* typedData = static_cast<const T*>(data);
+    value[0] = isComplex ? typedData[2 * pointIndex] : typedData[pointIndex];
+    value[1] = isComplex ? typedData[2 * pointIndex + 1] : 0.0;
+}
+
+template <typename T> static void SetPoint(void* data, const CountInt pointIndex, const bool isComplex, const double value[2]) {
+    T* typedData = static_cast<T*>(data);
+    if (isComplex) {
+        typedData[2 * pointIndex] = static_cast<T>(value[0]);
+        typedData[2 * pointIndex + 1] = static_cast<T>(value[1]);
+    } else {
+        typedData[pointIndex] = static_cast<T>(value[0]);
+    }
+}
+
+int MDGetNumericWavePointValue(waveHndl wave, IndexInt indices[MAX_DIMENSIONS], double value[2]) {
+    CountInt pointIndex;
+    int err = PointIndex(wave, indices, pointIndex);
+    if (err)
+        return err;
+    bool isComplex = ((wave->type & NT_CMPLX) != 0);
+    switch (wave->type & ~NT_CMPLX) {
+        case NT_I8: GetPoint<int8_t>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_I8 | NT_UNSIGNED: GetPoint<uint8_t>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_I16: GetPoint<int16_t>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_I16 | NT_UNSIGNED: GetPoint<uint16_t>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_I32: GetPoint<int32_t>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_I32 | NT_UNSIGNED: GetPoint<uint32_t>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_I64: GetPoint<int64_t>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_I64 | NT_UNSIGNED: GetPoint<uint64_t>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_FP32: GetPoint<float>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_FP64: GetPoint<double>(WaveData(wave), pointIndex, isComplex, value); break;
+        default:
+            return NT_INCOMPATIBLE;
+    }
+    return 0;
+}
+
+int MDSetNumericWavePointValue(waveHndl wave, IndexInt indices[MAX_DIMENSIONS], double value[2]) {
+    CountInt pointIndex;
+    int err = PointIndex(wave, indices, pointIndex);
+    if (err)
+        return err;
+    bool isComplex = ((wave->type & NT_CMPLX) != 0);
+    switch (wave->type & ~NT_CMPLX) {
+        case NT_I8: SetPoint<int8_t>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_I8 | NT_UNSIGNED: SetPoint<uint8_t>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_I16: SetPoint<int16_t>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_I16 | NT_UNSIGNED: SetPoint<uint16_t>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_I32: SetPoint<int32_t>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_I32 | NT_UNSIGNED: SetPoint<uint32_t>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_I64: SetPoint<int64_t>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_I64 | NT_UNSIGNED: SetPoint<uint64_t>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_FP32: SetPoint<float>(WaveData(wave), pointIndex, isComplex, value); break;
+        case NT_FP64: SetPoint<double>(WaveData(wave), pointIndex, isComplex, value); break;
+        default:
+            return NT_INCOMPATIBLE;
+    }
+    return 0;
+}
+
+int MDGetDPDataFromNumericWave(waveHndl wave, double* dPtr) {
+    if (wave->type == TEXT_WAVE_TYPE)
+        return NT_INCOMPATIBLE;
+    
+    bool isComplex = ((wave->type & NT_CMPLX) != 0);
+    CountInt nPoints = WavePoints(wave);
+    IndexInt indices[MAX_DIMENSIONS] = {0, 0, 0, 0};
+    double value[2];
+    for (CountInt i = 0; i < nPoints; ++i) {
+        // walk the points in column-major order
+        int err = MDGetNumericWavePointValue(wave, indices, value);
+        if (err)
+            return err;
+        *dPtr++ = value[0];
+        if (isComplex)
+            *dPtr++ = value[1];
+        for (int dim = 0; (dim < wave->numDimensions) && (++indices[dim] == wave->dimensionSizes[dim]); ++dim) {
+            indices[dim] = 0;
+        }
+    }
+    return 0;
+}
+
+int MDStoreDPDataInNumericWave(waveHndl wave, const double* dPtr) {
+    if (wave->type == TEXT_WAVE_TYPE)
+        return NT_INCOMPATIBLE;
+    
+    bool isComplex = ((wave->type & NT_CMPLX) != 0);
+    CountInt nPoints = WavePoints(wave);
+    IndexInt indices[MAX_DIMENSIONS] = {0, 0, 0, 0};
+    double value[2] = {0, 0};
+    for (CountInt i = 0; i < nPoints; ++i) {
+        value[0] = *dPtr++;
+        if (isComplex)
+            value[1] = *dPtr++;
+        int err = MDSetNumericWavePointValue(wave, indices, value);
+        if (err)
+            return err;
+        for (int dim = 0; (dim < wave->numDimensions) && (++indices[dim] == wave->dimensionSizes[dim]); ++dim) {
+            indices[dim] = 0;
+        }
+    }
+    return 0;
+}
+
+int MDSetTextWavePointValue(waveHndl wave, IndexInt indices[MAX_DIMENSIONS], Handle text) {
+    if (wave->type != TEXT_WAVE_TYPE)
+        return NT_INCOMPATIBLE;
+    CountInt pointIndex;
+    int err = PointIndex(wave, indices, pointIndex);
+    if (err)
+        return err;
+    wave->textPoints.at(pointIndex).assign(*text, GetHandleSize(text));
+    return 0;
+}
+
+void XOPNotice(const char* noticePtr) {
+    // Igor uses carriage returns as line separators
+    std::string notice(noticePtr);
+    for (size_t i = 0; i < notice.size(); ++i) {
+        if (notice[i] == '\r')
+            notice[i] = '\n';
+    }
+    fputs(notice.c_str(), stderr);
+}
+
+int GetNativePath(const char* filePathIn, char filePathOut[MAX_PATH_LEN + 1]) {
+    if (strlen(filePathIn) > MAX_PATH_LEN)
+        return GENERAL_BAD_VIBS;
+    strcpy(filePathOut, filePathIn);
+    return 0;
+}
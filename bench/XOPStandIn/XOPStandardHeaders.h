@@ -0,0 +1,104 @@
+/*
+IgorCL - an XOP to use OpenCL in Igor Pro
+Copyright(C) 2013-2017 Peter Dedecker
+
+This program is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see <http://www.gnu.org/licenses/>.
+
+The developer(s) of this software hereby grants permission to link
+this program with Igor Pro, developed by WaveMetrics Inc. (www.wavemetrics.com).
+*/
+
+// Stand-in for the part of the XOP Toolkit that is used by IgorCLOperations.cpp and IgorCLUtilities.cpp,
+// so that the execution core can be built and benchmarked outside of Igor (see bench/CMakeLists.txt).
+// Waves are plain host memory. The error codes are distinct, but do not have the values used by Igor.
+
+#ifndef IgorCL_XOPStandIn_h
+#define IgorCL_XOPStandIn_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+typedef char** Handle;
+typedef struct IgorCLStandInWave* waveHndl;
+typedef struct IgorCLStandInDataFolder* DataFolderHandle;
+typedef intptr_t CountInt;
+typedef intptr_t IndexInt;
+typedef intptr_t BCInt;
+
+#define MAX_DIMENSIONS 4
+#define MAX_OBJ_NAME 31
+#define MAX_PATH_LEN 511
+
+// wave types
+#define NT_CMPLX 1
+#define NT_FP32 2
+#define NT_FP64 4
+#define NT_I8 8
+#define NT_I16 0x10
+#define NT_I32 0x20
+#define NT_I64 0x80
+#define NT_UNSIGNED 0x40
+#define TEXT_WAVE_TYPE 0
+#define WAVE_TYPE 0x4000
+
+// error codes
+#define FIRST_XOP_ERR 10000
+enum {
+    NOMEM = 1,
+    NOWAV,
+    SYNERR,
+    EXPECT_POS_NUM,
+    USING_NULL_STRVAR,
+    NULL_WAVE_OP,
+    GENERAL_BAD_VIBS,
+    NT_INCOMPATIBLE,
+    INCOMPATIBLE_DIMENSIONING,
+    EXPECTED_STRING,
+    COMPLEX_TO_REAL_LOSS,
+    INCOMPATIBLE_FLAGS,
+    INDEX_OUT_OF_RANGE,
+    NOT_IMPLEMENTED
+};
+
+// memory handles
+Handle NewHandle(BCInt size);
+void DisposeHandle(Handle handle);
+BCInt GetHandleSize(Handle handle);
+int SetHandleSize(Handle handle, BCInt size);
+int PutCStringInHandle(const char* str, Handle handle);
+int GetCStringFromHandle(Handle handle, char* str, int maxChars);
+
+// waves
+int WaveType(waveHndl wave);
+CountInt WavePoints(waveHndl wave);
+void* WaveData(waveHndl wave);
+void WaveHandleModified(waveHndl wave);
+int MDMakeWave(waveHndl* wavePtr, const char* waveName, DataFolderHandle dataFolder, CountInt dimensionSizes[MAX_DIMENSIONS + 1], int type, int overwrite);
+int MDGetWaveDimensions(waveHndl wave, int* numDimensionsPtr, CountInt dimensionSizes[MAX_DIMENSIONS + 1]);
+int MDGetNumericWavePointValue(waveHndl wave, IndexInt indices[MAX_DIMENSIONS], double value[2]);
+int MDSetNumericWavePointValue(waveHndl wave, IndexInt indices[MAX_DIMENSIONS], double value[2]);
+int MDGetDPDataFromNumericWave(waveHndl wave, double* dPtr);
+int MDStoreDPDataInNumericWave(waveHndl wave, const double* dPtr);
+int MDSetTextWavePointValue(waveHndl wave, IndexInt indices[MAX_DIMENSIONS], Handle text);
+
+// miscellaneous
+void XOPNotice(const char* noticePtr);
+int GetNativePath(const char* filePathIn, char filePathOut[MAX_PATH_LEN + 1]);
+
+// not part of the XOP Toolkit: waves made by MDMakeWave are owned by the caller and released with this function.
+void IgorCLStandInKillWave(waveHndl wave);
+
+#endif